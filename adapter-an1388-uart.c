@@ -29,6 +29,7 @@ typedef struct {
     /* Common part */
     adapter_t adapter;
 
+    serial_t *serial;
     unsigned char reply [64];
     int reply_len;
 
@@ -118,7 +119,7 @@ static void an1388_command(an1388_adapter_t *a, unsigned char cmd,
         }
         fprintf(stderr, "\n");
     }
-    serial_write(buf, n);
+    serial_write(a->serial, buf, n);
 
     if (cmd == CMD_JUMP_APP) {
         /* No reply expected. */
@@ -129,7 +130,7 @@ static void an1388_command(an1388_adapter_t *a, unsigned char cmd,
     c = 0;
     esc = 0;
     while(1) {
-        res = serial_read(buf, 64, 1000);
+        res = serial_read(a->serial, buf, 64, 1000);
         /* timeout */
         if (res < 0) {
             a->reply_len = 0;
@@ -193,7 +194,7 @@ static void an1388_close(adapter_t *adapter, int power_on)
     an1388_command(a, CMD_JUMP_APP, 0, 0);
 
     /* restore and close serial port */
-    serial_close();
+    serial_close(a->serial);
     free(a);
 }
 
@@ -361,18 +362,19 @@ adapter_t *adapter_open_an1388_uart(const char *port, int baud_rate)
 {
     an1388_adapter_t *a;
 
-    /* open serial port */
-    if (serial_open(port, baud_rate) < 0) {
-        /* failed to open serial port */
-        return 0;
-    }
-
     a = calloc(1, sizeof(*a));
     if (! a) {
         fprintf(stderr, "Out of memory\n");
         return 0;
     }
 
+    /* open serial port */
+    if ((a->serial = serial_open(port, baud_rate)) == 0) {
+        /* failed to open serial port */
+        free(a);
+        return 0;
+    }
+
     /* Read version of adapter. */
     an1388_command(a, CMD_READ_VERSION, 0, 0);
     if (a->reply_len == 0) {
@@ -388,7 +390,7 @@ adapter_t *adapter_open_an1388_uart(const char *port, int baud_rate)
         a->adapter.user_start + a->adapter.user_nbytes - 1);
 
     a->adapter.block_override = 0;
-    a->adapter.flags = (AD_PROBE | AD_ERASE | AD_READ | AD_WRITE);
+    a->adapter.flags = (AD_PROBE | AD_ERASE | AD_READ | AD_WRITE | AD_VERIFY_SPAN);
 
     /* User functions. */
     a->adapter.close = an1388_close;
@@ -400,7 +400,7 @@ adapter_t *adapter_open_an1388(int vid, int pid, const char *serial)
     printf(" Program area: %08x-%08x\n", a->adapter.user_start,
         a->adapter.user_start + a->adapter.user_nbytes - 1);
     a->adapter.block_override = 0;
-    a->adapter.flags = (AD_PROBE | AD_ERASE | AD_READ | AD_WRITE);
+    a->adapter.flags = (AD_PROBE | AD_ERASE | AD_READ | AD_WRITE | AD_VERIFY_SPAN);
 
     /* User functions. */
     a->adapter.close = an1388_close;
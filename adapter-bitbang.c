@@ -37,8 +37,11 @@ typedef struct {
     unsigned Read2Count;            // number of calls to serial_read (handshakes)
     unsigned FDataCount;            // number of calls to xfer_fastdata
     unsigned DelayCount[4];         // number of calls to delay10mS (erase, xfer inst, PE resp, other)
+    unsigned erase_status;          // last status polled during chip erase
     struct timeval T1, T2;          // record start and finishing timestamps
 
+    serial_t *serial;               // serial port of the programmer
+
     unsigned use_executive;
     unsigned serial_execution_mode;
 } bitbang_adapter_t;
@@ -86,7 +89,7 @@ static void bitbang_delay10mS(bitbang_adapter_t *a, int caller)
     unsigned char ch;
 
     ch = '8';
-    serial_write(&ch, 1);
+    serial_write(a->serial, &ch, 1);
     a->WriteCount++;
     a->DelayCount[caller]++;
 }
@@ -256,7 +259,7 @@ static void bitbang_send(bitbang_adapter_t *a,
 
         a->PendingHandshake = 0;
 
-        n = serial_read(&ch, 1, 250);
+        n = serial_read(a->serial, &ch, 1, 250);
         a->Read2Count++;
 
         if (n != 1 || ch != '<')
@@ -303,7 +306,7 @@ static void bitbang_send(bitbang_adapter_t *a,
                 index, buffer, read_flag, L4,  L3,  L2,  L1);
     }
 
-    serial_write(buffer, index);
+    serial_write(a->serial, buffer, index);
     a->WriteCount++;
 }
 
@@ -327,7 +330,7 @@ static unsigned long long bitbang_recv(bitbang_adapter_t *a)
 
     int expected = (CFG4 ? a->CharToRead : a->BitsToRead);
 
-    n = serial_read(buffer, expected, 250);
+    n = serial_read(a->serial, buffer, expected, 250);
     a->TotalCodeChrsRecv += n;
     a->Read1Count++;
     buffer[n] = 0;              // append trailing zero so can print as a string
@@ -388,7 +391,7 @@ static void bitbang_ICSP_enable(bitbang_adapter_t *a, int ICSP_EN)
                                  // 0000000001111111111222222222233333333334444444444555555555566666
                                  // 1234567890123456789012345678901234567890123456789012345678901234
 
-        serial_write(buffer, 64);
+        serial_write(a->serial, buffer, 64);
         usleep(150000);    // 150mS delay to allow the above to percolate through the system
     }
     else
@@ -398,7 +401,7 @@ static void bitbang_ICSP_enable(bitbang_adapter_t *a, int ICSP_EN)
                                  // 0000000001111111
                                  // 1234567890123456
 
-        serial_write(buffer, 16);
+        serial_write(a->serial, buffer, 16);
 
         // 100mS delay to allow the above to percolate through the system
         usleep(100000);
@@ -439,10 +442,11 @@ static void bitbang_close(adapter_t *adapter, int power_on)
     printf("10mS delays (E/X/R)      = %i/%i/%i\n", a->DelayCount[0],
                                                     a->DelayCount[1],
                                                     a->DelayCount[2]);
+    mwait_stats();
     printf("elapsed programming time = %lum %02lus\n", (a->T2.tv_sec - a->T1.tv_sec) / 60,
                                                        (a->T2.tv_sec - a->T1.tv_sec) % 60);
 
-    serial_close();                    // at this point we are exiting application???
+    serial_close(a->serial);                    // at this point we are exiting application???
 //  free(a);                           // suspect this line was causing XP CRASHES
                                        // - shouldn't be needed anyway
 }
@@ -681,7 +685,7 @@ static void bitbang_read_data(adapter_t *adapter,
     unsigned addr, unsigned nwords, unsigned *data)
 {
     bitbang_adapter_t *a = (bitbang_adapter_t*) adapter;
-    unsigned words_read, i;
+    unsigned words_read, i, n;
 
     if (DBG2)
         fprintf(stderr, "read_data\n");
@@ -696,10 +700,13 @@ static void bitbang_read_data(adapter_t *adapter,
     }
 
     /* Use PE to read memory. */
-    for (words_read = 0; words_read < nwords; words_read += 32) {
+    for (words_read = 0; words_read < nwords; words_read += n) {
+        n = nwords - words_read;
+        if (n > 32)
+            n = 32;
 
         bitbang_send(a, 1, 1, 5, ETAP_FASTDATA, 0);
-        xfer_fastdata(a, PE_READ << 16 | 32);       /* Read 32 words */
+        xfer_fastdata(a, PE_READ << 16 | n);        /* Read up to 32 words */
         xfer_fastdata(a, addr);                     /* Address */
 
         unsigned response = get_pe_response(a);     /* Get response */
@@ -708,13 +715,42 @@ static void bitbang_read_data(adapter_t *adapter,
                                                response,     PE_READ << 16);
             exit(-1);
         }
-        for (i = 0; i < 32; i++) {
+        for (i = 0; i < n; i++) {
             *data++ = get_pe_response(a);           /* Get data */
         }
-        addr += 32 * 4;
+        addr += n * 4;
     }
 }
 
+/*
+ * Check that CPU waits for a processor access:
+ * PE loader or PE is ready to get FASTDATA.
+ */
+static int bitbang_pracc_ready(void *arg)
+{
+    bitbang_adapter_t *a = arg;
+    unsigned ctl;
+
+    bitbang_send(a, 1, 1, 5, ETAP_CONTROL, 0);        /* Send command. */
+    bitbang_send(a, 0, 0, 32, CONTROL_PRACC |         /* Xfer data. */
+                              CONTROL_PROBEN |
+                              CONTROL_PROBTRAP, 1);
+    ctl = bitbang_recv(a);
+    return (ctl & CONTROL_PRACC) != 0;
+}
+
+/*
+ * Wait for PE loader or PE, and select FASTDATA register again.
+ */
+static void bitbang_wait_pe(bitbang_adapter_t *a)
+{
+    if (mwait("PE start", bitbang_pracc_ready, a, 0, 30) < 0) {
+        fprintf(stderr, "\nPE does not respond\n");
+        exit(-1);
+    }
+    bitbang_send(a, 1, 1, 5, ETAP_FASTDATA, 0);       /* Send command. */
+}
+
 /*
  * Download programming executive (PE).
  */
@@ -803,21 +839,22 @@ static void bitbang_load_executive(adapter_t *adapter,
     for (i = 0; i < nwords; i++) {
         xfer_fastdata(a, *pe++);
     }
-    bitbang_delay10mS(a, 3);
+    bitbang_wait_pe(a);
     printf(" 7b");
     fflush(stdout);
 
     /* Download the PE instructions. */
     xfer_fastdata(a, 0);                       /* Step 8 - jump to PE. */
     xfer_fastdata(a, 0xDEAD0000);
-    bitbang_delay10mS(a, 3);
+    bitbang_wait_pe(a);
     printf(" 8");
     fflush(stdout);
 
     xfer_fastdata(a, PE_EXEC_VERSION << 16);
 
     unsigned version = get_pe_response(a);
-    if (version != (PE_EXEC_VERSION << 16 | pe_version)) {
+    if ((version >> 16) != PE_EXEC_VERSION ||
+        (pe_version != 0 && (version & 0xffff) != pe_version)) {
         fprintf(stderr, "\nbad PE version = %08x, expected %08x\n",
                        version, PE_EXEC_VERSION << 16 | pe_version);
         exit(-1);
@@ -827,6 +864,20 @@ static void bitbang_load_executive(adapter_t *adapter,
 
     if (debug_level > 0)
         fprintf(stderr, "PE version = %04x\n", version & 0xffff);
+    a->adapter.pe_version = version & 0xffff;
+}
+
+/*
+ * Check that chip erase is finished.
+ */
+static int bitbang_erase_done(void *arg)
+{
+    bitbang_adapter_t *a = arg;
+
+    bitbang_send(a, 0, 0, 8, MCHP_STATUS, 1);    /* Xfer data. */
+    a->erase_status = bitbang_recv(a);
+    return (a->erase_status & (MCHP_STATUS_CFGRDY |
+                               MCHP_STATUS_FCBUSY)) == MCHP_STATUS_CFGRDY;
 }
 
 /*
@@ -846,21 +897,12 @@ static void bitbang_erase_chip(adapter_t *adapter)
     if (memcmp(a->adapter.family_name, "mz", 2) == 0)
         bitbang_send(a, 0, 0, 8, MCHP_DEASSERT_RST, 0);      // needed for PIC32MZ devices only.
 
-    int i = 0;
-    unsigned status;
-    do {
-        bitbang_delay10mS(a, 0);
-        bitbang_send(a, 0, 0, 8, MCHP_STATUS, 1);    /* Xfer data. */
-        status = bitbang_recv(a);
-        i++;
-    } while ((status & (MCHP_STATUS_CFGRDY |
-                        MCHP_STATUS_FCBUSY)) != MCHP_STATUS_CFGRDY && i < 100);
-
-    if (i == 100) {
-        fprintf(stderr, "invalid status = %04x (in erase chip)\n", status);
+    int msec = mwait("erase", bitbang_erase_done, a, 10, a->adapter.erase_msec);
+    if (msec < 0) {
+        fprintf(stderr, "invalid status = %04x (in erase chip)\n", a->erase_status);
         exit(-1);
     }
-    printf("(%imS) ", i * 10);
+    printf("(%imS) ", msec);
     fflush(stdout);
 }
 
@@ -952,6 +994,93 @@ static void bitbang_program_row(adapter_t *adapter, unsigned addr,
     }
 }
 
+/*
+ * Flash write a span of rows by one PE command.
+ */
+static void bitbang_program_cluster(adapter_t *adapter, unsigned addr,
+    unsigned nwords, unsigned *data)
+{
+    bitbang_adapter_t *a = (bitbang_adapter_t*) adapter;
+    unsigned i, response;
+
+    if (debug_level > 0)
+        fprintf(stderr, "cluster program %u words at %08x\n", nwords, addr);
+    if (! a->use_executive) {
+        fprintf(stderr, "cluster program needs PE\n");
+        exit(-1);
+    }
+
+    bitbang_send(a, 1, 1, 5, ETAP_FASTDATA, 0);  /* Send command. */
+    xfer_fastdata(a, PE_PROGRAM_CLUSTER << 16);
+    xfer_fastdata(a, addr);                      /* Send address. */
+    xfer_fastdata(a, nwords * 4);                /* Send length in bytes. */
+
+    /* Download data. */
+    for (i = 0; i < nwords; i++) {
+        xfer_fastdata(a, *data++);               /* Send word. */
+    }
+
+    response = get_pe_response(a);
+    if (response != (PE_PROGRAM_CLUSTER << 16)) {
+        fprintf(stderr, "\nfailed to program cluster at %08x, reply = %08x\n",
+                                                         addr,         response);
+        exit(-1);
+    }
+}
+
+/*
+ * Erase a page of flash memory, by PE.
+ */
+static void bitbang_erase_page(adapter_t *adapter, unsigned addr)
+{
+    bitbang_adapter_t *a = (bitbang_adapter_t*) adapter;
+    unsigned response;
+
+    if (debug_level > 0)
+        fprintf(stderr, "erase page at %08x\n", addr);
+    if (! a->use_executive) {
+        fprintf(stderr, "page erase needs PE\n");
+        exit(-1);
+    }
+
+    bitbang_send(a, 1, 1, 5, ETAP_FASTDATA, 0);  /* Send command. */
+    xfer_fastdata(a, PE_PAGE_ERASE << 16 | 1);
+    xfer_fastdata(a, addr);                      /* Send address. */
+
+    response = get_pe_response(a);
+    if (response != (PE_PAGE_ERASE << 16)) {
+        fprintf(stderr, "\nfailed to erase page at %08x, reply = %08x\n",
+                                                addr,       response);
+        exit(-1);
+    }
+}
+
+/*
+ * Check that memory is erased, by PE.
+ * Return 1 when blank, 0 when not, -1 when PE is not loaded.
+ */
+static int bitbang_blank_check(adapter_t *adapter,
+    unsigned addr, unsigned nwords)
+{
+    bitbang_adapter_t *a = (bitbang_adapter_t*) adapter;
+    unsigned response;
+
+    if (! a->use_executive)
+        return -1;
+
+    bitbang_send(a, 1, 1, 5, ETAP_FASTDATA, 0);  /* Send command. */
+    xfer_fastdata(a, PE_BLANK_CHECK << 16);
+    xfer_fastdata(a, addr);                      /* Send address. */
+    xfer_fastdata(a, nwords * 4);                /* Send length. */
+
+    response = get_pe_response(a);
+    if (response >> 16 != PE_BLANK_CHECK) {
+        fprintf(stderr, "\nbad BLANK_CHECK response = %08x\n", response);
+        exit(-1);
+    }
+    return (response & 0xffff) == 0;
+}
+
 /*
  * Verify a block of memory.
  */
@@ -1035,9 +1164,9 @@ adapter_t *adapter_open_bitbang(const char *port, int baud_rate)
         unsigned char buffer [140];                     // 0x80 + 12d (max used is 133)
         int bps[] = {0, 9600, 19200, 57600, 115200 };   // known arduino bootloader baud rates
 
-        if (serial_open(port, bps[baud_rate]) < 0) {
+        serial_t *serial = serial_open(port, bps[baud_rate]);
+        if (! serial) {
             fprintf(stderr, "Unable to configure serial port %s\n", port);
-            serial_close();
             exit(-1);
         }
         printf("%i baud ", bps[baud_rate]);
@@ -1048,40 +1177,40 @@ adapter_t *adapter_open_bitbang(const char *port, int baud_rate)
             buffer[0] = STK_GET_SYNC;                   // get synchronization
             buffer[1] = CRC_EOP;
 
-            serial_write(buffer, 2);
+            serial_write(serial, buffer, 2);
             printf(".");
             fflush(stdout);
-            n = serial_read(buffer, 2, 100);
+            n = serial_read(serial, buffer, 2, 100);
             if ((n == 2) && (buffer[0] == STK_INSYNC) && (buffer[1] == STK_OK))
                 i = 100;
         }
 
         if (i < 100) {
             fprintf(stderr, "\nFailed to find arduino/STK500 bootloader\n");
-            serial_close();
+            serial_close(serial);
             exit(-1);
         }
         printf(" synchronized\n");
 
         buffer[0] = STK_ENTER_PROGMODE;                 // enter program mode (not needed)
         buffer[1] = CRC_EOP;
-        serial_write(buffer, 2);
-        n = serial_read(buffer, 2, 100);
+        serial_write(serial, buffer, 2);
+        n = serial_read(serial, buffer, 2, 100);
 
         if ((n != 2) || (buffer[0] != STK_INSYNC) || (buffer[1] != STK_OK)) {
             fprintf(stderr, "Failed to enter program mode\n");
-            serial_close();
+            serial_close(serial);
             exit(-1);
         }
 
         buffer[0] = STK_READ_SIGN;                      // read signature bytes (3)
         buffer[1] = CRC_EOP;
-        serial_write(buffer, 2);
-        n = serial_read(buffer, 5, 100);
+        serial_write(serial, buffer, 2);
+        n = serial_read(serial, buffer, 5, 100);
 
         if ((n != 5) || (buffer[0] != STK_INSYNC) || (buffer[4] != STK_OK)) {
             fprintf(stderr, "Failed to get signature\n");
-            serial_close();
+            serial_close(serial);
             exit(-1);
         }
         unsigned ID = (buffer[1] << 16) + (buffer[2] << 8) + buffer[3];
@@ -1100,12 +1229,12 @@ adapter_t *adapter_open_bitbang(const char *port, int baud_rate)
             buffer[1] = (i >> 1) % 0x100;               // address low (word boundary)
             buffer[2] = (i >> 1) / 0x100;               // address high
             buffer[3] = CRC_EOP;
-            serial_write(buffer, 4);
-            n = serial_read(buffer, 2, 100);
+            serial_write(serial, buffer, 4);
+            n = serial_read(serial, buffer, 2, 100);
 
             if ((n != 2) || (buffer[0] != STK_INSYNC) || (buffer[1] != STK_OK)) {
                 fprintf(stderr, "\nFailed to load address %04x\n", i);
-                serial_close();
+                serial_close(serial);
                 exit(-1);
             }
 
@@ -1115,12 +1244,12 @@ adapter_t *adapter_open_bitbang(const char *port, int baud_rate)
             buffer[3] = 'F';                            // memory type: 'E' = eeprom, 'F' = flash
             memcpy(&buffer[4], &ICSP[i], 0x80);         // data (128 bytes)
             buffer[4 + 0x80] = CRC_EOP;
-            serial_write(buffer, 4 + 0x80 + 1);
-            n = serial_read(buffer, 2, 100);
+            serial_write(serial, buffer, 4 + 0x80 + 1);
+            n = serial_read(serial, buffer, 2, 100);
 
             if ((n != 2) || (buffer[0] != STK_INSYNC) || (buffer[1] != STK_OK)) {
                 fprintf(stderr, "\nFailed to program page\n");
-                serial_close();
+                serial_close(serial);
                 exit(-1);
             }
         }
@@ -1128,16 +1257,16 @@ adapter_t *adapter_open_bitbang(const char *port, int baud_rate)
 
         buffer[0] = STK_LEAVE_PROGMODE;                 // leave program mode
         buffer[1] = CRC_EOP;
-        serial_write(buffer, 2);
-        n = serial_read(buffer, 2, 100);
+        serial_write(serial, buffer, 2);
+        n = serial_read(serial, buffer, 2, 100);
 
         if ((n != 2) || (buffer[0] != STK_INSYNC) || (buffer[1] != STK_OK)) {
             fprintf(stderr, "Failed to exit program mode\n");
-            serial_close();
+            serial_close(serial);
             exit(-1);
         }
         printf("Firmware uploaded to 'ascii ICSP' adapter OK\n");
-        serial_close();
+        serial_close(serial);
 #else
         printf("Firmware upload to arduino/STK500 not included\n");
 #endif
@@ -1155,10 +1284,9 @@ adapter_t *adapter_open_bitbang(const char *port, int baud_rate)
     }
 
     /* Open serial port */
-    if (serial_open(port, 115200) < 0) {
+    if ((a->serial = serial_open(port, 115200)) == 0) {
         /* failed to open serial port */
         fprintf(stderr, "Unable to configure serial port %s\n", port);
-        serial_close();
         free(a);
         return 0;
     }
@@ -1174,21 +1302,21 @@ adapter_t *adapter_open_bitbang(const char *port, int baud_rate)
     unsigned char ch;
     for (i = 0; i < 40; i++) {
         ch = '>';
-        serial_write(&ch, 1);
+        serial_write(a->serial, &ch, 1);
         ch = (i < 20 ? '.': ':');
         if (i == 20)
             for (n = 0; n < 20; n++ )
                 printf("\b");
         printf("%c", ch);
         fflush(stdout);
-        n = serial_read(&ch, 1, 250);
+        n = serial_read(a->serial, &ch, 1, 250);
         if (n == 1 && ch == '<')
             i = 100;
     }
 
     if (i < 100) {
         fprintf(stderr, "\nNo response from 'ascii ICSP' adapter\n");
-        serial_close();
+        serial_close(a->serial);
         free(a);
         return 0;
     }
@@ -1198,14 +1326,14 @@ adapter_t *adapter_open_bitbang(const char *port, int baud_rate)
     ch = '?';
     unsigned char buffer[15] = "..............\0";
                             // "ascii ICSP v1X"
-    serial_write(&ch, 1);
-    n = serial_read(buffer, 14, 250);
+    serial_write(a->serial, &ch, 1);
+    n = serial_read(a->serial, buffer, 14, 250);
 
     if (n == 14 && memcmp(buffer, "ascii ICSP v1", 13) == 0)
         printf(" OK2 - %s\n", buffer);
     else {
         fprintf(stderr, "\nBad response from 'ascii ICSP' adapter\n");
-        serial_close();
+        serial_close(a->serial);
         free(a);
         return 0;
     }
@@ -1262,7 +1390,7 @@ adapter_t *adapter_open_bitbang(const char *port, int baud_rate)
         bitbang_send(a, 0, 0, 8, MCHP_STATUS, 1);       /* Xfer data. */
         usleep(1000000);                                // allow 1 second for erase to complete
         bitbang_ICSP_enable(a, 0);                      // shut down target
-        serial_close();
+        serial_close(a->serial);
         free(a);
         exit(0);                                        // finished performing function, exit program
     }
@@ -1278,7 +1406,7 @@ adapter_t *adapter_open_bitbang(const char *port, int baud_rate)
         if (debug_level > 0 || (idcode != 0 && idcode != 0xffffffff))
             fprintf(stderr, "incompatible CPU detected, IDCODE=%08x\n", idcode);
         bitbang_ICSP_enable(a, 0);                      // shut down target
-        serial_close();
+        serial_close(a->serial);
         free(a);
         return 0;
     }
@@ -1305,7 +1433,7 @@ adapter_t *adapter_open_bitbang(const char *port, int baud_rate)
 #endif
         fprintf(stderr, "invalid status = %04x (in open)\n", status);       // 5.
         bitbang_ICSP_enable(a, 0);                  // shut down target
-        serial_close();
+        serial_close(a->serial);
         free(a);
         return 0;
     }
@@ -1321,7 +1449,11 @@ adapter_t *adapter_open_bitbang(const char *port, int baud_rate)
 //
 
     a->adapter.block_override = 0;
-    a->adapter.flags = AD_PROBE | AD_ERASE | AD_READ | AD_WRITE;
+    a->adapter.flags = AD_PROBE | AD_ERASE | AD_READ | AD_WRITE | AD_VERIFY_SPAN;
+
+    /* Serial link at 115200 baud, about four bits per character. */
+    a->adapter.round_trip_usec = 2000;
+    a->adapter.bytes_per_sec = 115200 / 10 / 2;
 
     /* User functions. */
     a->adapter.close = bitbang_close;
@@ -1330,8 +1462,11 @@ adapter_t *adapter_open_bitbang(const char *port, int baud_rate)
     a->adapter.read_word = bitbang_read_word;
     a->adapter.read_data = bitbang_read_data;
     a->adapter.verify_data = bitbang_verify_data;
+    a->adapter.blank_check = bitbang_blank_check;
+    a->adapter.erase_page = bitbang_erase_page;
     a->adapter.erase_chip = bitbang_erase_chip;
     a->adapter.program_word = bitbang_program_word;
     a->adapter.program_row = bitbang_program_row;
+    a->adapter.program_cluster = bitbang_program_cluster;
     return &a->adapter;
 }
@@ -49,6 +49,24 @@ typedef struct {
     uint16_t icsp_oe_inverted;
 } device_t;
 
+/*
+ * ICSP bit slot: write TDI and TMS, switch PGED to input,
+ * clock two bits (reading TDO), switch PGED back to output.
+ */
+#define ICSP_SLOT_BYTES         18
+
+/*
+ * Location and bit layout of one queued read in the input buffer.
+ */
+typedef struct {
+    int offset;                     /* Offset in input buffer */
+    int nbytes;                     /* Bytes received (bits in ICSP mode) */
+    unsigned long long fix_high_bit;
+    unsigned long long high_byte_mask;
+    unsigned long long high_bit_mask;
+    unsigned high_byte_bits;
+} mpsse_read_t;
+
 typedef struct {
     /* Common part */
     adapter_t adapter;
@@ -59,17 +77,19 @@ typedef struct {
     libusb_context *context;
 
     /* Transmit buffer for MPSSE packet. */
-    unsigned char output [256*16];
+    unsigned char output [256*256];
     int bytes_to_write;
 
-    /* Receive buffer. */
-    unsigned char input [256];  /* Increased for ICSP, just in case */
+    /* Receive buffer, grows as needed. */
+    unsigned char *input;
+    int input_size;
     int bytes_to_read;
-    int bytes_per_word;
-    unsigned long long fix_high_bit;
-    unsigned long long high_byte_mask;
-    unsigned long long high_bit_mask;
-    unsigned high_byte_bits;
+    int max_read_bytes;             /* Limit of reply data per flush */
+    int max_packet;                 /* Size of USB packet from the adapter */
+
+    /* Reads queued since the last flush. */
+    mpsse_read_t *reads;
+    int nreads, reads_size;
 
     /* Mapping of /TRST, /SYSRST and LED control signals. */
     unsigned trst_control, trst_inverted;
@@ -80,10 +100,26 @@ typedef struct {
     unsigned dir_control;
     unsigned extra_output;
 
-    unsigned mhz;
+    unsigned mhz;                   /* Max TCK rate: 6 for FT2232D, 30 for H series */
+    int latency;                    /* Current latency timer, or -1 */
     unsigned interface;
     unsigned use_executive;
     unsigned serial_execution_mode;
+    unsigned read_loop_loaded;      /* Fast read loop is in RAM */
+    unsigned khz;                   /* Current TCK frequency */
+    unsigned autospeed;             /* Tune TCK after PE is loaded */
+    unsigned idcode;                /* IDCODE of the target */
+    char serial [64];               /* Serial number of the adapter */
+
+    /* Precomputed MPSSE commands for one ICSP bit slot,
+     * indexed by TDI | TMS<<1 | read<<2. */
+    unsigned char icsp_bit [8] [ICSP_SLOT_BYTES];
+    unsigned char icsp_prefix [7];
+    int icsp_templates_ready;
+
+    /* Cached state of the target TAP. */
+    int tap;                        /* TAP_SW_MTAP, TAP_SW_ETAP, or 0 when unknown */
+    int ir;                         /* Instruction register, or -1 when unknown */
 } mpsse_adapter_t;
 
 /*
@@ -98,6 +134,7 @@ typedef struct {
 #define FTDI_DEFAULT_VID        0x0403  /* Neofoxx JTAG/SWD debug probe, Bus Blaster v2, Flyswatter, ...*/
 #define FTDI_DEFAULT_FT2232_PID 0x6010
 #define FTDI_DEFAULT_FT4232_PID 0x6011
+#define FTDI_DEFAULT_FT232H_PID 0x6014
 
 /*
  * USB endpoints.
@@ -161,10 +198,24 @@ static const device_t devlist[] = {
     { FTDI_DEFAULT_VID,     FTDI_DEFAULT_FT2232_PID,    "Neofoxx JTAG/SWD adapter",         30,  0xff3b, 0x0100, 1,  0x0200,  1,   0x8000,  1, "Neofoxx JTAG/SWD adapter", 0x0000, 0x0020, 1, 0x1000, 0},
     { FTDI_DEFAULT_VID,     FTDI_DEFAULT_FT2232_PID,    "Dangerous Prototypes Bus Blaster", 30,  0x0f10, 0x0100, 1,  0x0200,  1,   0x0000,  0, NULL, 0x0000, 0x0100, 1, 0x0008, 1},
     { FTDI_DEFAULT_VID,     FTDI_DEFAULT_FT4232_PID,    "Generic FT4232H adapter",          30,  0x0f10, 0x0100, 1,  0x0200,  1,   0x0000,  0, NULL, 0x0000, 0x0100, 1, 0x0008, 1},
+    { FTDI_DEFAULT_VID,     FTDI_DEFAULT_FT232H_PID,    "Generic FT232H adapter",           30,  0x0f10, 0x0100, 1,  0x0200,  1,   0x0000,  0, NULL, 0x0000, 0x0100, 1, 0x0008, 1},
 
     { 0 }
 };
 
+/*
+ * USB ids of known adapters, for autodetection.
+ * Return 0 after the last one.
+ */
+int adapter_mpsse_id(int index, unsigned short *vid, unsigned short *pid)
+{
+    if (index < 0 || devlist[index].vid == 0)
+        return 0;
+    *vid = devlist[index].vid;
+    *pid = devlist[index].pid;
+    return 1;
+}
+
 /*
  * Calculate checksum.
  */
@@ -186,6 +237,29 @@ static unsigned calculate_crc(unsigned crc, unsigned char *data, unsigned nbytes
     return crc & 0xffff;
 }
 
+/*
+ * Latency timer of FTDI chip: how long the chip holds
+ * a partial packet of reply data before sending it.
+ */
+#define LATENCY_INTERACTIVE(a)  (((a)->mhz > 6) ? 0 : 1)
+#define LATENCY_BATCHED         16
+
+/*
+ * Set the latency timer, when changed.
+ */
+static void mpsse_latency(mpsse_adapter_t *a, int msec)
+{
+    if (a->latency == msec)
+        return;
+    if (libusb_control_transfer(a->usbdev,
+        LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_OUT,
+        SIO_SET_LATENCY_TIMER, msec, 1, 0, 0, 1000) != 0) {
+        fprintf(stderr, "%s: unable to set latency timer\n", a->name);
+        exit(-1);
+    }
+    a->latency = msec;
+}
+
 /*
  * Send a packet to USB device.
  */
@@ -220,60 +294,79 @@ static void bulk_write(mpsse_adapter_t *a, unsigned char *output, int nbytes)
  */
 static void mpsse_flush_output(mpsse_adapter_t *a)
 {
-    int bytes_read, n;
-    unsigned char reply [64];
-    uint64_t icspTemp = 0;
+    int bytes_read, n, k;
+    unsigned char reply [4096];
 
     if (a->bytes_to_write <= 0)
         return;
 
+    if (a->bytes_to_read > 0) {
+        /* Replies of many packets are sent as soon as a packet is full:
+         * use long latency to avoid status-only packets.
+         * Short round trips need the shortest latency. */
+        mpsse_latency(a, (a->bytes_to_read > a->max_packet - 2) ?
+            LATENCY_BATCHED : LATENCY_INTERACTIVE(a));
+
+        /* Command "send immediate": don't wait for the latency timer
+         * with the last packet. */
+        if (a->bytes_to_write < sizeof(a->output))
+            a->output [a->bytes_to_write++] = 0x87;
+    }
     bulk_write(a, a->output, a->bytes_to_write);
     a->bytes_to_write = 0;
     if (a->bytes_to_read <= 0)
         return;
 
+    if (a->bytes_to_read > a->input_size) {
+        a->input_size = a->bytes_to_read;
+        a->input = realloc(a->input, a->input_size);
+        if (! a->input) {
+            fprintf(stderr, "%s: out of memory\n", a->name);
+            exit(-1);
+        }
+    }
+
     /* Get reply. */
     bytes_read = 0;
     while (bytes_read < a->bytes_to_read) {
+        /* Every USB packet starts with two FTDI status bytes.
+         * Ask for whole packets, enough for the remaining data. */
+        int npackets = (a->bytes_to_read - bytes_read + a->max_packet - 3) /
+                       (a->max_packet - 2);
+        if (npackets > (int) sizeof(reply) / a->max_packet)
+            npackets = sizeof(reply) / a->max_packet;
+
         int ret = libusb_bulk_transfer(a->usbdev, OUT_EP, (unsigned char*) reply,
-            a->bytes_to_read - bytes_read + 2, &n, 2000);
+            npackets * a->max_packet, &n, 2000);
         if (ret != 0) {
             fprintf(stderr, "usb bulk read failed\n");
             exit(-1);
         }
         if (debug_level > 1) {
-            if (n != a->bytes_to_read + 2)
-                fprintf(stderr, "usb bulk read %d bytes of %d\n",
-                    n, a->bytes_to_read - bytes_read + 2);
-            else {
-                int i;
-                fprintf(stderr, "usb bulk read %d bytes:", n);
-                for (i=0; i<n; i++)
-                    fprintf(stderr, "%c%02x", i ? '-' : ' ', reply[i]);
-                fprintf(stderr, "\n");
-            }
+            int i;
+            fprintf(stderr, "usb bulk read %d bytes:", n);
+            for (i=0; i<n; i++)
+                fprintf(stderr, "%c%02x", i ? '-' : ' ', reply[i]);
+            fprintf(stderr, "\n");
         }
-        if (n > 2) {
-            if (INTERFACE_JTAG == a->interface || INTERFACE_DEFAULT == a->interface)
-            {
-                /* Copy data. */
-                memcpy(a->input + bytes_read, reply + 2, n - 2);
-            }
-            else{
-                /* Else ICSP. Do data reconstruction from the bytes */
-                int counter;
-                for (counter=2; counter<n; counter++){
-                    icspTemp = icspTemp>>1 | ((reply[counter]&0x80) ? (1ULL<<63) : 0);
-                }
+
+        /* Strip status bytes at every packet boundary, and copy data.
+         * In ICSP mode, every byte holds one TDO bit,
+         * it is unpacked later by mpsse_unpack(). */
+        for (k=0; k<n; k+=a->max_packet) {
+            int len = n - k;
+
+            if (len > a->max_packet)
+                len = a->max_packet;
+            len -= 2;
+            if (len > a->bytes_to_read - bytes_read)
+                len = a->bytes_to_read - bytes_read;
+            if (len > 0) {
+                memcpy(a->input + bytes_read, reply + k + 2, len);
+                bytes_read += len;
             }
-            bytes_read += n - 2;
         }
     }
-    if (INTERFACE_ICSP == a->interface){
-        /* Since data is LSB, shift data to far right */
-        icspTemp = icspTemp>>((63+1) - a->bytes_to_read);
-        memcpy(a->input, &icspTemp, sizeof(uint64_t));        
-    }
     if (debug_level > 1) {
         int i;
         fprintf(stderr, "mpsse_flush_output received %d bytes:", a->bytes_to_read);
@@ -284,12 +377,55 @@ static void mpsse_flush_output(mpsse_adapter_t *a)
     a->bytes_to_read = 0;
 }
 
+/*
+ * Allocate a record for a new queued read.
+ * The first read after a flush starts a new batch.
+ */
+static mpsse_read_t *mpsse_new_read(mpsse_adapter_t *a)
+{
+    mpsse_read_t *r;
+
+    if (a->bytes_to_read == 0)
+        a->nreads = 0;
+    if (a->nreads >= a->reads_size) {
+        a->reads_size = a->reads_size ? a->reads_size * 2 : 64;
+        a->reads = realloc(a->reads, a->reads_size * sizeof(mpsse_read_t));
+        if (! a->reads) {
+            fprintf(stderr, "%s: out of memory\n", a->name);
+            exit(-1);
+        }
+    }
+    r = &a->reads[a->nreads++];
+    memset(r, 0, sizeof(*r));
+    r->offset = a->bytes_to_read;
+    return r;
+}
+
+/*
+ * How many reads of the given size can be queued before a flush.
+ * out_bytes - max size of MPSSE commands for one read,
+ * in_bytes - size of reply for one read.
+ */
+static unsigned mpsse_read_capacity(mpsse_adapter_t *a,
+    unsigned out_bytes, unsigned in_bytes)
+{
+    unsigned n = (a->max_read_bytes - a->bytes_to_read) / in_bytes;
+    unsigned m = (sizeof(a->output) - a->bytes_to_write) / out_bytes;
+
+    if (n > m)
+        n = m;
+    return n ? n : 1;
+}
+
 /*  Renamed function to mpsse_setPins, since it does more than just reset. 
  *  Now controls state of reset (always SYSRST), LED,
  *  ICSP select and ICSP output enable pins */
 
-static void mpsse_setPins(mpsse_adapter_t *a, int sysrst, int led,
-                            int icsp, int icsp_oe, int immediateWrite)
+/*
+ * Compute MPSSE commands to set the pins: 6 bytes.
+ */
+static void mpsse_pins(mpsse_adapter_t *a, int sysrst, int led,
+                            int icsp, int icsp_oe, unsigned char *cmd)
 {
     unsigned output    = 0x0008 | a->extra_output;  /* TMS idle high, OE pins etc. */
     unsigned direction = 0x000b | a->dir_control;
@@ -320,14 +456,29 @@ static void mpsse_setPins(mpsse_adapter_t *a, int sysrst, int led,
 	}
 
     /* command "set data bits low byte" */
-    a->output [a->bytes_to_write++] = 0x80;
-    a->output [a->bytes_to_write++] = output;
-    a->output [a->bytes_to_write++] = direction;
+    cmd[0] = 0x80;
+    cmd[1] = output;
+    cmd[2] = direction;
 
     /* command "set data bits high byte" */
-    a->output [a->bytes_to_write++] = 0x82;
-    a->output [a->bytes_to_write++] = output >> 8;
-    a->output [a->bytes_to_write++] = direction >> 8;
+    cmd[3] = 0x82;
+    cmd[4] = output >> 8;
+    cmd[5] = direction >> 8;
+}
+
+static void mpsse_setPins(mpsse_adapter_t *a, int sysrst, int led,
+                            int icsp, int icsp_oe, int immediateWrite)
+{
+    unsigned char *cmd = &a->output [a->bytes_to_write];
+
+    if (sysrst) {
+        /* Target reset: TAP state is lost. */
+        a->tap = 0;
+        a->ir = -1;
+    }
+
+    mpsse_pins(a, sysrst, led, icsp, icsp_oe, cmd);
+    a->bytes_to_write += 6;
 
     if (immediateWrite)
         mpsse_flush_output(a);
@@ -335,7 +486,62 @@ static void mpsse_setPins(mpsse_adapter_t *a, int sysrst, int led,
     if (debug_level>1)
         fprintf(stderr, "mpsse_setPins(sysrst=%d, led=%d, icsp=%d, icsp_oe=%d)\
                          output=%04x, direction: %04x\n",
-                        sysrst, led, icsp, icsp_oe, output, direction);
+                        sysrst, led, icsp, icsp_oe,
+                        cmd[1] | cmd[4] << 8, cmd[2] | cmd[5] << 8);
+}
+
+/*
+ * Build MPSSE command templates for ICSP bit slots.
+ * Pin settings don't change while in ICSP mode,
+ * so every slot is a fixed sequence of 18 bytes.
+ */
+static void mpsse_icsp_templates(mpsse_adapter_t *a)
+{
+    unsigned char pins_out[6], pins_in[6];
+    int i;
+
+    mpsse_pins(a, 0, 1, 1, 0, pins_out);    /* No Reset, LED, ICSP, ICSP_OE == OUTPUT */
+    mpsse_pins(a, 0, 1, 1, 1, pins_in);     /* No Reset, LED, ICSP, ICSP_OE == INPUT */
+
+    /* Start of every transaction: pins as output, and
+     * enable 3-phase clocking. Without this, the data will NOT be
+     * output on the proper edge! Due to this clock stretching, the speed
+     * could be set a bit higher in ICSP, to compensate. */
+    memcpy(a->icsp_prefix, pins_out, 6);
+    a->icsp_prefix[6] = 0x8C;
+
+    for (i=0; i<8; i++) {
+        unsigned char *t = a->icsp_bit[i];
+
+        /* Write in bit mode, LSB first, on TDI, on NEGATIVE EDGE.
+         * Always write 2 bits - "data" and TMS. */
+        t[0] = BITMODE + LSB + CLKWNEG + WTDI;
+        t[1] = 2-1;
+        t[2] = i & 3;
+        memcpy(t+3, pins_in, 6);
+
+        /* Read in bit mode, LSB first, on TDO.
+         * During reading, WTDI NEEDS TO BE HERE! Without it won't work properly.
+         * Two bits are clocked: TDO comes in the MSB of the reply byte. */
+        t[9] = (i & 4) ? (BITMODE + LSB + RTDO + CLKWNEG + WTDI) :
+                         (BITMODE + LSB + CLKWNEG + WTDI);
+        t[10] = 2-1;
+        t[11] = 0;
+        memcpy(t+12, pins_out, 6);
+    }
+    a->icsp_templates_ready = 1;
+}
+
+/*
+ * Append one ICSP bit slot to the output buffer.
+ */
+static inline void mpsse_icsp_bit(mpsse_adapter_t *a, int tdi, int tms, int read)
+{
+    memcpy(&a->output [a->bytes_to_write],
+        a->icsp_bit [tdi | tms << 1 | read << 2], ICSP_SLOT_BYTES);
+    a->bytes_to_write += ICSP_SLOT_BYTES;
+    if (read)
+        a->bytes_to_read++;
 }
 
 static void mpsse_send(mpsse_adapter_t *a,
@@ -346,9 +552,12 @@ static void mpsse_send(mpsse_adapter_t *a,
 
     if (INTERFACE_JTAG == a->interface || INTERFACE_DEFAULT == a->interface)
     {
-        /* Check that we have enough space in output buffer.
+        mpsse_read_t *r = 0;
+
+        /* Check that we have enough space in output and input buffers.
          * Max size of one packet is 23 bytes (6+8+3+3+3). */
-        if (a->bytes_to_write > sizeof(a->output) - 23)
+        if (a->bytes_to_write > sizeof(a->output) - 23 ||
+            (read_flag && a->bytes_to_read + 10 > a->max_read_bytes))
             mpsse_flush_output(a);
 
         /* Prepare a packet of MPSSE commands. */
@@ -376,13 +585,11 @@ static void mpsse_send(mpsse_adapter_t *a,
             unsigned nbytes = tdi_nbits / 8;
             unsigned last_byte_bits = tdi_nbits & 7;
             if (read_flag) {
-                a->high_byte_bits = last_byte_bits;
-                a->fix_high_bit = 0;
-                a->high_byte_mask = 0;
-                a->bytes_per_word = nbytes;
-                if (a->high_byte_bits > 0)
-                    a->bytes_per_word++;
-                a->bytes_to_read += a->bytes_per_word;
+                r = mpsse_new_read(a);
+                r->high_byte_bits = last_byte_bits;
+                r->nbytes = nbytes;
+                if (r->high_byte_bits > 0)
+                    r->nbytes++;
             }
             if (nbytes > 0) {
                 /* Whole bytes.
@@ -408,7 +615,8 @@ static void mpsse_send(mpsse_adapter_t *a,
                 a->output [a->bytes_to_write++] = last_byte_bits - 1;
                 a->output [a->bytes_to_write++] = tdi;
                 tdi >>= last_byte_bits;
-                a->high_byte_mask = 0xffULL << (a->bytes_per_word - 1) * 8;
+                if (r)
+                    r->high_byte_mask = 0xffULL << (r->nbytes - 1) * 8;
             }
             if (tms_epilog_nbits > 0) {
                 /* Last bit (actually two bits).
@@ -422,16 +630,17 @@ static void mpsse_send(mpsse_adapter_t *a,
                 a->output [a->bytes_to_write++] = tdi << 7 | 1 | tms_epilog << 1;
                 tms_epilog_nbits--;
                 tms_epilog >>= 1;
-                if (read_flag) {
+                if (r) {
                     /* Last bit wil come in next byte.
                      * Compute a mask for correction. */
-                    a->fix_high_bit = 0x40ULL << (a->bytes_per_word * 8);
-                    a->bytes_per_word++;
-                    a->bytes_to_read++;
+                    r->fix_high_bit = 0x40ULL << (r->nbytes * 8);
+                    r->nbytes++;
                 }
             }
-            if (read_flag)
-                a->high_bit_mask = 1ULL << (tdi_nbits - 1);
+            if (r) {
+                r->high_bit_mask = 1ULL << (tdi_nbits - 1);
+                a->bytes_to_read += r->nbytes;
+            }
         }
         if (tms_epilog_nbits > 0) {
             /* Epiloque TMS, from 1 to 7 bits.
@@ -443,139 +652,104 @@ static void mpsse_send(mpsse_adapter_t *a,
     }
     else{
         /* Else ICSP */
-        /* If no read flag, then should be simple.
-         *  -> Send two bits, change pin/OE, "read" two bits, change pin/OE
-         * If there is read flag, then similar, but from 3rd bit on, read 2 bits.
-         *  --> This means, we will get 2 bits of data - one TDO bit and one garbage.
-         *   --> Care must be taken to extract the right one!
-         *   --> (Since data is shifted LSB, the right one will be the MSB bit in the byte)
-         */
-
-        /* Check that we have enough space in output buffer.
-         * Max size of one packet is roughly 123 bytes (4+1+32+2+2)*3.
-         * Flush in any case, TODO optimize later */
-        mpsse_flush_output(a);
-        mpsse_setPins(a, 0, 1, 1, 0, 0);   /* No Reset, LED, ICSP, ICSP_OE == Output, not immediate */
-
-        /* Enable 3-phse clocking. Without this, the data will NOT be
-         * output on the proper edge! Due to this clock stretching, the speed
-         * could be set a bit higher in ICSP, to compensate. */
-        a->output [a->bytes_to_write++] = 0x8C;
-
-        /* Write the TMS prologue */
-        if (tms_prolog_nbits > 0)
-        {
-            /* Write all bits. Special case for the last one */
-            for(;tms_prolog_nbits>0; tms_prolog_nbits--){
-                a->output [a->bytes_to_write++] = BITMODE + LSB + CLKWNEG + WTDI; /* Write in bit mode, LSB first, on TDI, on NEGATIVE EDGE */
-                a->output [a->bytes_to_write++] = 2-1;    /* Always write 2 bits - "data" and TMS. */
-                a->output [a->bytes_to_write++] = (0) | ((tms_prolog & 0x01)<<1);
-                tms_prolog = tms_prolog>>1;
-
-                mpsse_setPins(a, 0, 1, 1, 1, 0);   /* No Reset, LED, ICSP, ICSP_OE == INPUT, not immediate */
-
-                /* During reading, WTDI NEEDS TO BE HERE! Without it won't work properly */
-                a->output [a->bytes_to_write++] = (tms_prolog_nbits == 1 && read_flag) ? 
-                    (BITMODE + LSB + RTDO + CLKWNEG + WTDI) :  /* Read in bit mode, LSB first, on TDO, on POSITIVE EDGE */
-                    (BITMODE + LSB + CLKWNEG + WTDI) ;         
-                a->output [a->bytes_to_write++] = 2-1;    /* Always write 2 bits - dummy in this case */
-                a->output [a->bytes_to_write++] = 0;
-                if (tms_prolog_nbits == 1 && read_flag){
-                    a->bytes_to_read++;
-                }
+        /* Every bit takes a slot of 4 phases: send two bits (TDI and TMS),
+         * change pin/OE, "read" two bits, change pin/OE.
+         * If there is read flag, then from the last prologue bit on,
+         * read 2 bits: we get one TDO bit and one garbage.
+         * Since data is shifted LSB, the right one is the MSB bit in the byte.
+         * Transactions are appended to the buffer, so many of them
+         * can be sent in one USB transfer. */
+        unsigned nbits = tms_prolog_nbits + tdi_nbits + tms_epilog_nbits;
+        unsigned nread = read_flag ? tdi_nbits : 0;
+
+        if (! a->icsp_templates_ready)
+            mpsse_icsp_templates(a);
+
+        /* Check that we have enough space in output and input buffers. */
+        if (a->bytes_to_write + sizeof(a->icsp_prefix) + nbits * ICSP_SLOT_BYTES > sizeof(a->output) ||
+            a->bytes_to_read + nread > a->max_read_bytes)
+            mpsse_flush_output(a);
 
-                mpsse_setPins(a, 0, 1, 1, 0, 0);   /* No Reset, LED, ICSP, ICSP_OE == OUTPUT, not immediate */
-            }
-         
-            
+        if (read_flag) {
+            mpsse_new_read(a)->nbytes = nread;
         }
-
-        /* Write all data bits */
-        if (tdi_nbits > 0){
-            /* Write all bits. Special case for the last one (TMS = 1)*/
-            for(;tdi_nbits>0; tdi_nbits--){
-                a->output [a->bytes_to_write++] = BITMODE + LSB + CLKWNEG + WTDI; /* Write in bit mode, LSB first, on TDI, on NEGATIVE EDGE */
-                a->output [a->bytes_to_write++] = 2-1;    /* Always write 2 bits - "data" and TMS. */
-                a->output [a->bytes_to_write++] = (tdi & 0x01) | ((tdi_nbits == 1) ? 1 : 0)<<1;    /* Write data, then TMS. TMS is 0, except for last bit */
-                tdi = tdi>>1;
-
-                mpsse_setPins(a, 0, 1, 1, 1, 0);   /* No Reset, LED, ICSP, ICSP_OE == INPUT, not immediate */
-
-                /* During reading, WTDI NEEDS TO BE HERE! Without it won't work properly */
-                a->output [a->bytes_to_write++] = (tdi_nbits > 1 && read_flag) ? /* Don't read on last bit - we got the last bit in the previous one. */
-                    (BITMODE + LSB + RTDO + CLKWNEG + WTDI) :  /* Read in bit mode, LSB first, on TDO, on POSITIVE EDGE */
-                    (BITMODE + LSB + CLKWNEG + WTDI) ;
-                a->output [a->bytes_to_write++] = 2-1;    /* Always write 2 bits - dummy in this case */
-                a->output [a->bytes_to_write++] = 0;
-                if (tdi_nbits > 1 && read_flag){
-                    a->bytes_to_read++;
-                }
-
-                mpsse_setPins(a, 0, 1, 1, 0, 0);   /* No Reset, LED, ICSP, ICSP_OE == OUTPUT, not immediate */
-            }
+        memcpy(&a->output [a->bytes_to_write], a->icsp_prefix, sizeof(a->icsp_prefix));
+        a->bytes_to_write += sizeof(a->icsp_prefix);
+
+        /* Write the TMS prologue. The first TDO bit comes
+         * with the last prologue bit. */
+        for (; tms_prolog_nbits > 0; tms_prolog_nbits--) {
+            mpsse_icsp_bit(a, 0, tms_prolog & 1,
+                tms_prolog_nbits == 1 && read_flag);
+            tms_prolog >>= 1;
         }
-    
-         /* Write the TMS epilog */
-        if (tms_epilog_nbits > 0)
-        {
-            /* Write all bits. Special case for the last one */
-            for(;tms_epilog_nbits>0; tms_epilog_nbits--){
-                a->output [a->bytes_to_write++] = BITMODE + LSB + CLKWNEG + WTDI; /* Write in bit mode, LSB first, on TDI, on NEGATIVE EDGE */
-                a->output [a->bytes_to_write++] = 2-1;    /* Always write 2 bits - "data" and TMS. */
-                a->output [a->bytes_to_write++] = (0) | ((tms_epilog & 0x01)<<1);
-                tms_epilog = tms_epilog>>1;
-
-                mpsse_setPins(a, 0, 1, 1, 1, 0);   /* No Reset, LED, ICSP, ICSP_OE == INPUT, not immediate */
-
-                /* During reading, WTDI NEEDS TO BE HERE! Without it won't work properly */
-                a->output [a->bytes_to_write++] = (BITMODE + LSB + CLKWNEG + WTDI) ; /* Just read. */
-                a->output [a->bytes_to_write++] = 2-1;    /* Always write 2 bits - dummy in this case */
-                a->output [a->bytes_to_write++] = 0;
-
-                mpsse_setPins(a, 0, 1, 1, 0, 0);   /* No Reset, LED, ICSP, ICSP_OE == OUTPUT, not immediate */
-            }
-         
-            
+
+        /* Write all data bits. TMS is 0, except for last bit.
+         * Don't read on last bit - we got it in the previous one. */
+        for (; tdi_nbits > 0; tdi_nbits--) {
+            mpsse_icsp_bit(a, tdi & 1, tdi_nbits == 1,
+                tdi_nbits > 1 && read_flag);
+            tdi >>= 1;
         }
 
+        /* Write the TMS epilogue. */
+        for (; tms_epilog_nbits > 0; tms_epilog_nbits--) {
+            mpsse_icsp_bit(a, 0, tms_epilog & 1, 0);
+            tms_epilog >>= 1;
+        }
     }
 }
 
-static unsigned long long mpsse_fix_data(mpsse_adapter_t *a, unsigned long long word)
+static unsigned long long mpsse_fix_data(const mpsse_read_t *r, unsigned long long word)
 {
-    unsigned long long fix_high_bit = word & a->fix_high_bit;
-    //if (debug) fprintf(stderr, "fix (%08llx) high_bit=%08llx\n", word, a->fix_high_bit);
+    unsigned long long fix_high_bit = word & r->fix_high_bit;
+    //if (debug) fprintf(stderr, "fix (%08llx) high_bit=%08llx\n", word, r->fix_high_bit);
 
-    if (a->high_byte_bits) {
+    if (r->high_byte_bits) {
         /* Fix a high byte of received data. */
-        unsigned long long high_byte = a->high_byte_mask &
-            ((word & a->high_byte_mask) >> (8 - a->high_byte_bits));
-        word = (word & ~a->high_byte_mask) | high_byte;
-        //if (debug) fprintf(stderr, "Corrected byte %08llx -> %08llx\n", a->high_byte_mask, high_byte);
+        unsigned long long high_byte = r->high_byte_mask &
+            ((word & r->high_byte_mask) >> (8 - r->high_byte_bits));
+        word = (word & ~r->high_byte_mask) | high_byte;
+        //if (debug) fprintf(stderr, "Corrected byte %08llx -> %08llx\n", r->high_byte_mask, high_byte);
     }
-    word &= a->high_bit_mask - 1;
+    word &= r->high_bit_mask - 1;
     if (fix_high_bit) {
         /* Fix a high bit of received data. */
-        word |= a->high_bit_mask;
-        //if (debug) fprintf(stderr, "Corrected bit %08llx -> %08llx\n", a->high_bit_mask, word >> 9);
+        word |= r->high_bit_mask;
+        //if (debug) fprintf(stderr, "Corrected bit %08llx -> %08llx\n", r->high_bit_mask, word >> 9);
     }
     return word;
 }
 
-static unsigned long long mpsse_recv(mpsse_adapter_t *a)
+/*
+ * Get a received word from the input buffer, by index of the queued read.
+ * In ICSP mode every byte holds one TDO bit.
+ */
+static unsigned long long mpsse_unpack(mpsse_adapter_t *a, int index)
 {
-    unsigned long long word;
+    const mpsse_read_t *r = &a->reads[index];
+    unsigned long long word = 0;
+    int i;
+
+    if (INTERFACE_JTAG == a->interface || INTERFACE_DEFAULT == a->interface) {
+        memcpy(&word, a->input + r->offset,
+            r->nbytes < sizeof(word) ? r->nbytes : sizeof(word));
+        return mpsse_fix_data(r, word);
+    }
+
+    /* Else ICSP */
+    for (i=r->nbytes-1; i>=0; i--)
+        word = word << 1 | (a->input[r->offset + i] >> 7);
+    return word;
+}
 
+static unsigned long long mpsse_recv(mpsse_adapter_t *a)
+{
     /* Send a packet. */
     mpsse_flush_output(a);
 
-    /* Process a reply: one 64-bit word. */
-    memcpy(&word, a->input, sizeof(word));
-    if (INTERFACE_JTAG == a->interface || INTERFACE_DEFAULT == a->interface)
-        return mpsse_fix_data(a, word);
-    else
-        /* Else ICSP */
-        return(word);
+    /* Process a reply: the last queued word. */
+    return mpsse_unpack(a, a->nreads - 1);
 }
 
 static uint32_t mpsse_bitReversal(uint32_t input){
@@ -590,7 +764,12 @@ static uint32_t mpsse_bitReversal(uint32_t input){
 }
 
 static void mpsse_setMode(mpsse_adapter_t *a, uint32_t mode, uint32_t immediate){
-    
+
+    /* TAP reset selects IDCODE; the MCHP key may switch the TAP. */
+    a->ir = -1;
+    if (SET_MODE_ICSP_SYNC == mode)
+        a->tap = 0;
+
     if (SET_MODE_TAP_RESET == mode){
         /* TMS 1-1-1-1-1-0 */
         mpsse_send(a, TMS_HEADER_RESET_TAP_NBITS, TMS_HEADER_RESET_TAP_VAL, 0, 0, 0, 0, 0);
@@ -629,6 +808,17 @@ static void mpsse_sendCommand(mpsse_adapter_t *a, uint32_t command, uint32_t imm
         exit(-1);   // TODO make exit procedure
     }
 
+    /* Skip the IR scan when the register is already selected. */
+    if ((int)command == a->ir &&
+        ((TAP_SW_ETAP == a->tap && (ETAP_ADDRESS == command || ETAP_DATA == command
+                                 || ETAP_CONTROL == command || ETAP_FASTDATA == command)) ||
+         (TAP_SW_MTAP == a->tap && MTAP_COMMAND == command))) {
+        if (immediate){
+            mpsse_flush_output(a);
+        }
+        return;
+    }
+
     if (MTAP_COMMAND != command && TAP_SW_MTAP != command 
         && TAP_SW_ETAP != command && MTAP_IDCODE != command){   // MTAP commands
         mpsse_send(a, TMS_HEADER_COMMAND_NBITS, TMS_HEADER_COMMAND_VAL,
@@ -644,6 +834,12 @@ static void mpsse_sendCommand(mpsse_adapter_t *a, uint32_t command, uint32_t imm
                     TMS_FOOTER_COMMAND_NBITS, TMS_FOOTER_COMMAND_VAL,
                     0);
     }
+    if (TAP_SW_MTAP == command || TAP_SW_ETAP == command) {
+        a->tap = command;
+        a->ir = -1;
+    } else
+        a->ir = command;
+
     if (immediate){
         mpsse_flush_output(a);
     }
@@ -693,7 +889,7 @@ static void mpsse_xferInstruction(mpsse_adapter_t *a, unsigned instruction)
         fprintf(stderr, "%s: xfer instruction %08x\n", a->name, instruction);
 
     /* Select Control Register */
-    mpsse_sendCommand(a, ETAP_CONTROL, 1); // ETAP_CONTROL, immediate
+    mpsse_sendCommand(a, ETAP_CONTROL, 0); // ETAP_CONTROL, sent with the read below
 
     // Wait until CPU is ready
     // Check if Processor Access bit (bit 18) is set
@@ -715,22 +911,43 @@ static void mpsse_xferInstruction(mpsse_adapter_t *a, unsigned instruction)
     } while (! (ctl & CONTROL_PROBEN));
 
     /* Select Data Register */
-    mpsse_sendCommand(a, ETAP_DATA, 1);    // ETAP_DATA, immediate
+    mpsse_sendCommand(a, ETAP_DATA, 0);    // ETAP_DATA, not immediate
 
     /* Send the instruction */
-    mpsse_xferData(a, 32, instruction, 0, 1);  // Send instruction, don't read, immediate
+    mpsse_xferData(a, 32, instruction, 0, 0);  // Send instruction, don't read, not immediate
 
     /* Tell CPU to execute instruction */
-    mpsse_sendCommand(a, ETAP_CONTROL, 1); // ETAP_CONTROL, immediate
+    mpsse_sendCommand(a, ETAP_CONTROL, 0); // ETAP_CONTROL, not immediate
     /* Send data. */
     mpsse_xferData(a, 32, (CONTROL_PROBEN | CONTROL_PROBTRAP), 0, 1);   // Send data, no readback, immediate
 }
 
+/*
+ * Send an instruction without polling the CPU first.
+ * Used inside of short sequences, when the previous instruction
+ * is known to complete in a few cycles. The commands are
+ * queued and sent to the adapter with the next read.
+ */
+static void mpsse_xferInstructionQueued(mpsse_adapter_t *a, unsigned instruction)
+{
+    if (debug_level > 1)
+        fprintf(stderr, "%s: xfer instruction %08x (queued)\n", a->name, instruction);
+
+    mpsse_sendCommand(a, ETAP_DATA, 0);
+    mpsse_xferData(a, 32, instruction, 0, 0);
+    mpsse_sendCommand(a, ETAP_CONTROL, 0);
+    mpsse_xferData(a, 32, (CONTROL_PROBEN | CONTROL_PROBTRAP), 0, 0);
+}
+
 static void mpsse_speed(mpsse_adapter_t *a, int khz)
 {
     unsigned char output [3];
-    int divisor = (a->mhz * 2000 / khz + 1) / 2 - 1;
+    int divisor;
 
+    /* TCK is master clock divided by 2*(divisor+1). */
+    if (khz > a->mhz * 1000)
+        khz = a->mhz * 1000;
+    divisor = (a->mhz * 2000 / khz + 1) / 2 - 1;
     if (divisor < 0)
         divisor = 0;
     if (debug_level)
@@ -740,7 +957,7 @@ static void mpsse_speed(mpsse_adapter_t *a, int khz)
         /* Use 60MHz master clock (disable divide by 5). */
         output [0] = 0x8A;
 
-        /* Turn off adaptive clocking. */
+        /* Turn off adaptive clocking: PIC32 has no RTCK output. */
         output [1] = 0x97;
 
         /* Disable three-phase clocking. */
@@ -748,6 +965,13 @@ static void mpsse_speed(mpsse_adapter_t *a, int khz)
         bulk_write(a, output, 3);
     }
 
+    a->khz = khz;
+
+    /* Every FASTDATA word takes about 40 clocks. */
+    a->adapter.bytes_per_sec = khz * 100;
+    if (INTERFACE_ICSP == a->interface)
+        a->adapter.bytes_per_sec /= 4;
+
     /* Command "set TCK divisor". */
     output [0] = 0x86;
     output [1] = divisor;
@@ -768,6 +992,9 @@ static void mpsse_close(adapter_t *adapter, int power_on)
     mpsse_setMode(a, SET_MODE_TAP_RESET, 1);   // Send TAP reset, immediate
     mdelay(10);
 
+    /* The reset below drops the read loop from RAM. */
+    a->read_loop_loaded = 0;
+
     /* Toggle /SYSRST. */
     mpsse_setPins(a, 1, 1, 0, 0, 1); // Reset, LED, no ICSP, no ICSP_OE, immediate
     mdelay(100);    /* Hold in reset for a bit, so it auto-runs afterwards */
@@ -775,6 +1002,8 @@ static void mpsse_close(adapter_t *adapter, int power_on)
 
     libusb_release_interface(a->usbdev, 0);
     libusb_close(a->usbdev);
+    free(a->input);
+    free(a->reads);
     free(a);
 }
 
@@ -845,6 +1074,9 @@ static void serial_execution(mpsse_adapter_t *a)
         return;
     a->serial_execution_mode = 1;
 
+    /* The CPU is reset: nothing is left in RAM. */
+    a->read_loop_loaded = 0;
+
     /* Enter serial execution. */
     if (debug_level > 0)
         fprintf(stderr, "%s: enter serial execution\n", a->name);
@@ -959,7 +1191,12 @@ static void serial_execution(mpsse_adapter_t *a)
     mdelay(10);
 }
 
-static unsigned get_pe_response(mpsse_adapter_t *a)
+/*
+ * Get a word from PE.
+ * When tries is nonzero, give up after so many polls of PrAcc,
+ * and return 0. Otherwise wait forever.
+ */
+static int try_pe_response(mpsse_adapter_t *a, unsigned *result, unsigned tries)
 {
     unsigned ctl, response;
 
@@ -969,10 +1206,14 @@ static unsigned get_pe_response(mpsse_adapter_t *a)
 
     // Wait until CPU is ready
     // Check if Processor Access bit (bit 18) is set
-    do {
+    for (;;) {
         ctl = mpsse_xferData(a, 32, (CONTROL_PRACC | CONTROL_PROBEN 
                 | CONTROL_PROBTRAP | CONTROL_EJTAGBRK), 1, 1);    // Send data, readflag, immediate don't care
-    } while (! (ctl & CONTROL_PRACC));
+        if (ctl & CONTROL_PRACC)
+            break;
+        if (tries != 0 && --tries == 0)
+            return 0;
+    }
 
     // Select Data Register
     // Send the instruction
@@ -990,17 +1231,237 @@ static unsigned get_pe_response(mpsse_adapter_t *a)
 
     if (debug_level > 1)
         fprintf(stderr, "%s: get PE response %08x\n", a->name, response);
+    *result = response;
+    return 1;
+}
+
+static unsigned get_pe_response(mpsse_adapter_t *a)
+{
+    unsigned response;
+
+    try_pe_response(a, &response, 0);
     return response;
 }
 
+/*
+ * Read words from memory in serial execution mode (without PE).
+ * The CPU is polled only before the first instruction and after
+ * the load from memory; other instructions are queued, so every
+ * word takes a few USB transactions.
+ */
+static void serial_read_words(mpsse_adapter_t *a,
+    unsigned addr, unsigned nwords, unsigned *data)
+{
+    unsigned code[7], ncode, i;
+
+    for (; nwords > 0; nwords--, addr += 4) {
+        unsigned addr_lo = addr & 0xFFFF;
+        unsigned addr_hi = (addr >> 16) & 0xFFFF;
+
+        if (FAMILY_MM != a->adapter.family_name_short) {
+            code[0] = 0x3c13ff20;                   // lui s3, FASTDATA_REG_ADDR(31:16)
+            code[1] = 0x3c080000 | addr_hi;         // lui t0, addr_hi
+            code[2] = 0x35080000 | addr_lo;         // ori t0, addr_lo
+            code[3] = 0x8d090000;                   // lw t1, 0(t0)
+            code[4] = 0xae690000;                   // sw t1, 0(s3)
+            code[5] = 0;                            // NOP - necessary!
+            ncode = 6;
+        } else {
+            /* PIC32MM */
+            code[0] = 0xFF2041B3;                   // lui s3, FAST_DATA_REG(32:16)
+            code[1] = 0x000041A8 | (addr_hi<<16);   // lui t0, DATA_ADDRESS(31:16)
+            code[2] = 0x00005108 | (addr_lo<<16);   // ori t0, DATA_ADDRESS(15:0)
+            code[3] = 0x0000FD28;                   // lw t1, 0(t0) - read data
+            code[4] = 0x0000F933;                   // sw t1, 0(s3) - store data to fast register
+            code[5] = 0x0c000c00;                   // Nop, 2x
+            code[6] = 0x0c000c00;                   // Nop, 2x, again. Without this (4x nop), you will get garbage
+            ncode = 7;
+        }
+
+        for (i=0; i<ncode; i++) {
+            /* Wait for the CPU before the first instruction,
+             * and after a load from flash memory. */
+            if (i == 0 || i == 4)
+                mpsse_xferInstruction(a, code[i]);
+            else
+                mpsse_xferInstructionQueued(a, code[i]);
+        }
+
+        /* Send command. */
+        mpsse_sendCommand(a, ETAP_FASTDATA, 0);
+        /* Get fastdata. */
+        /* Send zeroes, read response, immediate don't care. Shift by 1 to get rid of PrACC */
+        *data++ = mpsse_xferFastData(a, 0, 1, 1) >> 1;
+    }
+}
+
+/*
+ * Read a stream of words from FASTDATA register, several words
+ * per USB transaction. Scans with PrAcc=0 did not transfer
+ * any data (the CPU was not yet waiting on the store),
+ * so they are dropped and repeated.
+ */
+static void mpsse_read_fastdata_stream(mpsse_adapter_t *a,
+    unsigned nwords, unsigned *data)
+{
+    unsigned misses = 0, i, n;
+
+    mpsse_sendCommand(a, ETAP_FASTDATA, 0);
+    while (nwords > 0) {
+        /* As many scans as fit in one flush: 5 bytes of reply per scan
+         * in JTAG mode, 33 bytes (one per bit) in ICSP mode. */
+        if (INTERFACE_ICSP == a->interface)
+            n = mpsse_read_capacity(a, 7 + 40 * ICSP_SLOT_BYTES, 33);
+        else
+            n = mpsse_read_capacity(a, 23, 5);
+        if (n > nwords)
+            n = nwords;
+        for (i=0; i<n; i++) {
+            mpsse_send(a, TMS_HEADER_XFERDATAFAST_NBITS, TMS_HEADER_XFERDATAFAST_VAL,
+                            33, 0,
+                            TMS_FOOTER_XFERDATAFAST_NBITS, TMS_FOOTER_XFERDATAFAST_VAL,
+                            1);
+        }
+        mpsse_flush_output(a);
+
+        for (i=0; i<n; i++) {
+            unsigned long long word = mpsse_unpack(a, i);
+
+            if (! (word & 1)) {
+                /* PrAcc not set: no data. */
+                if (++misses > 1000) {
+                    fprintf(stderr, "%s: fast read loop does not respond\n", a->name);
+                    exit(-1);
+                }
+                continue;
+            }
+            misses = 0;
+            *data++ = word >> 1;
+            nwords--;
+        }
+    }
+}
+
+/*
+ * Read a memory block without PE, using a small copy loop in RAM.
+ * The loop is downloaded once by serial execution; every call
+ * then sets the address and count, jumps to the loop, and drains
+ * the words it stores to the FASTDATA register.
+ * At the end the loop jumps back to the debug vector,
+ * and the CPU returns to serial execution mode.
+ */
+static void serial_read_block(mpsse_adapter_t *a,
+    unsigned addr, unsigned nwords, unsigned *data)
+{
+    static const unsigned loop_mips32[] = {
+        0x8d0a0000,     // 1: lw    t2, 0(t0)
+        0x25080004,     //    addiu t0, t0, 4
+        0xae6a0000,     //    sw    t2, 0(s3)   - wait until probe reads FASTDATA
+        0x2529ffff,     //    addiu t1, t1, -1
+        0x1520fffb,     //    bne   t1, zero, 1b
+        0x00000000,     //    nop
+        0x3c19ff20,     //    lui   t9, 0xff20
+        0x37390200,     //    ori   t9, 0x0200  - debug exception vector
+        0x03200008,     //    jr    t9
+        0x00000000,     //    nop
+    };
+    static const unsigned loop_micromips[] = {
+        0x0000fd48,     // 1: lw    t2, 0(t0)
+        0x00043108,     //    addiu t0, t0, 4
+        0x0000f953,     //    sw    t2, 0(s3)   - wait until probe reads FASTDATA
+        0xffff3129,     //    addiu t1, t1, -1
+        0xfff6b409,     //    bne   t1, zero, 1b
+        0x00000000,     //    nop
+        0xff2041b9,     //    lui   t9, 0xff20
+        0x02015339,     //    ori   t9, t9, 0x0201 - debug exception vector, microMIPS
+        0x0c004599,     //    jr    t9; nop
+        0x0c000c00,     //    nop; nop
+    };
+    unsigned addr_lo = addr & 0xFFFF;
+    unsigned addr_hi = (addr >> 16) & 0xFFFF;
+    unsigned i;
+
+    if (nwords == 0)
+        return;
+
+    if (FAMILY_MM != a->adapter.family_name_short) {
+        if (! a->read_loop_loaded) {
+            if (FAMILY_MX1 == a->adapter.family_name_short ||
+                FAMILY_MX3 == a->adapter.family_name_short) {
+                /* Enable execution from RAM: same setup
+                 * as for the PE loader. */
+                mpsse_xferInstruction(a, 0x3c04bf88);    // lui a0, 0xbf88
+                mpsse_xferInstruction(a, 0x34842000);    // ori a0, 0x2000 - address of BMXCON
+                mpsse_xferInstruction(a, 0x3c05001f);    // lui a1, 0x1f
+                mpsse_xferInstruction(a, 0x34a50040);    // ori a1, 0x40   - a1 has 001f0040
+                mpsse_xferInstruction(a, 0xac850000);    // sw  a1, 0(a0)  - BMXCON initialized
+                mpsse_xferInstruction(a, 0x34050800);    // li  a1, 0x800  - a1 has 00000800
+                mpsse_xferInstruction(a, 0xac850010);    // sw  a1, 16(a0) - BMXDKPBA initialized
+                mpsse_xferInstruction(a, 0x8c850040);    // lw  a1, 64(a0) - load BMXDMSZ
+                mpsse_xferInstruction(a, 0xac850020);    // sw  a1, 32(a0) - BMXDUDBA initialized
+                mpsse_xferInstruction(a, 0xac850030);    // sw  a1, 48(a0) - BMXDUPBA initialized
+            }
+
+            /* Download the loop to 0xa0000800. */
+            mpsse_xferInstruction(a, 0x3c04a000);        // lui a0, 0xa000
+            mpsse_xferInstructionQueued(a, 0x34840800);  // ori a0, 0x800
+            for (i=0; i<sizeof(loop_mips32)/sizeof(unsigned); i++) {
+                mpsse_xferInstructionQueued(a, 0x3c060000 | loop_mips32[i] >> 16);     // lui a2, hi
+                mpsse_xferInstructionQueued(a, 0x34c60000 | (loop_mips32[i] & 0xFFFF)); // ori a2, lo
+                mpsse_xferInstruction(a, 0xac860000);                                   // sw  a2, 0(a0)
+                mpsse_xferInstructionQueued(a, 0x24840004);                             // addiu a0, 4
+            }
+            a->read_loop_loaded = 1;
+        }
+
+        /* Set parameters and jump to the loop. */
+        mpsse_xferInstruction(a, 0x3c13ff20);                    // lui s3, 0xff20 - FASTDATA
+        mpsse_xferInstructionQueued(a, 0x3c080000 | addr_hi);    // lui t0, addr_hi
+        mpsse_xferInstructionQueued(a, 0x35080000 | addr_lo);    // ori t0, addr_lo
+        mpsse_xferInstructionQueued(a, 0x3c090000 | nwords >> 16);       // lui t1, count_hi
+        mpsse_xferInstructionQueued(a, 0x35290000 | (nwords & 0xFFFF));  // ori t1, count_lo
+        mpsse_xferInstructionQueued(a, 0x3c19a000);              // lui t9, 0xa000
+        mpsse_xferInstructionQueued(a, 0x37390800);              // ori t9, 0x800
+        mpsse_xferInstructionQueued(a, 0x03200008);              // jr  t9
+        mpsse_xferInstruction(a, 0x00000000);                    // nop
+    } else {
+        /* PIC32MM */
+        if (! a->read_loop_loaded) {
+            /* Download the loop to 0xa0000200. */
+            mpsse_xferInstruction(a, 0xa00041a4);        // lui a0, 0xa000
+            mpsse_xferInstructionQueued(a, 0x02005084);  // ori a0, a0, 0x200
+            for (i=0; i<sizeof(loop_micromips)/sizeof(unsigned); i++) {
+                mpsse_xferInstructionQueued(a, 0x41A6 | (loop_micromips[i] >> 16) << 16);     // lui a2, hi
+                mpsse_xferInstructionQueued(a, 0x50C6 | (loop_micromips[i] & 0xFFFF) << 16);  // ori a2, a2, lo
+                mpsse_xferInstruction(a, 0x6E42EB40);    // sw a2, 0(a0); addiu a0, a0, 4
+            }
+            a->read_loop_loaded = 1;
+        }
+
+        /* Set parameters and jump to the loop. */
+        mpsse_xferInstruction(a, 0xFF2041B3);                        // lui s3, 0xff20 - FASTDATA
+        mpsse_xferInstructionQueued(a, 0x000041A8 | (addr_hi<<16));  // lui t0, addr_hi
+        mpsse_xferInstructionQueued(a, 0x00005108 | (addr_lo<<16));  // ori t0, addr_lo
+        mpsse_xferInstructionQueued(a, 0x000041A9 | (nwords >> 16) << 16);     // lui t1, count_hi
+        mpsse_xferInstructionQueued(a, 0x00005129 | (nwords & 0xFFFF) << 16);  // ori t1, t1, count_lo
+        mpsse_xferInstructionQueued(a, 0xA00041B9);                  // lui t9, 0xa000
+        mpsse_xferInstructionQueued(a, 0x02015339);                  // ori t9, t9, 0x0201 - microMIPS
+        mpsse_xferInstructionQueued(a, 0x0C004599);                  // jr t9; nop
+
+        /* Same as for the PE loader: two more nops are needed. */
+        mpsse_xferInstruction(a, 0x0C000C00);
+        mpsse_xferInstruction(a, 0x0C000C00);
+    }
+
+    mpsse_read_fastdata_stream(a, nwords, data);
+}
+
 /*
  * Read a word from memory (without PE).
  */
 static unsigned mpsse_read_word(adapter_t *adapter, unsigned addr)
 {
     mpsse_adapter_t *a = (mpsse_adapter_t*) adapter;
-    unsigned addr_lo = addr & 0xFFFF;
-    unsigned addr_hi = (addr >> 16) & 0xFFFF;
     unsigned word = 0;
 
     /* Workaround for PIC32MM. If not in serial execution mode yet,
@@ -1010,44 +1471,7 @@ static unsigned mpsse_read_word(adapter_t *adapter, unsigned addr)
 
     serial_execution(a);
     do{
-        if (FAMILY_MX1 == a->adapter.family_name_short
-                        || FAMILY_MX3 == a->adapter.family_name_short
-                        || FAMILY_MK == a->adapter.family_name_short
-                        || FAMILY_MZ == a->adapter.family_name_short)
-        {
-            //fprintf(stderr, "%s: read word from %08x\n", a->name, addr);
-
-            mpsse_xferInstruction(a, 0x3c13ff20);            // lui s3, FASTDATA_REG_ADDR(31:16)
-            mpsse_xferInstruction(a, 0x3c080000 | addr_hi);  // lui t0, addr_hi
-            mpsse_xferInstruction(a, 0x35080000 | addr_lo);  // ori t0, addr_lo
-            mpsse_xferInstruction(a, 0x8d090000);            // lw t1, 0(t0)
-            mpsse_xferInstruction(a, 0xae690000);            // sw t1, 0(s3)
-            mpsse_xferInstruction(a, 0);                     // NOP - necessary!
-
-            /* Send command. */
-            mpsse_sendCommand(a, ETAP_FASTDATA, 1);
-            /* Get fastdata. */    
-            /* Send zeroes, read response, immediate don't care. Shift by 1 to get rid of PrACC */
-            word = mpsse_xferFastData(a, 0, 1, 1) >> 1;
-        }
-        else{
-            /* Else PIC32MM */
-			mpsse_xferInstruction(a, 0xFF2041B3);					// lui s3, FAST_DATA_REG(32:16). Set address of fastdata register
-			mpsse_xferInstruction(a, 0x000041A8 | (addr_hi<<16));	// lui t0, DATA_ADDRESS(31:16)
-			mpsse_xferInstruction(a, 0x00005108 | (addr_lo<<16));	// ori t0, DATA_ADDRESS(15:0)
-	 		mpsse_xferInstruction(a, 0x0000FD28);					// lw t1, 0(t0) - read data
-	 		mpsse_xferInstruction(a, 0x0000F933);					// sw t1, 0(s3) - store data to fast register
-			mpsse_xferInstruction(a, 0x0c000c00);					// Nop, 2x
-			mpsse_xferInstruction(a, 0x0c000c00);					// Nop, 2x, again. Without this (4x nop), you will get garbage after a few bytes!
-																	// Extra Nops make it even worse, always get 0s
-	 		
-			/* Send command. */
-			mpsse_sendCommand(a, ETAP_FASTDATA, 1);
-
-			/* Get fastdata. */
-			word = mpsse_xferFastData(a, 0, 1, 1) >> 1; // Send zeroes, read response, immediate don't care. Shift by 1 to get rid of PrACC
-        }
-
+        serial_read_words(a, addr, 1, &word);
     }while(times-- > 0);
 
     if (debug_level > 0)
@@ -1062,23 +1486,32 @@ static void mpsse_read_data(adapter_t *adapter,
     unsigned addr, unsigned nwords, unsigned *data)
 {
     mpsse_adapter_t *a = (mpsse_adapter_t*) adapter;
-    unsigned words_read, i;
+    unsigned words_read, i, n;
 
     //fprintf(stderr, "%s: read %d bytes from %08x\n", a->name, nwords*4, addr);
     if (! a->use_executive) {
         /* Without PE. */
-        for (; nwords > 0; nwords--) {
-            *data++ = mpsse_read_word(adapter, addr);
-            addr += 4;
-        }
+        if (nwords == 0)
+            return;
+        *data = mpsse_read_word(adapter, addr);
+
+        /* Short reads are faster by serial execution,
+         * until the copy loop is downloaded. */
+        if (a->read_loop_loaded || nwords > 16)
+            serial_read_block(a, addr + 4, nwords - 1, data + 1);
+        else
+            serial_read_words(a, addr + 4, nwords - 1, data + 1);
         return;
     }
 
     /* Use PE to read memory. */
-    for (words_read = 0; words_read < nwords; words_read += 32) {
+    for (words_read = 0; words_read < nwords; words_read += n) {
+        n = nwords - words_read;
+        if (n > 32)
+            n = 32;
 
         mpsse_sendCommand(a, ETAP_FASTDATA, 1);
-        mpsse_xferFastData(a, PE_READ << 16 | 32, 0, 1);       /* Read 32 words */  // Data, don't read, immediate
+        mpsse_xferFastData(a, PE_READ << 16 | n, 0, 1);        /* Read up to 32 words */  // Data, don't read, immediate
         mpsse_xferFastData(a, addr, 0, 1);                     /* Address */        // Data, don't read, immediate
 
         unsigned response = get_pe_response(a);     /* Get response */
@@ -1087,11 +1520,284 @@ static void mpsse_read_data(adapter_t *adapter,
                 a->name, response, PE_READ << 16);
             exit(-1);
         }
-        for (i=0; i<32; i++) {
+        for (i=0; i<n; i++) {
             *data++ = get_pe_response(a);           /* Get data */
         }
-        addr += 32*4;
+        addr += n*4;
+    }
+}
+
+/*
+ * Check the link at current TCK rate: read IDCODE,
+ * get PE version through FASTDATA, and compare the PE image in RAM
+ * with the original, by PE_READ and by PE_GET_CRC.
+ * Return 1 when all data came back intact.
+ */
+static int mpsse_speed_trial(mpsse_adapter_t *a, unsigned pe_addr,
+    const unsigned *pe, unsigned nwords, unsigned pe_version)
+{
+    unsigned response, i, j, n;
+
+    mpsse_sendCommand(a, TAP_SW_MTAP, 1);
+    mpsse_sendCommand(a, MTAP_IDCODE, 1);
+    response = mpsse_xferData(a, 32, 0, 1, 1);
+    mpsse_sendCommand(a, TAP_SW_ETAP, 1);
+    if (response != a->idcode)
+        return 0;
+
+    mpsse_sendCommand(a, ETAP_FASTDATA, 1);
+    mpsse_xferFastData(a, PE_EXEC_VERSION << 16, 0, 1);
+    if (! try_pe_response(a, &response, 1000) ||
+        response != (PE_EXEC_VERSION << 16 | pe_version))
+        return 0;
+
+    for (i=0; i<nwords; i+=n) {
+        n = nwords - i;
+        if (n > 32)
+            n = 32;
+        mpsse_sendCommand(a, ETAP_FASTDATA, 1);
+        mpsse_xferFastData(a, PE_READ << 16 | n, 0, 1);
+        mpsse_xferFastData(a, pe_addr + i*4, 0, 1);
+        if (! try_pe_response(a, &response, 1000) ||
+            response != PE_READ << 16)
+            return 0;
+        for (j=0; j<n; j++) {
+            if (! try_pe_response(a, &response, 1000) ||
+                response != pe[i+j])
+                return 0;
+        }
+    }
+
+    mpsse_sendCommand(a, ETAP_FASTDATA, 1);
+    mpsse_xferFastData(a, PE_GET_CRC << 16, 0, 1);
+    mpsse_xferFastData(a, pe_addr, 0, 1);
+    mpsse_xferFastData(a, nwords * 4, 0, 1);
+    if (! try_pe_response(a, &response, 1000) ||
+        response != PE_GET_CRC << 16)
+        return 0;
+    if (! try_pe_response(a, &response, 1000) ||
+        (response & 0xffff) != calculate_crc(0xffff, (unsigned char*) pe, nwords * 4))
+        return 0;
+    return 1;
+}
+
+/*
+ * Name of file with tuned TCK rates: lines of
+ * "adapter-serial devid khz".
+ */
+static char *speed_cache_name(char *buf, unsigned size)
+{
+    const char *home = getenv("HOME");
+
+    if (! home)
+        return 0;
+    snprintf(buf, size, "%s/.pic32prog-speed", home);
+    return buf;
+}
+
+static unsigned speed_cache_get(mpsse_adapter_t *a)
+{
+    char filename [256], serial [64];
+    unsigned devid, khz;
+    FILE *fd;
+
+    if (! speed_cache_name(filename, sizeof(filename)))
+        return 0;
+    fd = fopen(filename, "r");
+    if (! fd)
+        return 0;
+    while (fscanf(fd, "%63s %x %u", serial, &devid, &khz) == 3) {
+        if (strcmp(serial, a->serial) == 0 && devid == a->idcode) {
+            fclose(fd);
+            return khz;
+        }
+    }
+    fclose(fd);
+    return 0;
+}
+
+static void speed_cache_put(mpsse_adapter_t *a, unsigned khz)
+{
+    char filename [256], line [256], serial [64];
+    char *contents = 0;
+    unsigned len = 0, devid;
+    FILE *fd;
+
+    if (! speed_cache_name(filename, sizeof(filename)))
+        return;
+
+    /* Keep records for other adapters and targets. */
+    fd = fopen(filename, "r");
+    if (fd) {
+        while (fgets(line, sizeof(line), fd)) {
+            if (sscanf(line, "%63s %x", serial, &devid) == 2 &&
+                strcmp(serial, a->serial) == 0 && devid == a->idcode)
+                continue;
+            contents = realloc(contents, len + strlen(line) + 1);
+            if (! contents)
+                break;
+            strcpy(contents + len, line);
+            len += strlen(line);
+        }
+        fclose(fd);
+    }
+    fd = fopen(filename, "w");
+    if (fd) {
+        if (contents)
+            fputs(contents, fd);
+        fprintf(fd, "%s %08x %u\n", a->serial, a->idcode, khz);
+        fclose(fd);
+    } else if (debug_level > 0)
+        fprintf(stderr, "%s: cannot write %s\n", a->name, filename);
+    free(contents);
+}
+
+static void mpsse_load_executive(adapter_t *adapter,
+    const unsigned *pe, unsigned nwords, unsigned pe_version);
+
+/*
+ * Skip the rest of PE reply after a failed trial.
+ * PE sends words by stores to FASTDATA; stop when it waits
+ * for the next command (a load), or stays quiet.
+ */
+static void mpsse_drain_pe(mpsse_adapter_t *a)
+{
+    unsigned ctl, n, idle;
+
+    mpsse_sendCommand(a, TAP_SW_ETAP, 1);
+    for (n=0, idle=0; n<1024 && idle<100; ) {
+        mpsse_sendCommand(a, ETAP_CONTROL, 1);
+        ctl = mpsse_xferData(a, 32, (CONTROL_PRACC | CONTROL_PROBEN
+                | CONTROL_PROBTRAP | CONTROL_EJTAGBRK), 1, 1);
+        if (! (ctl & CONTROL_PRACC)) {
+            idle++;
+            continue;
+        }
+        if (! (ctl & CONTROL_PRNW))
+            break;
+
+        /* Take the word and let PE go on. */
+        mpsse_sendCommand(a, ETAP_DATA, 1);
+        mpsse_xferData(a, 32, 0, 1, 1);
+        mpsse_sendCommand(a, ETAP_CONTROL, 1);
+        mpsse_xferData(a, 32, (CONTROL_PROBEN | CONTROL_PROBTRAP), 0, 1);
+        n++;
+        idle = 0;
+    }
+    if (debug_level > 0 && n > 0)
+        fprintf(stderr, "%s: skip %u words of PE reply\n", a->name, n);
+}
+
+/*
+ * Get PE back in sync after a failed trial, at the lowest rate.
+ * When PE does not answer for version, reset the CPU
+ * and load PE again.
+ */
+static void mpsse_resync(mpsse_adapter_t *a, unsigned khz,
+    const unsigned *pe, unsigned nwords, unsigned pe_version)
+{
+    unsigned response;
+
+    mpsse_speed(a, khz);
+    mpsse_drain_pe(a);
+
+    mpsse_sendCommand(a, ETAP_FASTDATA, 1);
+    mpsse_xferFastData(a, PE_EXEC_VERSION << 16, 0, 1);
+    if (try_pe_response(a, &response, 1000) &&
+        response == (PE_EXEC_VERSION << 16 | pe_version))
+        return;
+
+    if (debug_level > 0)
+        fprintf(stderr, "%s: PE is out of sync, load it again\n", a->name);
+    a->serial_execution_mode = 0;
+    mpsse_load_executive(&a->adapter, pe, nwords, pe_version);
+}
+
+/*
+ * Find the highest TCK rate at which the target works reliably.
+ * Step up from the default rate, running every trial three times.
+ * After the first failure, back off by one step, for margin.
+ * The result is cached per adapter and target.
+ */
+static void mpsse_autospeed(mpsse_adapter_t *a, unsigned pe_addr,
+    const unsigned *pe, unsigned nwords, unsigned pe_version)
+{
+    static const unsigned steps[] = {
+        500, 1000, 2000, 3000, 5000, 7500, 10000, 15000, 30000, 0
+    };
+    unsigned max_khz = a->mhz * 1000;
+    unsigned khz = speed_cache_get(a);
+    unsigned best, i, k, ntrial;
+
+    /* Compare a part of PE image. */
+    ntrial = (nwords > 256) ? 256 : nwords;
+    mpsse_flush_output(a);
+
+    if (khz != 0) {
+        /* Check the cached value. */
+        mpsse_speed(a, khz);
+        if (mpsse_speed_trial(a, pe_addr, pe, ntrial, pe_version))
+            goto done;
+        if (debug_level > 0)
+            fprintf(stderr, "%s: cached speed %u kHz failed, tuning again\n",
+                a->name, khz);
+        mpsse_resync(a, steps[0], pe, nwords, pe_version);
+    }
+
+    best = 0;
+    for (i=0; steps[i] != 0 && steps[i] <= max_khz; i++) {
+        mpsse_speed(a, steps[i]);
+        for (k=0; k<3; k++) {
+            if (! mpsse_speed_trial(a, pe_addr, pe, ntrial, pe_version))
+                break;
+        }
+        if (debug_level > 0)
+            fprintf(stderr, "%s: trial at %u kHz %s\n", a->name, steps[i],
+                (k < 3) ? "failed" : "passed");
+        if (k < 3) {
+            /* Failed: back off one more step. */
+            mpsse_resync(a, steps[0], pe, nwords, pe_version);
+            if (best > 0)
+                best--;
+            break;
+        }
+        best = i;
+    }
+    khz = steps[best];
+    mpsse_speed(a, khz);
+    if (! mpsse_speed_trial(a, pe_addr, pe, ntrial, pe_version)) {
+        fprintf(stderr, "%s: target does not respond at %u kHz\n", a->name, khz);
+        exit(-1);
+    }
+    speed_cache_put(a, khz);
+done:
+    printf("      Clock: %u kHz\n", khz);
+}
+
+/*
+ * Check that CPU waits for a processor access:
+ * PE loader or PE is ready to get FASTDATA.
+ */
+static int mpsse_pracc_ready(void *arg)
+{
+    mpsse_adapter_t *a = arg;
+    unsigned ctl;
+
+    mpsse_sendCommand(a, ETAP_CONTROL, 1);
+    ctl = mpsse_xferData(a, 32, (CONTROL_PRACC | CONTROL_PROBEN | CONTROL_PROBTRAP), 1, 1);
+    return (ctl & CONTROL_PRACC) != 0;
+}
+
+/*
+ * Wait for PE loader or PE, and select FASTDATA register again.
+ */
+static void mpsse_wait_pe(mpsse_adapter_t *a)
+{
+    if (mwait("PE start", mpsse_pracc_ready, a, 0, 10) < 0) {
+        fprintf(stderr, "%s: PE does not respond\n", a->name);
+        exit(-1);
     }
+    mpsse_sendCommand(a, ETAP_FASTDATA, 1);
 }
 
 /*
@@ -1101,8 +1807,11 @@ static void mpsse_load_executive(adapter_t *adapter,
     const unsigned *pe, unsigned nwords, unsigned pe_version)
 {
     mpsse_adapter_t *a = (mpsse_adapter_t*) adapter;
+    const unsigned *pe_image = pe;
+    unsigned pe_addr;
 
     a->use_executive = 1;
+    a->read_loop_loaded = 0;
     serial_execution(a);
 
     if (debug_level > 0)
@@ -1162,7 +1871,8 @@ static void mpsse_load_executive(adapter_t *adapter,
          * PE_SIZE */
         /* Send command. */
         mpsse_sendCommand(a, ETAP_FASTDATA, 1);
-        mpsse_xferFastData(a, 0xa0000900, 0, 1);    /* Don't read, immediate */
+        pe_addr = 0xa0000900;
+        mpsse_xferFastData(a, pe_addr, 0, 1);       /* Don't read, immediate */
         mpsse_xferFastData(a, nwords, 0, 1);        /* Don't read, immediate */
 
         /* Download the PE itself (step 7-B). */
@@ -1172,13 +1882,13 @@ static void mpsse_load_executive(adapter_t *adapter,
             mpsse_xferFastData(a, *pe++, 0, 0);     /* Don't read, not immediate */
         }
         mpsse_flush_output(a);
-        mdelay(10);
+        mpsse_wait_pe(a);
 
         /* Download the PE instructions. */
         /* Step 8 - jump to PE. */
         mpsse_xferFastData(a, 0, 0, 1);             /* Don't read, immediate */                  
         mpsse_xferFastData(a, 0xDEAD0000, 0, 1);    /* Don't read, immediate */
-        mdelay(10);
+        mpsse_wait_pe(a);
         mpsse_xferFastData(a, PE_EXEC_VERSION << 16, 0, 1); /* Don't read, immediate */
     }
     else{
@@ -1218,7 +1928,8 @@ static void mpsse_load_executive(adapter_t *adapter,
 		mpsse_sendCommand(a, ETAP_FASTDATA, 1);
 
 		// Send PE_ADDRESS, Address os PE program block from PE Hex file
-		mpsse_xferFastData(a, 0xA0000300, 0, 1);	// Taken from the .hex file.
+		pe_addr = 0xA0000300;
+		mpsse_xferFastData(a, pe_addr, 0, 1);	// Taken from the .hex file.
 		
 		// Send PE_SIZE, number as 32-bit words of the program block from the PE Hex file
 		mpsse_xferFastData(a, nwords, 0, 1);        // Data, don't read, immediate (wasn't before)
@@ -1231,7 +1942,7 @@ static void mpsse_load_executive(adapter_t *adapter,
 			mpsse_xferFastData(a, *pe++, 0, 0);     // Data, don't read, no immediate
 		}
 		mpsse_flush_output(a);
-		mdelay(10);
+		mpsse_wait_pe(a);
 
 		// Step 5, Jump to the PE.
 		mpsse_xferFastData(a, 0x00000000, 0, 1);
@@ -1239,12 +1950,13 @@ static void mpsse_load_executive(adapter_t *adapter,
 
 		// Done.
 		// Get PE version?
-		mdelay(10);
+		mpsse_wait_pe(a);
 		mpsse_xferFastData(a, PE_EXEC_VERSION << 16, 0, 1);     // Data, don't read, immediate (wasn't before)
     }
     
     unsigned version = get_pe_response(a);
-    if (version != (PE_EXEC_VERSION << 16 | pe_version)) {
+    if ((version >> 16) != PE_EXEC_VERSION ||
+        (pe_version != 0 && (version & 0xffff) != pe_version)) {
         fprintf(stderr, "%s: bad PE version = %08x, expected %08x\n",
             a->name, version, PE_EXEC_VERSION << 16 | pe_version);
         exit(-1);
@@ -1252,15 +1964,32 @@ static void mpsse_load_executive(adapter_t *adapter,
     if (debug_level > 0)
         fprintf(stderr, "%s: PE version = %04x\n",
             a->name, version & 0xffff);
+    a->adapter.pe_version = version & 0xffff;
+
+    if (a->autospeed) {
+        /* PE reads memory by physical address.
+         * Clear the flag first: a failed trial loads PE again. */
+        a->autospeed = 0;
+        mpsse_autospeed(a, pe_addr & 0x1fffffff, pe_image, nwords,
+            version & 0xffff);
+    }
 }
 
 /*
  * Erase all flash memory.
  */
+static int mpsse_erase_done(void *arg)
+{
+    mpsse_adapter_t *a = arg;
+    unsigned status;
+
+    status = mpsse_xferData(a, MTAP_COMMAND_DR_NBITS, MCHP_STATUS, 1, 1);  // Send data, read response, immediate don't care
+    return (status & (MCHP_STATUS_CFGRDY | MCHP_STATUS_FCBUSY)) == MCHP_STATUS_CFGRDY;
+}
+
 static void mpsse_erase_chip(adapter_t *adapter)
 {
     mpsse_adapter_t *a = (mpsse_adapter_t*) adapter;
-    unsigned status = 0;
 
     /* Switch to MTAP */
     mpsse_sendCommand(a, TAP_SW_MTAP, 1);
@@ -1272,20 +2001,19 @@ static void mpsse_erase_chip(adapter_t *adapter)
     mpsse_xferData(a, MTAP_COMMAND_DR_NBITS, MCHP_ERASE, 0, 1);
     mpsse_xferData(a, MTAP_COMMAND_DR_NBITS, MCHP_DEASSERT_RST, 0, 1);
 
+    /* Erase resets the CPU: the read loop and BMX setup are gone. */
+    a->read_loop_loaded = 0;
+
     // https://www.microchip.com/forums/m627418.aspx .......
     if (INTERFACE_JTAG == a->interface || INTERFACE_DEFAULT == a->interface){
         mpsse_setPins(a, 0, 1, 0, 0, 1);  /* No Reset, LED, no ICSP, no ICSP_OE, immediate */
     }
 
-    do{
-        status = mpsse_xferData(a, MTAP_COMMAND_DR_NBITS, MCHP_STATUS, 1, 1);  // Send data, read response, immediate don't care
-        //fprintf(stderr, "Status is 0x%08x ... \n", statuss);
-        if (!(status & MCHP_STATUS_CFGRDY) || (status & MCHP_STATUS_FCBUSY)){
-            printf(".");
-            mdelay(10);
-        }
-    }while(!(status & MCHP_STATUS_CFGRDY) || (status & MCHP_STATUS_FCBUSY));
-
+    /* Give the erase some time to start and set FCBUSY. */
+    if (mwait("erase", mpsse_erase_done, a, 10, a->adapter.erase_msec) < 0) {
+        fprintf(stderr, "%s: chip erase timed out\n", a->name);
+        exit(-1);
+    }
     mpsse_setMode(a, SET_MODE_TAP_RESET, 1); 
     mdelay(25);
 }
@@ -1440,6 +2168,105 @@ static void mpsse_program_row(adapter_t *adapter, unsigned addr,
     }
 }
 
+/*
+ * Flash write a span of rows by one PE command.
+ */
+static void mpsse_program_cluster(adapter_t *adapter, unsigned addr,
+    unsigned nwords, unsigned *data)
+{
+    mpsse_adapter_t *a = (mpsse_adapter_t*) adapter;
+    unsigned i, response;
+
+    if (debug_level > 0)
+        fprintf(stderr, "%s: cluster program %u words at %08x\n",
+            a->name, nwords, addr);
+    if (! a->use_executive) {
+        fprintf(stderr, "%s: cluster program needs PE.\n", a->name);
+        exit(-1);
+    }
+
+    mpsse_sendCommand(a, ETAP_FASTDATA, 1);
+    mpsse_xferFastData(a, PE_PROGRAM_CLUSTER << 16, 0, 1);
+    mpsse_xferFastData(a, addr, 0, 1);          /* Send address. */
+    mpsse_xferFastData(a, nwords * 4, 0, 1);    /* Send length in bytes. */
+
+    /* Download data. */
+    for (i = 0; i < nwords; i++) {
+        if ((i & 7) == 0)
+            mpsse_flush_output(a);
+        mpsse_xferFastData(a, *data++, 0, 0);
+    }
+    mpsse_flush_output(a);
+
+    response = get_pe_response(a);
+    if (response != (PE_PROGRAM_CLUSTER << 16)) {
+        fprintf(stderr, "%s: failed to program cluster at %08x, reply = %08x\n",
+            a->name, addr, response);
+        exit(-1);
+    }
+}
+
+/*
+ * Erase a page of flash memory, by PE.
+ */
+static void mpsse_erase_page(adapter_t *adapter, unsigned addr)
+{
+    mpsse_adapter_t *a = (mpsse_adapter_t*) adapter;
+    unsigned response;
+
+    if (debug_level > 0)
+        fprintf(stderr, "%s: erase page at %08x\n", a->name, addr);
+    if (! a->use_executive) {
+        fprintf(stderr, "%s: page erase needs PE.\n", a->name);
+        exit(-1);
+    }
+
+    mpsse_sendCommand(a, ETAP_FASTDATA, 1);
+    mpsse_xferFastData(a, PE_PAGE_ERASE << 16 | 1, 0, 1);
+    mpsse_xferFastData(a, addr, 0, 1);
+
+    /* Sleep through the first half of the erase, instead of
+     * polling PrAcc over USB all the time. */
+    if (mwait("page erase", mpsse_pracc_ready, a,
+        a->adapter.page_erase_msec / 2, a->adapter.page_erase_msec) < 0) {
+        fprintf(stderr, "%s: page erase at %08x timed out\n", a->name, addr);
+        exit(-1);
+    }
+    response = get_pe_response(a);
+    if (response != (PE_PAGE_ERASE << 16)) {
+        fprintf(stderr, "%s: failed to erase page at %08x, reply = %08x\n",
+            a->name, addr, response);
+        exit(-1);
+    }
+}
+
+/*
+ * Check that memory is erased, by PE.
+ * Return 1 when blank, 0 when not, -1 when PE is not loaded.
+ */
+static int mpsse_blank_check(adapter_t *adapter,
+    unsigned addr, unsigned nwords)
+{
+    mpsse_adapter_t *a = (mpsse_adapter_t*) adapter;
+    unsigned response;
+
+    if (! a->use_executive)
+        return -1;
+
+    mpsse_sendCommand(a, ETAP_FASTDATA, 1);
+    mpsse_xferFastData(a, PE_BLANK_CHECK << 16, 0, 1);
+    mpsse_xferFastData(a, addr, 0, 1);
+    mpsse_xferFastData(a, nwords * 4, 0, 1);
+
+    response = get_pe_response(a);
+    if (response >> 16 != PE_BLANK_CHECK) {
+        fprintf(stderr, "%s: bad BLANK_CHECK response = %08x\n",
+            a->name, response);
+        exit(-1);
+    }
+    return (response & 0xffff) == 0;
+}
+
 /*
  * Verify a block of memory.
  */
@@ -1485,7 +2312,8 @@ static void mpsse_verify_data(adapter_t *adapter,
  * Initialize adapter F2232.
  * Return a pointer to a data structure, allocated dynamically.
  * When adapter not found, return 0.
- * Parameters vid, pid and serial are not used.
+ * When vid is nonzero, only devices with given vid:pid are probed.
+ * Parameter serial is not used.
  */
 adapter_t *adapter_open_mpsse(int vid, int pid, const char *serial, 
                                 int interface, int speed)
@@ -1500,6 +2328,7 @@ adapter_t *adapter_open_mpsse(int vid, int pid, const char *serial,
         return 0;
     }
     a->context = NULL;
+    a->ir = -1;
     int ret = libusb_init(&a->context);
 
     if (ret != 0) {
@@ -1509,6 +2338,8 @@ adapter_t *adapter_open_mpsse(int vid, int pid, const char *serial,
     }
 
     for (i = 0; devlist[i].vid; i++) {
+        if (vid && (devlist[i].vid != vid || devlist[i].pid != pid))
+            continue;
         a->usbdev = libusb_open_device_with_vid_pid(a->context, devlist[i].vid, devlist[i].pid);
         if (a->usbdev != NULL) {
             int match = 1;
@@ -1545,6 +2376,7 @@ adapter_t *adapter_open_mpsse(int vid, int pid, const char *serial,
                 a->icsp_oe_inverted     = devlist[i].icsp_oe_inverted;
                 goto found;
             }
+            libusb_close(a->usbdev);
         }
     }
 
@@ -1570,6 +2402,43 @@ found:
 
     libusb_claim_interface(a->usbdev, 0);
 
+    {
+        struct libusb_device_descriptor desc = {0};
+
+        /* Detect the chip type by device release number:
+         * FT2232H, FT4232H and FT232H have 60 MHz master clock,
+         * and TCK up to 30 MHz. Older chips have 6 MHz maximum. */
+        if (libusb_get_device_descriptor(libusb_get_device(a->usbdev), &desc) == 0) {
+            switch (desc.bcdDevice) {
+            case 0x0700:            /* FT2232H */
+            case 0x0800:            /* FT4232H */
+            case 0x0900:            /* FT232H */
+                a->mhz = 30;
+                break;
+            case 0x0500:            /* FT2232C/D */
+                a->mhz = 6;
+                break;
+            }
+            if (debug_level > 0)
+                fprintf(stderr, "%s: chip release %04x, max TCK %u MHz\n",
+                    a->name, desc.bcdDevice, a->mhz);
+        }
+
+        /* Serial number identifies the adapter for autospeed cache. */
+        if (desc.iSerialNumber == 0 ||
+            libusb_get_string_descriptor_ascii(a->usbdev, desc.iSerialNumber,
+                (unsigned char*) a->serial, sizeof(a->serial)) <= 0)
+            strcpy(a->serial, "-");
+    }
+
+    /* Size of USB packet: 64 bytes at full speed, 512 at high speed.
+     * Keep the reply of one flush within the receive buffer of the chip:
+     * 384 bytes on FT2232D, 2-4 kbytes on FT2232H/FT4232H/FT232H. */
+    a->max_packet = libusb_get_max_packet_size(libusb_get_device(a->usbdev), OUT_EP);
+    if (a->max_packet < 64)
+        a->max_packet = 64;
+    a->max_read_bytes = (a->max_packet >= 512) ? 2048 : 256;
+
     /* Reset the ftdi device. */
     if (libusb_control_transfer(a->usbdev,
         LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_OUT,
@@ -1592,14 +2461,17 @@ failed: libusb_release_interface(a->usbdev, 0);
         goto failed;
     }
 
-    /* Optimal latency timer is 1 for slow mode and 0 for fast mode. */
-    unsigned latency_timer = (a->mhz > 6) ? 0 : 1;
+    /* Optimal latency timer for interactive mode is 1 for slow chips
+     * and 0 for fast chips. It is switched in mpsse_flush_output(). */
+    unsigned latency_timer = LATENCY_INTERACTIVE(a);
+    a->latency = -1;
     if (libusb_control_transfer(a->usbdev,
         LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_OUT,
         SIO_SET_LATENCY_TIMER, latency_timer, 1, 0, 0, 1000) != 0) {
         fprintf(stderr, "%s: unable to set latency timer\n", a->name);
         goto failed;
     }
+    a->latency = latency_timer;
     if (libusb_control_transfer(a->usbdev,
         LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_IN,
         SIO_GET_LATENCY_TIMER, 0, 1, (unsigned char*) &latency_timer, 1, 1000) != 1) {
@@ -1609,9 +2481,13 @@ failed: libusb_release_interface(a->usbdev, 0);
     if (debug_level)
         fprintf(stderr, "%s: latency timer: %u usec\n", a->name, latency_timer);
 
-    /* By default, use 500 kHz speed, unless specified */
+    /* By default, use 500 kHz speed, unless specified.
+     * With autospeed, start from default and tune when PE is loaded. */
     int khz = 500;
-    if (0 != speed){
+    if (SPEED_AUTO == speed){
+        a->autospeed = 1;
+    }
+    else if (0 != speed){
         khz = speed;
     }
     mpsse_speed(a, khz);
@@ -1658,6 +2534,7 @@ failed: libusb_release_interface(a->usbdev, 0);
         goto failed;
     }
     printf("      IDCODE=%08x\n", idcode);
+    a->idcode = idcode;
 
     /* Activate /SYSRST and LED. Only done in JTAG mode */
     if (INTERFACE_JTAG == a->interface || INTERFACE_DEFAULT == a->interface)
@@ -1692,7 +2569,8 @@ failed: libusb_release_interface(a->usbdev, 0);
     printf("      Adapter: %s\n", a->name);
 
     a->adapter.block_override = 0;
-    a->adapter.flags = (AD_PROBE | AD_ERASE | AD_READ | AD_WRITE);
+    a->adapter.flags = (AD_PROBE | AD_ERASE | AD_READ | AD_WRITE | AD_VERIFY_SPAN);
+    a->adapter.round_trip_usec = 1000;
 
     /* User functions. */
     a->adapter.close = mpsse_close;
@@ -1701,9 +2579,12 @@ failed: libusb_release_interface(a->usbdev, 0);
     a->adapter.read_word = mpsse_read_word;
     a->adapter.read_data = mpsse_read_data;
     a->adapter.verify_data = mpsse_verify_data;
+    a->adapter.blank_check = mpsse_blank_check;
+    a->adapter.erase_page = mpsse_erase_page;
     a->adapter.erase_chip = mpsse_erase_chip;
     a->adapter.program_word = mpsse_program_word;
     a->adapter.program_row = mpsse_program_row;
+    a->adapter.program_cluster = mpsse_program_cluster;
     a->adapter.program_double_word = mpsse_program_double_word;
     a->adapter.program_quad_word = mpsse_program_quad_word;
     return &a->adapter;
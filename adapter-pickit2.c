@@ -304,6 +304,38 @@ step1_6_mz(pickit_adapter_t *a, unsigned nwords)
     check_timeout(a, "step6");
 }
 
+/*
+ * Check that CPU waits for a processor access:
+ * PE loader or PE is ready to get FASTDATA.
+ */
+static int pickit_pracc_ready(void *arg)
+{
+    pickit_adapter_t *a = arg;
+    unsigned ctl;
+
+    pickit_send(a, 11, CMD_CLEAR_UPLOAD_BUFFER, CMD_EXECUTE_SCRIPT, 7,
+        SCRIPT_JT2_SENDCMD, ETAP_CONTROL,
+        SCRIPT_JT2_XFERDATA32_LIT, WORD_AS_BYTES(CONTROL_PRACC |
+            CONTROL_PROBEN | CONTROL_PROBTRAP),
+        CMD_UPLOAD_DATA);
+    pickit_recv(a);
+    ctl = a->reply[1] | a->reply[2] << 8 | a->reply[3] << 16 | a->reply[4] << 24;
+    return (ctl & CONTROL_PRACC) != 0;
+}
+
+/*
+ * Wait for PE loader or PE, and select FASTDATA register again.
+ */
+static void pickit_wait_pe(pickit_adapter_t *a)
+{
+    if (mwait("PE start", pickit_pracc_ready, a, 0, 10) < 0) {
+        fprintf(stderr, "%s: PE does not respond\n", a->name);
+        exit(-1);
+    }
+    pickit_send(a, 4, CMD_EXECUTE_SCRIPT, 2,
+        SCRIPT_JT2_SENDCMD, ETAP_FASTDATA);
+}
+
 /*
  * Download programming executive (PE).
  */
@@ -358,7 +390,7 @@ static void pickit_load_executive(adapter_t *adapter,
                 SCRIPT_JT2_XFRFASTDAT_BUF);
         check_timeout(a, "step7");
     }
-    mdelay(100);
+    pickit_wait_pe(a);
 
     // Download the PE instructions
     pickit_send(a, 15, CMD_CLEAR_DOWNLOAD_BUFFER,
@@ -369,7 +401,7 @@ static void pickit_load_executive(adapter_t *adapter,
             SCRIPT_JT2_XFRFASTDAT_BUF,
             SCRIPT_JT2_XFRFASTDAT_BUF);
     check_timeout(a, "step8");
-    mdelay(100);
+    pickit_wait_pe(a);
 
     pickit_send(a, 11, CMD_CLEAR_UPLOAD_BUFFER,
         CMD_EXECUTE_SCRIPT, 8,
@@ -388,29 +420,72 @@ static void pickit_load_executive(adapter_t *adapter,
         exit(-1);
     }
     version = a->reply[1] | (a->reply[2] << 8);
-    if (version != pe_version) {
+    if (pe_version != 0 && version != pe_version) {
         fprintf(stderr, "%s: bad PE version = %04x, expected %04x\n",
             a->name, version, pe_version);
         exit(-1);
     }
     if (debug_level > 0)
         fprintf(stderr, "%s: PE version = %04x\n", a->name, version);
+    a->adapter.pe_version = version;
 }
 
-#if 0
-int pe_blank_check(pickit_adapter_t *a,
-    unsigned int start, unsigned int nbytes)
+/*
+ * Erase a page of flash memory, by PE.
+ */
+static void pickit_erase_page(adapter_t *adapter, unsigned addr)
 {
+    pickit_adapter_t *a = (pickit_adapter_t*) adapter;
+
+    if (debug_level > 0)
+        fprintf(stderr, "%s: erase page at %08x\n", a->name, addr);
+    if (! a->use_executive) {
+        fprintf(stderr, "%s: page erase needs PE.\n", a->name);
+        exit(-1);
+    }
+    pickit_send(a, 17, CMD_CLEAR_UPLOAD_BUFFER,
+        CMD_EXECUTE_SCRIPT, 13,
+            SCRIPT_JT2_SENDCMD, ETAP_FASTDATA,
+            SCRIPT_JT2_XFRFASTDAT_LIT,
+                1, 0, PE_PAGE_ERASE, 0,         // PAGE_ERASE, 1 page
+            SCRIPT_JT2_XFRFASTDAT_LIT,
+                (unsigned char) addr,
+                (unsigned char) (addr >> 8),
+                (unsigned char) (addr >> 16),
+                (unsigned char) (addr >> 24),
+            SCRIPT_JT2_GET_PE_RESP,
+        CMD_UPLOAD_DATA);
+    pickit_recv(a);
+    if (a->reply[0] != 4 || a->reply[1] != 0) { // response code 0 = success
+        fprintf(stderr, "%s: failed to erase page at %08x, reply = %02x-%02x-%02x-%02x-%02x\n",
+            a->name, addr, a->reply[0], a->reply[1], a->reply[2], a->reply[3], a->reply[4]);
+        exit(-1);
+    }
+}
+
+/*
+ * Check that memory is erased, by PE.
+ * Return 1 when blank, 0 when not, -1 when PE is not loaded.
+ */
+static int pickit_blank_check(adapter_t *adapter,
+    unsigned addr, unsigned nwords)
+{
+    pickit_adapter_t *a = (pickit_adapter_t*) adapter;
+    unsigned nbytes = nwords * 4;
+
+    if (! a->use_executive)
+        return -1;
+
     pickit_send(a, 21, CMD_CLEAR_UPLOAD_BUFFER, CMD_EXECUTE_SCRIPT, 18,
         SCRIPT_JT2_SENDCMD, ETAP_FASTDATA,
         SCRIPT_JT2_XFRFASTDAT_LIT,
             0x00, 0x00,
             0x06, 0x00,                         // BLANK_CHECK
         SCRIPT_JT2_XFRFASTDAT_LIT,
-            (unsigned char) start,
-            (unsigned char) (start >> 8),
-            (unsigned char) (start >> 16),
-            (unsigned char) (start >> 24),
+            (unsigned char) addr,
+            (unsigned char) (addr >> 8),
+            (unsigned char) (addr >> 16),
+            (unsigned char) (addr >> 24),
         SCRIPT_JT2_XFRFASTDAT_LIT,
             (unsigned char) nbytes,
             (unsigned char) (nbytes >> 8),
@@ -420,12 +495,15 @@ int pe_blank_check(pickit_adapter_t *a,
     check_timeout(a, "BLANK_CHECK");
     pickit_send(a, 1, CMD_UPLOAD_DATA);
     pickit_recv(a);
-    if (a->reply[3] != 6 || a->reply[1] != 0) { // response code 0 = success
-        return 0;
+    if (a->reply[3] != 6) {
+        fprintf(stderr, "%s: bad BLANK_CHECK response = %02x-%02x-%02x-%02x\n",
+            a->name, a->reply[1], a->reply[2], a->reply[3], a->reply[4]);
+        exit(-1);
     }
-    return 1;
+    return a->reply[1] == 0 && a->reply[2] == 0;   // response code 0 = blank
 }
 
+#if 0
 int pe_get_crc(pickit_adapter_t *a,
     unsigned int start, unsigned int nbytes)
 {
@@ -726,7 +804,12 @@ static void pickit_read_data(adapter_t *adapter,
         }
         pickit_send_buf(a, buf, k);
 
-        for (k = 0; k < 8; k++) {
+        for (k = 0; k < 8 && words_read < nwords; k++) {
+            unsigned chunk[32], n = nwords - words_read;
+
+            if (n > 32)
+                n = 32;
+
             /* Read progmem. */
             pickit_send(a, 17, CMD_CLEAR_UPLOAD_BUFFER,
                 CMD_EXECUTE_SCRIPT, 13,
@@ -739,17 +822,18 @@ static void pickit_read_data(adapter_t *adapter,
                     SCRIPT_LOOP, 1, 31,
                 CMD_UPLOAD_DATA_NOLEN);
             pickit_recv(a);
-            memcpy(data, a->reply, 64);
-//fprintf(stderr, "   ...%08x...\n", data[0]);
-            data += 64/4;
-            words_read += 64/4;
+            memcpy(chunk, a->reply, 64);
+//fprintf(stderr, "   ...%08x...\n", chunk[0]);
 
             /* Get second half of upload buffer. */
             pickit_send(a, 1, CMD_UPLOAD_DATA_NOLEN);
             pickit_recv(a);
-            memcpy(data, a->reply, 64);
-            data += 64/4;
-            words_read += 64/4;
+            memcpy(chunk + 64/4, a->reply, 64);
+
+            /* Don't write past the end of caller's buffer. */
+            memcpy(data, chunk, n * 4);
+            data += n;
+            words_read += n;
         }
     }
 }
@@ -779,6 +863,45 @@ static void download_data(pickit_adapter_t *a,
     pickit_send_buf(a, buf, k);
 }
 
+/*
+ * Send data to PE through the fast data register:
+ * by 256 bytes, and a tail of 128 bytes (the row of MX1/2 family).
+ */
+static void stream_data(pickit_adapter_t *a, unsigned *data, unsigned nwords)
+{
+    for (; nwords >= 64; nwords -= 64, data += 64) {
+        /* Download 256 bytes of data. */
+        download_data(a, data, 15, 1);
+        download_data(a, data+15, 15, 0);
+        download_data(a, data+30, 15, 0);
+        download_data(a, data+45, 15, 0);
+
+        pickit_send(a, 26,
+            CMD_DOWNLOAD_DATA, 4*4,
+                WORD_AS_BYTES(data[60]),
+                WORD_AS_BYTES(data[61]),
+                WORD_AS_BYTES(data[62]),
+                WORD_AS_BYTES(data[63]),
+            CMD_EXECUTE_SCRIPT, 6,              // execute
+                SCRIPT_JT2_SENDCMD, ETAP_FASTDATA,
+                SCRIPT_JT2_XFRFASTDAT_BUF,
+                SCRIPT_LOOP, 1, 63);
+    }
+    if (nwords >= 32) {
+        download_data(a, data, 15, 1);
+        download_data(a, data+15, 15, 0);
+
+        pickit_send(a, 18,
+            CMD_DOWNLOAD_DATA, 2*4,
+                WORD_AS_BYTES(data[30]),
+                WORD_AS_BYTES(data[31]),
+            CMD_EXECUTE_SCRIPT, 6,              // execute
+                SCRIPT_JT2_SENDCMD, ETAP_FASTDATA,
+                SCRIPT_JT2_XFRFASTDAT_BUF,
+                SCRIPT_LOOP, 1, 31);
+    }
+}
+
 /*
  * Write a word to flash memory.
  */
@@ -937,7 +1060,6 @@ static void pickit_program_row(adapter_t *adapter, unsigned addr,
     unsigned *data, unsigned words_per_row)
 {
     pickit_adapter_t *a = (pickit_adapter_t*) adapter;
-    unsigned i;
 
     if (debug_level > 0)
         fprintf(stderr, "%s: row program %u words at %08x\n",
@@ -961,42 +1083,7 @@ static void pickit_program_row(adapter_t *adapter, unsigned addr,
                 (unsigned char) (addr >> 24));
 
     /* Download data. */
-    if (words_per_row == 32) {
-        /* MX1/2 family. */
-        download_data(a, data, 15, 1);
-        download_data(a, data+15, 15, 0);
-
-        pickit_send(a, 18,
-            CMD_DOWNLOAD_DATA, 2*4,
-                WORD_AS_BYTES(data[30]),
-                WORD_AS_BYTES(data[31]),
-            CMD_EXECUTE_SCRIPT, 6,              // execute
-                SCRIPT_JT2_SENDCMD, ETAP_FASTDATA,
-                SCRIPT_JT2_XFRFASTDAT_BUF,
-                SCRIPT_LOOP, 1, 31);
-    } else {
-        /* MX3/4/5/6/7 or MZ family. */
-        for (i = 0; i < words_per_row/64; i++) {
-            /* Download 256 bytes of data. */
-            download_data(a, data, 15, 1);
-            download_data(a, data+15, 15, 0);
-            download_data(a, data+30, 15, 0);
-            download_data(a, data+45, 15, 0);
-
-            pickit_send(a, 26,
-                CMD_DOWNLOAD_DATA, 4*4,
-                    WORD_AS_BYTES(data[60]),
-                    WORD_AS_BYTES(data[61]),
-                    WORD_AS_BYTES(data[62]),
-                    WORD_AS_BYTES(data[63]),
-                CMD_EXECUTE_SCRIPT, 6,              // execute
-                    SCRIPT_JT2_SENDCMD, ETAP_FASTDATA,
-                    SCRIPT_JT2_XFRFASTDAT_BUF,
-                    SCRIPT_LOOP, 1, 63);
-
-            data += 64;
-        }
-    }
+    stream_data(a, data, words_per_row);
 
     pickit_send(a, 5, CMD_CLEAR_UPLOAD_BUFFER,
         CMD_EXECUTE_SCRIPT, 1,
@@ -1013,20 +1100,87 @@ static void pickit_program_row(adapter_t *adapter, unsigned addr,
     }
 }
 
+/*
+ * Flash write a span of rows by one PE command.
+ */
+static void pickit_program_cluster(adapter_t *adapter, unsigned addr,
+    unsigned nwords, unsigned *data)
+{
+    pickit_adapter_t *a = (pickit_adapter_t*) adapter;
+    unsigned nbytes = nwords * 4;
+
+    if (debug_level > 0)
+        fprintf(stderr, "%s: cluster program %u words at %08x\n",
+            a->name, nwords, addr);
+    if (! a->use_executive) {
+        fprintf(stderr, "%s: cluster program needs PE.\n", a->name);
+        exit(-1);
+    }
+
+    pickit_send(a, 20, CMD_CLEAR_UPLOAD_BUFFER,
+        CMD_EXECUTE_SCRIPT, 17,
+            SCRIPT_JT2_SENDCMD, ETAP_FASTDATA,
+            SCRIPT_JT2_XFRFASTDAT_LIT,
+                0, 0, PE_PROGRAM_CLUSTER, 0,    // PROGRAM CLUSTER
+            SCRIPT_JT2_XFRFASTDAT_LIT,
+                (unsigned char) addr,
+                (unsigned char) (addr >> 8),
+                (unsigned char) (addr >> 16),
+                (unsigned char) (addr >> 24),
+            SCRIPT_JT2_XFRFASTDAT_LIT,
+                (unsigned char) nbytes,
+                (unsigned char) (nbytes >> 8),
+                (unsigned char) (nbytes >> 16),
+                (unsigned char) (nbytes >> 24));
+
+    /* Download data. */
+    stream_data(a, data, nwords);
+
+    pickit_send(a, 5, CMD_CLEAR_UPLOAD_BUFFER,
+        CMD_EXECUTE_SCRIPT, 1,
+            SCRIPT_JT2_GET_PE_RESP,
+        CMD_UPLOAD_DATA);
+    pickit_recv(a);
+    if (a->reply[0] != 4 || a->reply[1] != 0) { // response code 0 = success
+        fprintf(stderr, "%s: failed to program cluster at %08x, reply = %02x-%02x-%02x-%02x-%02x\n",
+            a->name, addr, a->reply[0], a->reply[1], a->reply[2], a->reply[3], a->reply[4]);
+        exit(-1);
+    }
+}
+
 /*
  * Erase all flash memory.
  */
+static int pickit_erase_done(void *arg)
+{
+    pickit_adapter_t *a = arg;
+    unsigned status;
+
+    pickit_send(a, 6, CMD_CLEAR_UPLOAD_BUFFER, CMD_EXECUTE_SCRIPT, 2,
+        SCRIPT_JT2_XFERDATA8_LIT, MCHP_STATUS,
+        CMD_UPLOAD_DATA);
+    pickit_recv(a);
+    status = a->reply[1];
+    return (status & (MCHP_STATUS_CFGRDY | MCHP_STATUS_FCBUSY)) == MCHP_STATUS_CFGRDY;
+}
+
 static void pickit_erase_chip(adapter_t *adapter)
 {
     pickit_adapter_t *a = (pickit_adapter_t*) adapter;
 
     //fprintf(stderr, "%s: erase chip\n", a->name);
-    pickit_send(a, 11, CMD_CLEAR_UPLOAD_BUFFER, CMD_EXECUTE_SCRIPT, 8,
+    pickit_send(a, 9, CMD_CLEAR_UPLOAD_BUFFER, CMD_EXECUTE_SCRIPT, 6,
         SCRIPT_JT2_SENDCMD, TAP_SW_MTAP,
         SCRIPT_JT2_SENDCMD, MTAP_COMMAND,
-        SCRIPT_JT2_XFERDATA8_LIT, MCHP_ERASE,
-        SCRIPT_DELAY_LONG, 74);                 // 400 msec
+        SCRIPT_JT2_XFERDATA8_LIT, MCHP_ERASE);
     check_timeout(a, "chip erase");
+
+    /* Poll status, instead of fixed 400 msec delay.
+     * Give the erase some time to start and set FCBUSY. */
+    if (mwait("erase", pickit_erase_done, a, 10, a->adapter.erase_msec) < 0) {
+        fprintf(stderr, "%s: chip erase timed out\n", a->name);
+        exit(-1);
+    }
 }
 
 /*
@@ -1149,7 +1303,9 @@ static adapter_t *open_pickit(hid_device *hiddev, int is_pk3)
             fprintf(stderr, "%s: invalid status = %04x.\n", a->name, status);
             return 0;
         }
-        /* Wait for power to stabilize. */
+        /* Wait for power to stabilize. Nothing to poll here:
+         * PICkit senses Vdd at its own output, not the power-on
+         * reset of the chip, so the delay stays fixed. */
         mdelay(500);
         break;
 
@@ -1213,10 +1369,13 @@ static adapter_t *open_pickit(hid_device *hiddev, int is_pk3)
     a->adapter.load_executive = pickit_load_executive;
     a->adapter.read_word = pickit_read_word;
     a->adapter.read_data = pickit_read_data;
+    a->adapter.blank_check = pickit_blank_check;
+    a->adapter.erase_page = pickit_erase_page;
     a->adapter.erase_chip = pickit_erase_chip;
     a->adapter.program_word = pickit_program_word;
     a->adapter.program_double_word = pickit_program_double_word;
     a->adapter.program_row = pickit_program_row;
+    a->adapter.program_cluster = pickit_program_cluster;
     a->adapter.program_quad_word = pickit_program_quad_word;
     return &a->adapter;
 }
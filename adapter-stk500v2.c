@@ -59,6 +59,7 @@ typedef struct {
     /* Common part */
     adapter_t adapter;
 
+    serial_t        *serial;
     int             first_time;
     int             timeout_msec;
     unsigned        baud;
@@ -102,9 +103,9 @@ again:
         printf("-%x\n", sum);
     }
 
-    if (serial_write(hdr, 5) < 0 ||
-        serial_write(cmd, cmdlen) < 0 ||
-        serial_write(&sum, 1) < 0) {
+    if (serial_write(a->serial, hdr, 5) < 0 ||
+        serial_write(a->serial, cmd, cmdlen) < 0 ||
+        serial_write(a->serial, &sum, 1) < 0) {
         fprintf(stderr, "stk-send: write error\n");
         exit(-1);
     }
@@ -115,7 +116,7 @@ again:
     p = hdr;
     len = 0;
     while (len < 5) {
-        got = serial_read(p, 5 - len, a->timeout_msec);
+        got = serial_read(a->serial, p, 5 - len, a->timeout_msec);
         if (! got)
             return 0;
 
@@ -131,7 +132,7 @@ again:
             printf("got invalid header: %x-%x-%x-%x-%x\n",
                 hdr[0], hdr[1], hdr[2], hdr[3], hdr[4]);
 flush_input:
-        serial_read(buf, sizeof(buf), a->timeout_msec);
+        serial_read(a->serial, buf, sizeof(buf), a->timeout_msec);
         if (retry) {
             retry = 1;
             goto again;
@@ -151,7 +152,7 @@ flush_input:
     p = response;
     len = 0;
     while (len < rlen) {
-        got = serial_read(p, rlen - len, a->timeout_msec);
+        got = serial_read(a->serial, p, rlen - len, a->timeout_msec);
         if (! got)
             return 0;
 
@@ -165,7 +166,7 @@ flush_input:
     p = &sum;
     len = 0;
     while (len < 1) {
-        got = serial_read(p, 1, a->timeout_msec);
+        got = serial_read(a->serial, p, 1, a->timeout_msec);
         if (! got)
             return 0;
         ++len;
@@ -209,7 +210,7 @@ static void switch_baud(stk_adapter_t *a)
             response[4] == cmd[3] &&
             response[5] == cmd[4])
         {
-            serial_baud(alternate_speed);
+            serial_baud(a->serial, alternate_speed);
             printf("    Baud rate: %d bps\n", alternate_speed);
         } else {
             printf("    Baud rate: %d bps\n", a->baud);
@@ -291,7 +292,7 @@ static void prog_disable(stk_adapter_t *a)
 
     /* Skip all incoming data. */
     unsigned char buf [300];
-    serial_read(buf, sizeof(buf), a->timeout_msec);
+    serial_read(a->serial, buf, sizeof(buf), a->timeout_msec);
 
     /* Leave programming mode; ignore errors. */
     send_receive(a, cmd, 3, response, 2);
@@ -421,7 +422,7 @@ static void stk_close(adapter_t *adapter, int power_on)
     prog_disable(a);
 
     /* restore and close serial port */
-    serial_close();
+    serial_close(a->serial);
     free(a);
 }
 
@@ -564,7 +565,7 @@ adapter_t *adapter_open_stk500v2(const char *port, int baud_rate)
     a->timeout_msec = 1000;
 
     /* Open serial port */
-    if (serial_open(port, baud_rate) < 0) {
+    if ((a->serial = serial_open(port, baud_rate)) == 0) {
         /* failed to open serial port */
         free(a);
         return 0;
@@ -599,14 +600,18 @@ adapter_t *adapter_open_stk500v2(const char *port, int baud_rate)
         if (retry_count >= 3) {
             /* Bad reply or no device connected */
             retry_count = 0;
-            serial_close();
+            serial_close(a->serial);
             usleep(200000);
-            serial_open(port, baud_rate);
+            a->serial = serial_open(port, baud_rate);
+            if (! a->serial) {
+                free(a);
+                return 0;
+            }
             outer_retry++;
         }
         if (outer_retry >= 2) {
+            serial_close(a->serial);
             free(a);
-            serial_close();
             return 0;
         }
     }
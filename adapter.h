@@ -17,11 +17,14 @@
 #define AD_WRITE 0x0002
 #define AD_ERASE 0x0004
 #define AD_PROBE 0x0008
+#define AD_VERIFY_SPAN 0x0010        /* verify_data accepts any length */
 
 #define INTERFACE_DEFAULT   0
 #define INTERFACE_JTAG      1
 #define INTERFACE_ICSP      2
 
+#define SPEED_AUTO          -1      /* Tune the interface clock */
+
 typedef struct _adapter_t adapter_t;
 
 struct _adapter_t {
@@ -34,10 +37,16 @@ struct _adapter_t {
     unsigned flags;
     const char *family_name;            /* Name of pic32 family */
 	unsigned family_name_short;			/* Int define of the family name */
+    unsigned erase_msec;                /* Expected time of chip erase */
+    unsigned row_usec;                  /* Expected time of row write */
+    unsigned page_erase_msec;           /* Expected time of page erase */
+    unsigned round_trip_usec;           /* Latency of one request, for planning */
+    unsigned bytes_per_sec;             /* Data rate of the link, for planning */
+    unsigned pe_version;                /* Version of running PE, or 0 */
 
     void (*close)(adapter_t *a, int power_on);
     unsigned (*get_idcode)(adapter_t *a);
-    void (*load_executive)(adapter_t *a,
+    void (*load_executive)(adapter_t *a,         /* Any version when 0 */
         const unsigned *pe, unsigned nwords, unsigned pe_version);
     void (*read_data)(adapter_t *a, unsigned addr, unsigned nwords, unsigned *data);
     void (*verify_data)(adapter_t *a, unsigned addr, unsigned nwords, unsigned *data);
@@ -45,10 +54,13 @@ struct _adapter_t {
     void (*program_quad_word)(adapter_t *a, unsigned addr, unsigned word0,
         unsigned word1, unsigned word2, unsigned word3);
     void (*program_row)(adapter_t *a, unsigned addr, unsigned *data, unsigned words_per_row);
+    void (*program_cluster)(adapter_t *a, unsigned addr, unsigned nwords, unsigned *data);
     void (*program_word)(adapter_t *a, unsigned addr, unsigned word);
     void (*program_double_word)(adapter_t *a, unsigned addr, unsigned word0, unsigned word1);
     unsigned (*read_word)(adapter_t *a, unsigned addr);
+    int (*blank_check)(adapter_t *a, unsigned addr, unsigned nwords);
     void (*erase_chip)(adapter_t *a);
+    void (*erase_page)(adapter_t *a, unsigned addr);
 };
 
 adapter_t *adapter_open_pickit2(int vid, int pid, const char *serial);
@@ -56,12 +68,16 @@ adapter_t *adapter_open_pickit3(int vid, int pid, const char *serial);
 adapter_t *adapter_open_an1388(int vid, int pid, const char *serial);
 adapter_t *adapter_open_hidboot(int vid, int pid, const char *serial);
 adapter_t *adapter_open_mpsse(int vid, int pid, const char *serial, int interface, int speed);
+int adapter_mpsse_id(int index, unsigned short *vid, unsigned short *pid);
 adapter_t *adapter_open_bitbang(const char *port, int baud_rate);
 adapter_t *adapter_open_an1388_uart(const char *port, int baud_rate);
 adapter_t *adapter_open_stk500v2(const char *port, int baud_rate);
 adapter_t *adapter_open_uhb(int vid, int pid, const char *serial);
 
 void mdelay(unsigned msec);
+int mwait(const char *name, int (*ready)(void *arg), void *arg,
+    unsigned first_msec, unsigned expected_msec);
+void mwait_stats(void);
 extern int debug_level;
 
 #endif
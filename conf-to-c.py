@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+#
+# Convert pic32prog.conf to a C table of chip variants,
+# indexed by a perfect hash of DEVID.
+#
+# Usage: conf-to-c.py pic32prog.conf > pic32tab.inc
+#
+import sys, re
+
+if len(sys.argv) != 2:
+    print("Usage: %s file" % sys.argv[0])
+    sys.exit(1)
+
+#
+# Entries which are not real chips, and so are not listed in the config file.
+#
+builtin = [
+    (0xEAFB00B, "Bootloader", 0, "bl"),     # USB bootloader
+]
+
+families = ("mx1", "mx3", "mz", "mk", "mm_gpl", "mm_gpm", "bl")
+
+#
+# Must match pic32_hash() in target.c.
+#
+def pic32_hash(id, seed):
+    h = id ^ seed
+    h = ((h ^ (h >> 16)) * 0x85ebca6b) & 0xffffffff
+    h = ((h ^ (h >> 13)) * 0xc2b2ae35) & 0xffffffff
+    return h ^ (h >> 16)
+
+def parse_conf(filename):
+    variants = []
+    section = None
+    params = {}
+
+    def flush():
+        if section is None:
+            return
+        if "id" not in params or "family" not in params or "flash" not in params:
+            sys.stderr.write("%s: Not enough parameters for section %s\n" %
+                (filename, section))
+            sys.exit(1)
+        flash = params["flash"]
+        kbytes = int(flash[:-1], 0)
+        if flash[-1] in "mM":
+            kbytes *= 1024
+        elif flash[-1] not in "kK":
+            sys.stderr.write("%s: Invalid Flash size: %s\n" % (filename, flash))
+            sys.exit(1)
+        family = params["family"].lower()
+        if family not in families:
+            sys.stderr.write("%s: Unknown family=%s.\n" % (section, family))
+            sys.exit(1)
+        variants.append((int(params["id"], 0), section, kbytes, family))
+
+    for line in open(filename):
+        line = re.split("[#;]", line)[0].strip()
+        if not line:
+            continue
+        m = re.match(r"\[\s*(.*?)\s*\]$", line)
+        if m:
+            flush()
+            section = m.group(1)
+            params = {}
+            continue
+        name, value = [s.strip() for s in line.split("=", 1)]
+        params[name.lower()] = value
+    flush()
+    return variants
+
+variants = parse_conf(sys.argv[1]) + builtin
+
+# Check for duplicates: the DEVID is compared without revision bits.
+ids = {}
+for v in variants:
+    id = v[0] & 0x0fffffff
+    if id in ids:
+        sys.stderr.write("%s: duplicate id %07x, also in %s\n" %
+            (v[1], id, ids[id]))
+        sys.exit(1)
+    ids[id] = v[1]
+
+# Table size is a power of two, filled by 3/4 at most.
+tabsz = 1
+while tabsz * 3 < len(variants) * 4:
+    tabsz <<= 1
+nbuckets = tabsz // 4
+
+# Distribute keys into buckets, then find a seed for every bucket,
+# largest buckets first, so that all keys get distinct slots.
+buckets = [[] for i in range(nbuckets)]
+for v in variants:
+    buckets[pic32_hash(v[0], 0) % nbuckets].append(v)
+
+slots = [None] * tabsz
+seeds = [0] * nbuckets
+for b in sorted(range(nbuckets), key=lambda b: -len(buckets[b])):
+    if not buckets[b]:
+        continue
+    for seed in range(1, 0x10000):
+        pos = [pic32_hash(v[0], seed) % tabsz for v in buckets[b]]
+        if len(set(pos)) == len(pos) and all(slots[p] is None for p in pos):
+            break
+    else:
+        sys.stderr.write("Cannot find a perfect hash for bucket %d\n" % b)
+        sys.exit(1)
+    seeds[b] = seed
+    for p, v in zip(pos, buckets[b]):
+        slots[p] = v
+
+print("/*")
+print(" * Table of PIC32 chip variants, generated from %s" % sys.argv[1])
+print(" * by conf-to-c.py script. Do not edit.")
+print(" */")
+print("#define PIC32_TABSZ     %d" % tabsz)
+print("#define PIC32_NBUCKETS  %d" % nbuckets)
+print("")
+print("static const unsigned short pic32_seed[PIC32_NBUCKETS] = {")
+for i in range(0, nbuckets, 8):
+    print("    " + " ".join("%5d," % s for s in seeds[i:i+8]))
+print("};")
+print("")
+print("static const variant_t pic32_tab[PIC32_TABSZ] = {")
+for i, v in enumerate(slots):
+    if v is None:
+        print("    /*%3d*/ {0},"  % i)
+    else:
+        print("    /*%3d*/ {0x%07X, %-15s %5d,   &family_%s}," %
+            (i, v[0], '"%s",' % v[1], v[2], v[3]))
+print("};")
@@ -0,0 +1,464 @@
+/*
+ * Writing memory dumps to a file.
+ *
+ * The reader fills one buffer with data from the target,
+ * while a separate thread encodes and writes the other one.
+ * This way the device is never kept waiting for the disk.
+ *
+ * Copyright (C) 2015 Serge Vakulenko
+ *
+ * This file is part of PIC32PROG project, which is distributed
+ * under the terms of the GNU General Public License (GPL).
+ * See the accompanying file "COPYING" for more details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "dump.h"
+
+#define NBUF            2       /* Double buffering */
+#define HEX_RECLEN      16      /* Data bytes per HEX or SREC record */
+
+#define ELF_EHSIZE      52      /* Size of ELF32 file header */
+#define ELF_PHSIZE      32      /* Size of ELF32 program header */
+
+typedef struct {
+    unsigned data [DUMP_BUFSZ / 4];
+    unsigned addr;              /* Target address of data */
+    unsigned nbytes;            /* Number of valid bytes */
+    int full;                   /* Buffer is owned by writer */
+} buffer_t;
+
+typedef struct {
+    unsigned addr;              /* Target address */
+    unsigned offset;            /* Offset in file */
+    unsigned nbytes;            /* Length in bytes */
+} region_t;
+
+struct _dump_t {
+    FILE *fd;
+    int format;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* Buffer passed in either direction */
+    buffer_t buf [NBUF];
+    int fill;                   /* Next buffer for reader */
+    int drain;                  /* Next buffer for writer */
+    int done;                   /* No more data */
+    int error;                  /* Write failed */
+    int started;                /* Origin is set */
+    unsigned origin;            /* Lowest address, for raw image */
+    unsigned end;               /* Highest address, for raw image */
+
+    region_t *region;           /* Contiguous regions written */
+    int nregions;
+    int maxregions;
+    unsigned high;              /* Upper address of last HEX record */
+};
+
+static const char hexdigit[] = "0123456789ABCDEF";
+
+static const unsigned char erased [1024] = {
+#define FF8 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+#define FF64 FF8, FF8, FF8, FF8, FF8, FF8, FF8, FF8
+    FF64, FF64, FF64, FF64, FF64, FF64, FF64, FF64,
+    FF64, FF64, FF64, FF64, FF64, FF64, FF64, FF64,
+};
+
+int dump_format(const char *name)
+{
+    if (strcasecmp(name, "raw") == 0 || strcasecmp(name, "bin") == 0)
+        return DUMP_RAW;
+    if (strcasecmp(name, "hex") == 0 || strcasecmp(name, "ihex") == 0)
+        return DUMP_HEX;
+    if (strcasecmp(name, "srec") == 0)
+        return DUMP_SREC;
+    if (strcasecmp(name, "elf") == 0)
+        return DUMP_ELF;
+    return -1;
+}
+
+int dump_format_of(const char *filename)
+{
+    const char *ext = strrchr(filename, '.');
+
+    if (! ext)
+        return DUMP_RAW;
+    ext++;
+    if (strcasecmp(ext, "hex") == 0 || strcasecmp(ext, "ihx") == 0)
+        return DUMP_HEX;
+    if (strcasecmp(ext, "srec") == 0 || strcasecmp(ext, "s19") == 0 ||
+        strcasecmp(ext, "s28") == 0 || strcasecmp(ext, "s37") == 0 ||
+        strcasecmp(ext, "mot") == 0)
+        return DUMP_SREC;
+    if (strcasecmp(ext, "elf") == 0)
+        return DUMP_ELF;
+    return DUMP_RAW;
+}
+
+static void put16(unsigned char *p, unsigned val)
+{
+    p[0] = val;
+    p[1] = val >> 8;
+}
+
+static void put32(unsigned char *p, unsigned val)
+{
+    p[0] = val;
+    p[1] = val >> 8;
+    p[2] = val >> 16;
+    p[3] = val >> 24;
+}
+
+/*
+ * Account the data in the list of regions.
+ * Return 1 when a new region is started.
+ */
+static int add_region(dump_t *d, unsigned addr, unsigned nbytes)
+{
+    region_t *r;
+
+    if (d->nregions > 0) {
+        r = &d->region [d->nregions - 1];
+        if (addr == r->addr + r->nbytes) {
+            r->nbytes += nbytes;
+            return 0;
+        }
+    }
+    if (d->nregions >= d->maxregions) {
+        d->maxregions = d->maxregions ? d->maxregions * 2 : 8;
+        d->region = realloc(d->region, d->maxregions * sizeof(region_t));
+        if (! d->region) {
+            fprintf(stderr, "dump: out of memory\n");
+            exit(-1);
+        }
+    }
+    r = &d->region [d->nregions++];
+    r->addr = addr;
+    r->offset = ftell(d->fd);
+    r->nbytes = nbytes;
+    return 1;
+}
+
+/*
+ * Pad the raw image with erased bytes up to the given length.
+ */
+static int pad(dump_t *d, unsigned length)
+{
+    unsigned pos = ftell(d->fd), n;
+
+    while (pos < length) {
+        n = length - pos;
+        if (n > sizeof(erased))
+            n = sizeof(erased);
+        if (fwrite(erased, 1, n, d->fd) != n)
+            return -1;
+        pos += n;
+    }
+    return 0;
+}
+
+static void hex_record(dump_t *d, unsigned type, unsigned addr,
+    const unsigned char *data, unsigned nbytes)
+{
+    char line [16 + HEX_RECLEN*2], *p = line;
+    unsigned sum, i;
+
+    sum = nbytes + (addr >> 8 & 0xff) + (addr & 0xff) + type;
+    p += sprintf(p, ":%02X%04X%02X", nbytes, addr & 0xffff, type);
+    for (i=0; i<nbytes; i++) {
+        *p++ = hexdigit [data[i] >> 4];
+        *p++ = hexdigit [data[i] & 15];
+        sum += data[i];
+    }
+    sprintf(p, "%02X\n", -sum & 0xff);
+    fputs(line, d->fd);
+}
+
+static void srec_record(dump_t *d, int type, unsigned addr,
+    const unsigned char *data, unsigned nbytes)
+{
+    char line [20 + HEX_RECLEN*2], *p = line;
+    unsigned sum, i;
+
+    sum = (nbytes + 5) + (addr >> 24) + (addr >> 16 & 0xff) +
+        (addr >> 8 & 0xff) + (addr & 0xff);
+    p += sprintf(p, "S%c%02X%08X", type, nbytes + 5, addr);
+    for (i=0; i<nbytes; i++) {
+        *p++ = hexdigit [data[i] >> 4];
+        *p++ = hexdigit [data[i] & 15];
+        sum += data[i];
+    }
+    sprintf(p, "%02X\n", ~sum & 0xff);
+    fputs(line, d->fd);
+}
+
+/*
+ * Encode one buffer of data.
+ * Return -1 on error.
+ */
+static int encode(dump_t *d, buffer_t *b)
+{
+    const unsigned char *data = (const unsigned char*) b->data;
+    unsigned addr = b->addr;
+    unsigned nbytes = b->nbytes;
+    unsigned n;
+
+    switch (d->format) {
+    case DUMP_RAW:
+        /* Raw image cannot go backwards; gaps are filled as erased. */
+        if (addr < d->origin || pad(d, addr - d->origin) < 0)
+            return -1;
+        add_region(d, addr, nbytes);
+        if (fwrite(data, 1, nbytes, d->fd) != nbytes)
+            return -1;
+        break;
+
+    case DUMP_HEX:
+        while (nbytes > 0) {
+            n = HEX_RECLEN;
+            if (n > nbytes)
+                n = nbytes;
+            if (n > 0x10000 - (addr & 0xffff))
+                n = 0x10000 - (addr & 0xffff);
+            if (addr >> 16 != d->high) {
+                /* Extended linear address. */
+                unsigned char ela[2] = { addr >> 24, addr >> 16 };
+
+                hex_record(d, 4, 0, ela, 2);
+                d->high = addr >> 16;
+            }
+            hex_record(d, 0, addr, data, n);
+            addr += n;
+            data += n;
+            nbytes -= n;
+        }
+        break;
+
+    case DUMP_SREC:
+        while (nbytes > 0) {
+            n = HEX_RECLEN;
+            if (n > nbytes)
+                n = nbytes;
+            srec_record(d, '3', addr, data, n);
+            addr += n;
+            data += n;
+            nbytes -= n;
+        }
+        break;
+
+    case DUMP_ELF:
+        add_region(d, addr, nbytes);
+        if (fwrite(data, 1, nbytes, d->fd) != nbytes)
+            return -1;
+        break;
+    }
+    return ferror(d->fd) ? -1 : 0;
+}
+
+/*
+ * Write the ELF file header and a PT_LOAD segment for every region.
+ * Program headers are placed after the data, as the number
+ * of regions is not known in advance.
+ */
+static int finish_elf(dump_t *d)
+{
+    unsigned char hdr [ELF_EHSIZE], *ph;
+    unsigned phoff;
+    int i;
+
+    phoff = (ftell(d->fd) + 3) & ~3;
+    fseek(d->fd, phoff, SEEK_SET);
+    for (i=0; i<d->nregions; i++) {
+        unsigned char phdr [ELF_PHSIZE];
+
+        ph = phdr;
+        put32(ph, 1);                           /* PT_LOAD */
+        put32(ph + 4, d->region[i].offset);
+        put32(ph + 8, d->region[i].addr);       /* Virtual address */
+        put32(ph + 12, d->region[i].addr & 0x1fffffff); /* Physical */
+        put32(ph + 16, d->region[i].nbytes);
+        put32(ph + 20, d->region[i].nbytes);
+        put32(ph + 24, 5);                      /* PF_R | PF_X */
+        put32(ph + 28, 4);
+        if (fwrite(phdr, 1, ELF_PHSIZE, d->fd) != ELF_PHSIZE)
+            return -1;
+    }
+
+    memset(hdr, 0, sizeof(hdr));
+    hdr[0] = 0x7f;
+    hdr[1] = 'E';
+    hdr[2] = 'L';
+    hdr[3] = 'F';
+    hdr[4] = 1;                                 /* ELFCLASS32 */
+    hdr[5] = 1;                                 /* ELFDATA2LSB */
+    hdr[6] = 1;                                 /* EV_CURRENT */
+    put16(hdr + 16, 2);                         /* ET_EXEC */
+    put16(hdr + 18, 8);                         /* EM_MIPS */
+    put32(hdr + 20, 1);                         /* EV_CURRENT */
+    put32(hdr + 28, phoff);
+    put32(hdr + 36, 0x70000000);                /* EF_MIPS_ARCH_32R2 */
+    put16(hdr + 40, ELF_EHSIZE);
+    put16(hdr + 42, ELF_PHSIZE);
+    put16(hdr + 44, d->nregions);
+    fseek(d->fd, 0, SEEK_SET);
+    if (fwrite(hdr, 1, ELF_EHSIZE, d->fd) != ELF_EHSIZE)
+        return -1;
+    return 0;
+}
+
+/*
+ * Writer thread: encode and write buffers in order.
+ */
+static void *writer(void *arg)
+{
+    dump_t *d = arg;
+    buffer_t *b;
+    int full, failed;
+
+    for (;;) {
+        b = &d->buf [d->drain];
+        pthread_mutex_lock(&d->lock);
+        while (! b->full && ! d->done)
+            pthread_cond_wait(&d->cond, &d->lock);
+        full = b->full;
+        failed = d->error;
+        pthread_mutex_unlock(&d->lock);
+        if (! full)
+            break;
+
+        /* After an error, keep releasing buffers to the reader. */
+        if (! failed && encode(d, b) < 0)
+            failed = 1;
+
+        pthread_mutex_lock(&d->lock);
+        if (failed)
+            d->error = 1;
+        b->full = 0;
+        d->drain = (d->drain + 1) % NBUF;
+        pthread_cond_broadcast(&d->cond);
+        pthread_mutex_unlock(&d->lock);
+    }
+    return 0;
+}
+
+dump_t *dump_open(const char *filename, int format)
+{
+    dump_t *d;
+
+    d = calloc(1, sizeof(dump_t));
+    if (! d) {
+        fprintf(stderr, "dump: out of memory\n");
+        exit(-1);
+    }
+    d->format = format;
+    d->high = ~0;
+    d->fd = fopen(filename, (format == DUMP_HEX || format == DUMP_SREC) ?
+        "w" : "wb");
+    if (! d->fd) {
+        free(d);
+        return 0;
+    }
+    if (format == DUMP_ELF) {
+        /* Reserve space for the file header. */
+        unsigned char hdr [ELF_EHSIZE];
+
+        memset(hdr, 0, sizeof(hdr));
+        fwrite(hdr, 1, ELF_EHSIZE, d->fd);
+    }
+    pthread_mutex_init(&d->lock, 0);
+    pthread_cond_init(&d->cond, 0);
+    if (pthread_create(&d->thread, 0, writer, d) != 0) {
+        fclose(d->fd);
+        free(d);
+        return 0;
+    }
+    return d;
+}
+
+unsigned *dump_buffer(dump_t *d)
+{
+    buffer_t *b = &d->buf [d->fill];
+    int failed;
+
+    pthread_mutex_lock(&d->lock);
+    while (b->full && ! d->error)
+        pthread_cond_wait(&d->cond, &d->lock);
+    failed = d->error;
+    pthread_mutex_unlock(&d->lock);
+    return failed ? 0 : b->data;
+}
+
+/*
+ * Track the address range, for raw image.
+ * Called by the reader only.
+ */
+static void extent(dump_t *d, unsigned addr, unsigned nbytes)
+{
+    if (! d->started) {
+        d->origin = addr;
+        d->started = 1;
+    }
+    if (d->end < addr + nbytes)
+        d->end = addr + nbytes;
+}
+
+void dump_hole(dump_t *d, unsigned addr, unsigned nbytes)
+{
+    extent(d, addr, nbytes);
+}
+
+void dump_write(dump_t *d, unsigned addr, unsigned nbytes)
+{
+    buffer_t *b = &d->buf [d->fill];
+
+    extent(d, addr, nbytes);
+    pthread_mutex_lock(&d->lock);
+    b->addr = addr;
+    b->nbytes = nbytes;
+    b->full = 1;
+    pthread_cond_broadcast(&d->cond);
+    pthread_mutex_unlock(&d->lock);
+    d->fill = (d->fill + 1) % NBUF;
+}
+
+int dump_close(dump_t *d)
+{
+    int failed;
+
+    pthread_mutex_lock(&d->lock);
+    d->done = 1;
+    pthread_cond_broadcast(&d->cond);
+    pthread_mutex_unlock(&d->lock);
+    pthread_join(d->thread, 0);
+
+    failed = d->error;
+    if (! failed) {
+        switch (d->format) {
+        case DUMP_RAW:
+            if (pad(d, d->end - d->origin) < 0)
+                failed = 1;
+            break;
+        case DUMP_HEX:
+            hex_record(d, 1, 0, 0, 0);
+            break;
+        case DUMP_SREC:
+            srec_record(d, '7', 0, 0, 0);
+            break;
+        case DUMP_ELF:
+            if (finish_elf(d) < 0)
+                failed = 1;
+            break;
+        }
+    }
+    if (ferror(d->fd))
+        failed = 1;
+    if (fclose(d->fd) != 0)
+        failed = 1;
+    pthread_cond_destroy(&d->cond);
+    pthread_mutex_destroy(&d->lock);
+    free(d->region);
+    free(d);
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Writing memory dumps to a file.
+ *
+ * Copyright (C) 2015 Serge Vakulenko
+ *
+ * This file is part of PIC32PROG project, which is distributed
+ * under the terms of the GNU General Public License (GPL).
+ * See the accompanying file "COPYING" for more details.
+ */
+
+#ifndef _DUMP_H
+#define _DUMP_H
+
+/*
+ * Output formats.
+ */
+#define DUMP_RAW        0       /* Binary image */
+#define DUMP_HEX        1       /* Intel HEX */
+#define DUMP_SREC       2       /* Motorola S-records */
+#define DUMP_ELF        3       /* ELF executable, one segment per region */
+
+/*
+ * Size of every data buffer, in bytes.
+ */
+#define DUMP_BUFSZ      (64 * 1024)
+
+typedef struct _dump_t dump_t;
+
+/*
+ * Get the format by name: "raw", "hex", "srec" or "elf".
+ * Return -1 when unknown.
+ */
+int dump_format(const char *name);
+
+/*
+ * Guess the format by the file name extension.
+ * Binary format is used by default.
+ */
+int dump_format_of(const char *filename);
+
+/*
+ * Create the output file and start the writer thread.
+ * Return a handle, or 0 on error.
+ */
+dump_t *dump_open(const char *filename, int format);
+
+/*
+ * Get the next empty buffer of DUMP_BUFSZ bytes,
+ * waiting while the writer is busy with it.
+ * Return 0 when writing has failed.
+ */
+unsigned *dump_buffer(dump_t *dump);
+
+/*
+ * Pass the buffer, filled with nbytes of data from addr,
+ * to the writer thread. Data at a non-contiguous address
+ * starts a new region.
+ */
+void dump_write(dump_t *dump, unsigned addr, unsigned nbytes);
+
+/*
+ * Account an erased range, which was not read from the target.
+ * Raw image is padded with 0xff bytes; other formats skip it.
+ */
+void dump_hole(dump_t *dump, unsigned addr, unsigned nbytes);
+
+/*
+ * Flush all data, finish the file and close it.
+ * Return -1 on error.
+ */
+int dump_close(dump_t *dump);
+
+#endif
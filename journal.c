@@ -0,0 +1,195 @@
+/*
+ * Journal of programming progress, for resuming
+ * an interrupted session.
+ *
+ * The journal is a text file: a header with the hash of the image
+ * and the device ID of the chip, followed by one line for every row
+ * which has been programmed and verified.  Lines are only appended,
+ * so a file cut short by a crash still holds a valid prefix.
+ *
+ * Copyright (C) 2015 Serge Vakulenko
+ *
+ * This file is part of PIC32PROG project, which is distributed
+ * under the terms of the GNU General Public License (GPL).
+ * See the accompanying file "COPYING" for more details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "journal.h"
+
+#define FLUSH_ROWS      16      /* Flush the file every so many rows */
+
+struct _journal_t {
+    FILE *fd;
+    char *filename;
+    unsigned long long hash;    /* Hash of the image */
+    unsigned devid;             /* Device ID of the chip */
+    unsigned *row;              /* Addresses of confirmed rows */
+    unsigned nrows;
+    unsigned maxrows;
+    int sorted;                 /* Row array is sorted */
+    unsigned unflushed;         /* Rows written since last flush */
+};
+
+static int compare(const void *a, const void *b)
+{
+    unsigned x = *(const unsigned*) a;
+    unsigned y = *(const unsigned*) b;
+
+    return (x < y) ? -1 : (x > y);
+}
+
+static void add_row(journal_t *j, unsigned addr)
+{
+    if (j->nrows >= j->maxrows) {
+        j->maxrows = j->maxrows ? j->maxrows * 2 : 256;
+        j->row = realloc(j->row, j->maxrows * sizeof(unsigned));
+        if (! j->row) {
+            fprintf(stderr, "journal: out of memory\n");
+            exit(-1);
+        }
+    }
+    if (j->nrows > 0 && addr < j->row[j->nrows - 1])
+        j->sorted = 0;
+    j->row[j->nrows++] = addr;
+}
+
+/*
+ * Load rows from the existing file, when the header matches.
+ */
+static void load(journal_t *j)
+{
+    FILE *fd;
+    char line [64];
+    unsigned long long hash;
+    unsigned devid, addr;
+
+    fd = fopen(j->filename, "r");
+    if (! fd)
+        return;
+    if (! fgets(line, sizeof(line), fd) ||
+        sscanf(line, "image %llx", &hash) != 1 || hash != j->hash ||
+        ! fgets(line, sizeof(line), fd) ||
+        sscanf(line, "devid %x", &devid) != 1 || devid != j->devid) {
+        /* Written for another image or another chip. */
+        fclose(fd);
+        return;
+    }
+    while (fgets(line, sizeof(line), fd)) {
+        /* Ignore a partially written last line. */
+        if (! strchr(line, '\n'))
+            break;
+        if (sscanf(line, "row %x", &addr) == 1)
+            add_row(j, addr);
+    }
+    fclose(fd);
+}
+
+static void write_header(journal_t *j)
+{
+    fprintf(j->fd, "image %016llx\n", j->hash);
+    fprintf(j->fd, "devid %08x\n", j->devid);
+    fflush(j->fd);
+    j->unflushed = 0;
+}
+
+journal_t *journal_open(const char *filename,
+    unsigned long long image_hash, unsigned devid)
+{
+    journal_t *j;
+
+    j = calloc(1, sizeof(journal_t));
+    if (! j) {
+        fprintf(stderr, "journal: out of memory\n");
+        exit(-1);
+    }
+    j->filename = strdup(filename);
+    j->hash = image_hash;
+    j->devid = devid;
+    j->sorted = 1;
+    load(j);
+
+    /* Keep the old rows until the caller starts a new session. */
+    j->fd = fopen(filename, "a");
+    if (! j->fd) {
+        perror(filename);
+        free(j->row);
+        free(j->filename);
+        free(j);
+        return 0;
+    }
+    return j;
+}
+
+unsigned journal_count(journal_t *j)
+{
+    return j->nrows;
+}
+
+int journal_has(journal_t *j, unsigned addr)
+{
+    if (! j->sorted) {
+        qsort(j->row, j->nrows, sizeof(unsigned), compare);
+        j->sorted = 1;
+    }
+    return bsearch(&addr, j->row, j->nrows, sizeof(unsigned), compare) != 0;
+}
+
+void journal_begin(journal_t *j, int (*keep)(unsigned addr))
+{
+    unsigned *kept;
+    unsigned i, nkept = 0;
+
+    /* Decide on all rows before the set is changed.
+     * Sort it first: keep() may look up rows, which sorts
+     * the array under the loop. */
+    kept = malloc((j->nrows + 1) * sizeof(unsigned));
+    if (! kept) {
+        fprintf(stderr, "journal: out of memory\n");
+        exit(-1);
+    }
+    if (! j->sorted) {
+        qsort(j->row, j->nrows, sizeof(unsigned), compare);
+        j->sorted = 1;
+    }
+    for (i=0; i<j->nrows; i++) {
+        if (keep(j->row[i]))
+            kept[nkept++] = j->row[i];
+    }
+    j->nrows = 0;
+    j->sorted = 1;
+    j->fd = freopen(j->filename, "w", j->fd);
+    if (! j->fd) {
+        perror(j->filename);
+        exit(-1);
+    }
+    write_header(j);
+    for (i=0; i<nkept; i++)
+        journal_confirm(j, kept[i]);
+    fflush(j->fd);
+    j->unflushed = 0;
+    free(kept);
+}
+
+void journal_confirm(journal_t *j, unsigned addr)
+{
+    add_row(j, addr);
+    fprintf(j->fd, "row %08x\n", addr);
+    if (++j->unflushed >= FLUSH_ROWS) {
+        fflush(j->fd);
+        j->unflushed = 0;
+    }
+}
+
+void journal_close(journal_t *j, int complete)
+{
+    if (j->fd)
+        fclose(j->fd);
+    if (complete)
+        unlink(j->filename);
+    free(j->row);
+    free(j->filename);
+    free(j);
+}
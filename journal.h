@@ -0,0 +1,53 @@
+/*
+ * Journal of programming progress, for resuming
+ * an interrupted session.
+ *
+ * Copyright (C) 2015 Serge Vakulenko
+ *
+ * This file is part of PIC32PROG project, which is distributed
+ * under the terms of the GNU General Public License (GPL).
+ * See the accompanying file "COPYING" for more details.
+ */
+
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+typedef struct _journal_t journal_t;
+
+/*
+ * Open the journal file. When it was written for the same image
+ * and the same chip, the confirmed rows are loaded from it.
+ * Return 0 on error.
+ */
+journal_t *journal_open(const char *filename,
+    unsigned long long image_hash, unsigned devid);
+
+/*
+ * Number of confirmed rows, loaded or added.
+ */
+unsigned journal_count(journal_t *j);
+
+/*
+ * Check whether the row at given physical address is confirmed.
+ */
+int journal_has(journal_t *j, unsigned addr);
+
+/*
+ * Start a new session and rewrite the file.
+ * Only the rows, for which keep() returns nonzero, remain confirmed.
+ */
+void journal_begin(journal_t *j, int (*keep)(unsigned addr));
+
+/*
+ * Record the row at given physical address as programmed and verified.
+ * The file is flushed every few rows.
+ */
+void journal_confirm(journal_t *j, unsigned addr);
+
+/*
+ * Flush and close the journal. When the session has
+ * completed, the file is removed.
+ */
+void journal_close(journal_t *j, int complete);
+
+#endif
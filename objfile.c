@@ -0,0 +1,151 @@
+/*
+ * Reading of object files: Intel HEX and ELF.
+ *
+ * Used both for the image to program and for the programming
+ * executive: the data are passed byte by byte to a store function.
+ *
+ * Copyright (C) 2015 Serge Vakulenko
+ *
+ * This file is part of PIC32PROG project, which is distributed
+ * under the terms of the GNU General Public License (GPL).
+ * See the accompanying file "COPYING" for more details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "objfile.h"
+#include "localize.h"
+
+#define HEX(p)  (hexdigit((p)[0]) << 4 | hexdigit((p)[1]))
+
+static int hexdigit(unsigned char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    return toupper(c) - 'A' + 10;
+}
+
+static unsigned word(unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | p[3] << 24;
+}
+
+int objfile_read_hex(FILE *fd, const char *filename,
+    objfile_store_t *store, void *arg)
+{
+    char buf [256];
+    unsigned char data [256], sum;
+    unsigned address, high = 0, type, bytes, i;
+
+    while (fgets(buf, sizeof(buf), fd)) {
+        if (buf[0] == '\n' || buf[0] == '\r')
+            continue;
+        if (buf[0] != ':')
+            return 0;
+        for (i=1; i<9; i++) {
+            if (! isxdigit((unsigned char) buf[i])) {
+                fprintf(stderr, _("%s: bad HEX record: %s\n"), filename, buf);
+                return -1;
+            }
+        }
+        bytes = HEX(buf+1);
+        type = HEX(buf+7);
+        if (type == 1) {
+            /* End of file. */
+            break;
+        }
+        if (strlen(buf) < bytes * 2 + 11) {
+            fprintf(stderr, _("%s: too short hex line\n"), filename);
+            return -1;
+        }
+        sum = bytes + HEX(buf+3) + HEX(buf+5) + type;
+        for (i=0; i<bytes; i++) {
+            data [i] = HEX(buf+9 + i + i);
+            sum += data [i];
+        }
+        if (sum != (unsigned char) - HEX(buf+9 + bytes + bytes)) {
+            fprintf(stderr, _("%s: bad HEX checksum\n"), filename);
+            return -1;
+        }
+        switch (type) {
+        case 0:                         /* Data */
+            address = high << 16 | HEX(buf+3) << 8 | HEX(buf+5);
+            for (i=0; i<bytes; i++) {
+                if (! store(arg, address++, data [i]))
+                    return -1;
+            }
+            break;
+        case 4:                         /* Extended address */
+            if (bytes != 2) {
+                fprintf(stderr, _("%s: invalid HEX linear address record length\n"),
+                    filename);
+                return -1;
+            }
+            high = data[0] << 8 | data[1];
+            break;
+        case 5:                         /* Start address, ignore */
+            break;
+        default:
+            fprintf(stderr, _("%s: unknown HEX record type: %d\n"),
+                filename, type);
+            return -1;
+        }
+    }
+    return 1;
+}
+
+int objfile_read_elf(FILE *fd, const char *filename,
+    objfile_store_t *store, void *arg)
+{
+    unsigned char hdr [52], phdr [32], *data;
+    unsigned phoff, phnum, phentsize, i, k;
+    unsigned offset, addr, nbytes;
+
+    if (fread(hdr, 1, sizeof(hdr), fd) != sizeof(hdr) ||
+        memcmp(hdr, "\177ELF", 4) != 0)
+        return 0;
+    if (hdr[4] != 1 || hdr[5] != 1) {
+        fprintf(stderr, _("%s: not a 32-bit little-endian ELF file\n"),
+            filename);
+        return -1;
+    }
+    phoff = word(hdr+28);
+    phentsize = hdr[42] | hdr[43] << 8;
+    phnum = hdr[44] | hdr[45] << 8;
+    for (i=0; i<phnum; i++) {
+        if (fseek(fd, phoff + i*phentsize, SEEK_SET) < 0 ||
+            fread(phdr, 1, sizeof(phdr), fd) != sizeof(phdr)) {
+            fprintf(stderr, _("%s: bad ELF program header\n"), filename);
+            return -1;
+        }
+        offset = word(phdr+4);
+        addr = word(phdr+12);
+        nbytes = word(phdr+16);
+        if (word(phdr) != 1 || nbytes == 0)     /* PT_LOAD only */
+            continue;
+        if (addr == 0) {
+            /* No physical address: use virtual. */
+            addr = word(phdr+8);
+        }
+        data = malloc(nbytes);
+        if (! data) {
+            fprintf(stderr, _("%s: out of memory\n"), filename);
+            exit(1);
+        }
+        if (fseek(fd, offset, SEEK_SET) < 0 ||
+            fread(data, 1, nbytes, fd) != nbytes) {
+            fprintf(stderr, _("%s: bad ELF segment\n"), filename);
+            free(data);
+            return -1;
+        }
+        for (k=0; k<nbytes; k++) {
+            if (! store(arg, addr + k, data [k])) {
+                free(data);
+                return -1;
+            }
+        }
+        free(data);
+    }
+    return 1;
+}
@@ -0,0 +1,37 @@
+/*
+ * Reading of object files: Intel HEX and ELF.
+ *
+ * Copyright (C) 2015 Serge Vakulenko
+ *
+ * This file is part of PIC32PROG project, which is distributed
+ * under the terms of the GNU General Public License (GPL).
+ * See the accompanying file "COPYING" for more details.
+ */
+
+#ifndef _OBJFILE_H
+#define _OBJFILE_H
+
+#include <stdio.h>
+
+/*
+ * Store a byte of data at the given address.
+ * Return 0 to stop reading with error.
+ */
+typedef int objfile_store_t(void *arg, unsigned addr, unsigned char byte);
+
+/*
+ * Read Intel HEX file from the current position.
+ * Return 1 on success, 0 when not HEX, -1 with a message on error.
+ */
+int objfile_read_hex(FILE *fd, const char *filename,
+    objfile_store_t *store, void *arg);
+
+/*
+ * Read ELF executable: data of all PT_LOAD segments,
+ * at physical addresses when given.
+ * Return 1 on success, 0 when not ELF, -1 with a message on error.
+ */
+int objfile_read_elf(FILE *fd, const char *filename,
+    objfile_store_t *store, void *arg);
+
+#endif
@@ -0,0 +1,149 @@
+/*
+ * Programming executive, loaded from external file.
+ *
+ * Microchip publishes new versions of PE as HEX files, so they can
+ * be used without rebuilding pic32prog.  A PE is a single block
+ * of code, placed in RAM at a fixed address.
+ *
+ * Copyright (C) 2015 Serge Vakulenko
+ *
+ * This file is part of PIC32PROG project, which is distributed
+ * under the terms of the GNU General Public License (GPL).
+ * See the accompanying file "COPYING" for more details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pefile.h"
+#include "objfile.h"
+#include "localize.h"
+
+#ifdef _WIN32
+#   define PATH_SEPARATOR   ';'
+#else
+#   define PATH_SEPARATOR   ':'
+#endif
+
+/*
+ * Image of PE, collected from the file.
+ */
+typedef struct {
+    const char *filename;
+    unsigned char *data;
+    unsigned max_bytes;
+    unsigned base;              /* Physical address of first byte */
+    unsigned nbytes;            /* Size up to the last byte stored */
+    int empty;
+} image_t;
+
+static int store(void *arg, unsigned addr, unsigned char byte)
+{
+    image_t *im = arg;
+
+    /* Virtual addresses of RAM: KSEG0 or KSEG1. */
+    addr &= 0x1fffffff;
+    if (im->empty) {
+        im->base = addr;
+        im->empty = 0;
+    }
+    if (addr < im->base || addr - im->base >= im->max_bytes) {
+        fprintf(stderr, _("%s: PE is not one block of %u bytes or less\n"),
+            im->filename, im->max_bytes);
+        return 0;
+    }
+    im->data [addr - im->base] = byte;
+    if (addr - im->base >= im->nbytes)
+        im->nbytes = addr - im->base + 1;
+    return 1;
+}
+
+static unsigned word(unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | p[3] << 24;
+}
+
+unsigned *pefile_read(const char *filename, unsigned max_bytes,
+    unsigned *addr, unsigned *nwords)
+{
+    image_t im;
+    FILE *fd;
+    unsigned *code, n, i;
+    int status;
+
+    fd = fopen(filename, "rb");
+    if (! fd) {
+        perror(filename);
+        return 0;
+    }
+    im.filename = filename;
+    im.max_bytes = max_bytes;
+    im.base = 0;
+    im.nbytes = 0;
+    im.empty = 1;
+    im.data = calloc(max_bytes, 1);
+    if (! im.data) {
+        fprintf(stderr, _("%s: out of memory\n"), filename);
+        exit(-1);
+    }
+    status = objfile_read_elf(fd, filename, store, &im);
+    if (status == 0) {
+        rewind(fd);
+        status = objfile_read_hex(fd, filename, store, &im);
+        if (status == 0)
+            fprintf(stderr, _("%s: PE must be HEX or ELF file\n"), filename);
+    }
+    fclose(fd);
+    if (status > 0 && (im.empty || (im.base & 3))) {
+        fprintf(stderr, _("%s: no PE code at word address\n"), filename);
+        status = -1;
+    }
+    if (status <= 0) {
+        free(im.data);
+        return 0;
+    }
+
+    /* Adapters send PE by groups of up to 10 words:
+     * pad the code with zeros. */
+    n = (im.nbytes + 3) / 4;
+    code = calloc((n + 9) / 10 * 10, sizeof(unsigned));
+    if (! code) {
+        fprintf(stderr, _("%s: out of memory\n"), filename);
+        exit(-1);
+    }
+    for (i=0; i<n; i++)
+        code[i] = word(im.data + i*4);
+    free(im.data);
+    *addr = im.base;
+    *nwords = n;
+    return code;
+}
+
+char *pefile_find(const char *path, const char *family_name)
+{
+    static const char *suffix[] = { "hex", "elf", 0 };
+    const char *dir, *end;
+    char *name;
+    int i, len;
+
+    for (dir=path; dir && *dir; dir=end) {
+        end = strchr(dir, PATH_SEPARATOR);
+        len = end ? end - dir : strlen(dir);
+        if (end)
+            end++;
+        if (len == 0)
+            continue;
+        for (i=0; suffix[i]; i++) {
+            name = malloc(len + strlen(family_name) + 10);
+            if (! name) {
+                fprintf(stderr, _("pefile: out of memory\n"));
+                exit(-1);
+            }
+            sprintf(name, "%.*s/pe-%s.%s", len, dir, family_name, suffix[i]);
+            if (access(name, R_OK) == 0)
+                return name;
+            free(name);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+/*
+ * Programming executive, loaded from external file.
+ *
+ * Copyright (C) 2015 Serge Vakulenko
+ *
+ * This file is part of PIC32PROG project, which is distributed
+ * under the terms of the GNU General Public License (GPL).
+ * See the accompanying file "COPYING" for more details.
+ */
+
+#ifndef _PEFILE_H
+#define _PEFILE_H
+
+/*
+ * Find a PE file for the family in a list of directories,
+ * separated by ':' (';' on Windows). The file is named pe-<family>
+ * with .hex or .elf suffix. Return an allocated name, or 0.
+ */
+char *pefile_find(const char *path, const char *family_name);
+
+/*
+ * Read PE code from HEX or ELF file. The code must be one block
+ * of at most max_bytes. Return an allocated array of words,
+ * or 0 with a message on error. The load address is returned
+ * as a physical address.
+ */
+unsigned *pefile_read(const char *filename, unsigned max_bytes,
+    unsigned *addr, unsigned *nwords);
+
+#endif
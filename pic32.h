@@ -31,6 +31,7 @@ extern const unsigned pic32_pemk[];
 #define FAMILY_MZ	2
 #define FAMILY_MK	3
 #define FAMILY_MM	4
+#define FAMILY_BL	5	/* Bootloader, chip unknown */
 
 /*
  * TAP instructions (5-bit).
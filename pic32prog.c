@@ -24,6 +24,10 @@
 #include "serial.h"
 #include "localize.h"
 #include "adapter.h"
+#include "dump.h"
+#include "journal.h"
+#include "plan.h"
+#include "objfile.h"
 
 #include "pic32.h"
 
@@ -49,6 +53,8 @@ unsigned char boot_data [BOOT_BYTES];
 unsigned char flash_data [FLASH_BYTES];
 unsigned char boot_dirty [BOOT_BYTES / MINBLOCKSZ];
 unsigned char flash_dirty [FLASH_BYTES / MINBLOCKSZ];
+unsigned char boot_owner [BOOT_BYTES];      /* Input file for every byte */
+unsigned char flash_owner [FLASH_BYTES];
 unsigned blocksz;               /* Size of flash memory block */
 unsigned boot_used;
 unsigned char bootv_kseg = 1;    // Default to 1, same as before. Set in store_data.
@@ -106,6 +112,77 @@ unsigned progress_count;
 int verify_only;
 int erase_only = 0;
 int skip_verify = 0;
+int read_format = -1;            /* Format of memory dump, by default from file name */
+int sparse_read = 0;             /* Skip erased memory when reading */
+int overlap_later = 0;          /* Overlapping input data: later file wins */
+#define MAXINPUTS 255           /* Max number of input files */
+char *input_name [MAXINPUTS+1]; /* Input files, indexed from 1 */
+int input_index;                /* Current input file */
+unsigned overlap_count;         /* Overlapping bytes in current file */
+unsigned overlap_addr;          /* First overlapping address */
+int overlap_with;               /* Owner of the first overlapping byte */
+int outside_seen;               /* Data outside of flash in current file */
+unsigned outside_next;          /* Address following the last such byte */
+
+/*
+ * Address windows, selected by --range and --exclude options.
+ * Physical addresses, end is not included.
+ */
+typedef struct {
+    unsigned start;
+    unsigned end;
+} window_t;
+
+#define MAXWINDOWS 16
+window_t range [MAXWINDOWS];
+window_t exclude [MAXWINDOWS];
+int nranges, nexcludes;
+
+/*
+ * Changes of configuration words, by --config-word option.
+ */
+typedef struct {
+    unsigned addr;              /* Physical address */
+    unsigned value;
+    unsigned mask;              /* Bits to change */
+} cfgpatch_t;
+
+cfgpatch_t cfgpatch [MAXWINDOWS];
+int ncfgpatches;
+int config_only = 0;            /* Update configuration page only */
+
+/*
+ * Per-board patch slots, by --slot option: name@address:length[:format].
+ * Values come from --set, --counter and --csv options.
+ */
+#define SLOT_LE         0       /* Integer, little endian */
+#define SLOT_BE         1       /* Integer, big endian */
+#define SLOT_HEX        2       /* Bytes in hex, like 00:04:a3:12:34:56 */
+#define SLOT_TEXT       3       /* String, padded with zeros */
+
+typedef struct {
+    char *name;
+    unsigned addr;
+    unsigned nbytes;
+    int format;
+    char *value;                /* Value to store, or 0 */
+    char *counter;              /* Counter file, or 0 */
+} slot_t;
+
+slot_t slot [MAXWINDOWS];
+int nslots;
+char *slot_set [MAXWINDOWS];    /* Values by --set option: name=value */
+int nslot_sets;
+char *slot_counter [MAXWINDOWS]; /* Counters by --counter option: name=file */
+int nslot_counters;
+char *slot_csv;                 /* Table of values by --csv option: file@row */
+char *journal_name;             /* Journal of programming progress */
+journal_t *journal;
+int journal_resume;             /* Rows confirmed by journal are kept */
+unsigned devcfg_addr;           /* Physical address of devcfg, when written separately */
+int dry_run = 0;                /* Print the plan only */
+const char *dry_run_part;       /* Part or family to plan for, with no chip */
+int executive_loaded;           /* PE is already in chip RAM */
 int debug_level;
 int power_on;
 target_t *target;
@@ -138,50 +215,71 @@ unsigned mseconds_elapsed(void *arg)
 
 void store_data(unsigned address, unsigned byte)
 {
+    unsigned char *data, *owner;
     unsigned offset;
 
     if (address >= BOOTV_KSEG0_BASE && address < BOOTV_KSEG0_BASE + BOOT_BYTES) {
         /* Boot code, virtual. KSEG0! */
         offset = address - BOOTV_KSEG0_BASE;
-        boot_data [offset] = byte;
+        data = boot_data;
+        owner = boot_owner;
         boot_used = 1;
         bootv_kseg = 0;
     } else if (address >= BOOTV_KSEG1_BASE && address < BOOTV_KSEG1_BASE + BOOT_BYTES) {
         /* Boot code, virtual. KSEG1! */
         offset = address - BOOTV_KSEG1_BASE;
-        boot_data [offset] = byte;
+        data = boot_data;
+        owner = boot_owner;
         boot_used = 1;
         bootv_kseg = 1;
     } else if (address >= BOOTP_BASE && address < BOOTP_BASE + BOOT_BYTES) {
         /* Boot code, physical. */
         offset = address - BOOTP_BASE;
-        boot_data [offset] = byte;
+        data = boot_data;
+        owner = boot_owner;
         boot_used = 1;
     } else if (address >= FLASHV_KSEG1_BASE && address < FLASHV_KSEG1_BASE + FLASH_BYTES) {
         /* Main flash memory, virtual. */
         offset = address - FLASHV_KSEG1_BASE;
-        flash_data [offset] = byte;
+        data = flash_data;
+        owner = flash_owner;
         flash_used = 1;
         flashv_kseg = 1;
     }
     else if (address >= FLASHV_KSEG0_BASE && address < FLASHV_KSEG0_BASE + FLASH_BYTES) {
         /* Main flash memory, virtual. */
         offset = address - FLASHV_KSEG0_BASE;
-        flash_data [offset] = byte;
+        data = flash_data;
+        owner = flash_owner;
         flash_used = 1;
         flashv_kseg = 0;
     } else if (address >= FLASHP_BASE && address < FLASHP_BASE + FLASH_BYTES) {
         /* Main flash memory, physical. */
         offset = address - FLASHP_BASE;
-        flash_data [offset] = byte;
+        data = flash_data;
+        owner = flash_owner;
         flash_used = 1;
     } else {
-        /* Ignore incorrect data. */
-        //fprintf(stderr, _("%08X: address out of flash memory\n"), address);
-		fprintf(stdout, "Else statement\n");
+        /* Ignore incorrect data: warn once per contiguous block. */
+        if (! outside_seen || address != outside_next)
+            fprintf(stderr, _("%s: address %08x outside of flash, ignored\n"),
+                input_name [input_index], address);
+        outside_seen = 1;
+        outside_next = address + 1;
         return;
     }
-    total_bytes++;
+    data [offset] = byte;
+    if (owner [offset] == 0) {
+        owner [offset] = input_index;
+        total_bytes++;
+    } else if (owner [offset] != input_index) {
+        /* Overlaps data from another input file. */
+        if (overlap_count++ == 0) {
+            overlap_addr = address;
+            overlap_with = owner [offset];
+        }
+        owner [offset] = input_index;
+    }
 }
 
 /*
@@ -252,88 +350,564 @@ int read_srec(char *filename)
     return 1;
 }
 
+static int store_object(void *arg, unsigned addr, unsigned char byte)
+{
+    store_data(addr, byte);
+    return 1;
+}
+
 /*
- * Read HEX file.
+ * Read HEX or ELF file.
+ * Return 0 when the format is unknown.
  */
-int read_hex(char *filename)
+int read_object(char *filename)
 {
     FILE *fd;
-    unsigned char buf [256], data[16], record_type, sum;
-    unsigned address, high;
-    int bytes, i;
+    int status;
 
-    fd = fopen(filename, "r");
+    fd = fopen(filename, "rb");
     if (! fd) {
         perror(filename);
         exit(1);
     }
-    high = 0;
-    while (fgets((char*) buf, sizeof(buf), fd)) {
-        if (buf[0] == '\n')
-            continue;
-        if (buf[0] != ':') {
-            fclose(fd);
-            return 0;
+    status = objfile_read_hex(fd, filename, store_object, 0);
+    if (status == 0) {
+        rewind(fd);
+        status = objfile_read_elf(fd, filename, store_object, 0);
+    }
+    fclose(fd);
+    if (status < 0)
+        exit(1);
+    return status;
+}
+
+/*
+ * Read binary file, placed at the given address.
+ */
+void read_raw(char *filename, unsigned addr)
+{
+    FILE *fd;
+    int c;
+
+    fd = fopen(filename, "rb");
+    if (! fd) {
+        perror(filename);
+        exit(1);
+    }
+    while ((c = getc(fd)) != EOF)
+        store_data(addr++, c);
+    fclose(fd);
+}
+
+/*
+ * Load an input file into the memory image.
+ * Binary file needs an address: file.bin@0x9d000000.
+ */
+void load_input(char *arg)
+{
+    char *at = strrchr(arg, '@');
+
+    if (input_index >= MAXINPUTS) {
+        fprintf(stderr, _("Too many input files\n"));
+        exit(1);
+    }
+    input_name [++input_index] = arg;
+    overlap_count = 0;
+    outside_seen = 0;
+    if (at) {
+        *at = 0;
+        read_raw(arg, strtoul(at+1, 0, 0));
+    } else if (! read_srec(arg) &&
+               ! read_object(arg)) {
+        fprintf(stderr, _("%s: bad file format\n"), arg);
+        exit(1);
+    }
+    if (overlap_count > 0) {
+        fprintf(stderr, _("%s: %u bytes overlap with %s, first at %08X\n"),
+            arg, overlap_count, input_name [overlap_with], overlap_addr);
+        if (! overlap_later)
+            exit(1);
+    }
+}
+
+/*
+ * Parse an address window: start:end.
+ */
+void parse_window(char *arg, window_t *tab, int *count)
+{
+    window_t *w;
+    char *end;
+
+    if (*count >= MAXWINDOWS) {
+        fprintf(stderr, _("Too many address ranges\n"));
+        exit(1);
+    }
+    w = &tab [*count];
+    w->start = strtoul(arg, &end, 0) & 0x1fffffff;
+    if (*end != ':') {
+        fprintf(stderr, _("Bad address range \"%s\", need start:end\n"), arg);
+        exit(1);
+    }
+    w->end = strtoul(end+1, 0, 0) & 0x1fffffff;
+    if (w->end <= w->start) {
+        fprintf(stderr, _("Bad address range \"%s\": empty\n"), arg);
+        exit(1);
+    }
+    ++*count;
+}
+
+/*
+ * Parse a configuration word patch: address:value[/mask].
+ */
+void parse_cfgpatch(char *arg)
+{
+    cfgpatch_t *p;
+    char *end;
+
+    if (ncfgpatches >= MAXWINDOWS) {
+        fprintf(stderr, _("Too many configuration words\n"));
+        exit(1);
+    }
+    p = &cfgpatch [ncfgpatches];
+    p->addr = strtoul(arg, &end, 0) & 0x1fffffff;
+    if (*end != ':' || (p->addr & 3)) {
+        fprintf(stderr, _("Bad configuration word \"%s\", need address:value[/mask]\n"), arg);
+        exit(1);
+    }
+    p->value = strtoul(end+1, &end, 0);
+    p->mask = 0xffffffff;
+    if (*end == '/')
+        p->mask = strtoul(end+1, 0, 0);
+    ++ncfgpatches;
+}
+
+/*
+ * Parse a patch slot: name@address:length[:format].
+ */
+void parse_slot(char *arg)
+{
+    static const char *format_name[] = { "le", "be", "hex", "text", 0 };
+    slot_t *s;
+    char *at, *end;
+
+    if (nslots >= MAXWINDOWS) {
+        fprintf(stderr, _("Too many patch slots\n"));
+        exit(1);
+    }
+    s = &slot [nslots];
+    at = strchr(arg, '@');
+    if (! at || at == arg)
+        goto bad;
+    *at = 0;
+    s->name = arg;
+    s->addr = strtoul(at+1, &end, 0);
+    if (*end != ':')
+        goto bad;
+    s->nbytes = strtoul(end+1, &end, 0);
+    if (s->nbytes == 0)
+        goto bad;
+    s->format = SLOT_LE;
+    if (*end == ':') {
+        for (s->format=0; format_name[s->format]; s->format++)
+            if (strcmp(end+1, format_name[s->format]) == 0)
+                break;
+        if (! format_name[s->format])
+            goto bad;
+    } else if (*end != 0)
+        goto bad;
+    ++nslots;
+    return;
+bad:
+    fprintf(stderr, _("Bad patch slot \"%s\", need name@address:length[:le|be|hex|text]\n"), arg);
+    exit(1);
+}
+
+/*
+ * Find the patch slot by name, given as name=...
+ * Return the pointer to the text after '='.
+ */
+static char *find_slot(char *arg, slot_t **sp)
+{
+    char *eq = strchr(arg, '=');
+    int i;
+
+    if (eq) {
+        for (i=0; i<nslots; i++) {
+            if (strlen(slot[i].name) == eq - arg &&
+                strncmp(slot[i].name, arg, eq - arg) == 0) {
+                *sp = &slot[i];
+                return eq + 1;
+            }
         }
-        if (! isxdigit(buf[1]) || ! isxdigit(buf[2]) ||
-            ! isxdigit(buf[3]) || ! isxdigit(buf[4]) ||
-            ! isxdigit(buf[5]) || ! isxdigit(buf[6]) ||
-            ! isxdigit(buf[7]) || ! isxdigit(buf[8])) {
-            fprintf(stderr, _("%s: bad HEX record: %s\n"), filename, buf);
+    }
+    fprintf(stderr, _("Unknown patch slot in \"%s\"\n"), arg);
+    exit(1);
+}
+
+/*
+ * Remove spaces and quotes around the CSV field.
+ */
+static char *csv_field(char *p)
+{
+    char *end;
+
+    while (*p == ' ' || *p == '\t')
+        p++;
+    end = p + strlen(p);
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t' ||
+        end[-1] == '\n' || end[-1] == '\r'))
+        *--end = 0;
+    if (*p == '"' && end > p+1 && end[-1] == '"') {
+        end[-1] = 0;
+        p++;
+    }
+    return p;
+}
+
+/*
+ * Take values of slots from the CSV table: file@row.
+ * The first line names the slots, rows are counted from 1.
+ */
+static void read_csv(char *arg)
+{
+    static char header [1024], line [1024];
+    char *at, *name[MAXWINDOWS], *field, *next, *end;
+    int row, ncolumns, i, k;
+    FILE *fd;
+
+    at = strrchr(arg, '@');
+    if (at)
+        row = strtol(at+1, &end, 0);
+    if (! at || at[1] == 0 || *end != 0 || row < 1) {
+        fprintf(stderr, _("Bad CSV table \"%s\", need file@row, rows from 1\n"), arg);
+        exit(1);
+    }
+    *at = 0;
+    fd = fopen(arg, "r");
+    if (! fd) {
+        perror(arg);
+        exit(1);
+    }
+    if (! fgets(header, sizeof(header), fd)) {
+        fprintf(stderr, _("%s: empty table\n"), arg);
+        exit(1);
+    }
+    ncolumns = 0;
+    for (field=header; field && ncolumns<MAXWINDOWS; field=next) {
+        next = strchr(field, ',');
+        if (next)
+            *next++ = 0;
+        name[ncolumns++] = csv_field(field);
+    }
+    for (i=0; i<row; i++) {
+        if (! fgets(line, sizeof(line), fd)) {
+            fprintf(stderr, _("%s: no row %d\n"), arg, row);
             exit(1);
         }
-        record_type = HEX(buf+7);
-        if (record_type == 1) {
-            /* End of file. */
-            break;
+    }
+    fclose(fd);
+
+    field = line;
+    for (i=0; i<ncolumns; i++, field=next) {
+        next = 0;
+        if (field) {
+            next = strchr(field, ',');
+            if (next)
+                *next++ = 0;
         }
-        if (record_type == 5) {
-            /* Start address, ignore. */
-            continue;
+        for (k=0; k<nslots; k++) {
+            if (strcmp(slot[k].name, name[i]) != 0)
+                continue;
+            if (! field) {
+                fprintf(stderr, _("%s: no column %s in row %d\n"),
+                    arg, name[i], row);
+                exit(1);
+            }
+            slot[k].value = strdup(csv_field(field));
         }
+    }
+}
+
+/*
+ * Read the value of a counter file.
+ */
+static char *read_counter(char *filename)
+{
+    static char line [64];
+    FILE *fd;
 
-        bytes = HEX(buf+1);
-        if (strlen((char*) buf) < bytes * 2 + 11) {
-            fprintf(stderr, _("%s: too short hex line\n"), filename);
+    fd = fopen(filename, "r");
+    if (! fd) {
+        perror(filename);
+        exit(1);
+    }
+    if (! fgets(line, sizeof(line), fd)) {
+        fprintf(stderr, _("%s: empty counter\n"), filename);
+        exit(1);
+    }
+    fclose(fd);
+    return strdup(csv_field(line));
+}
+
+/*
+ * Fill patch slots with values and store them to the image.
+ * Only the bytes of slots are changed.
+ */
+void apply_slots()
+{
+    unsigned char bytes [256];
+    unsigned long long value;
+    slot_t *s;
+    char *p, *end;
+    int i, k;
+
+    if (slot_csv)
+        read_csv(slot_csv);
+    for (i=0; i<nslot_counters; i++) {
+        p = find_slot(slot_counter[i], &s);
+        s->counter = p;
+        s->value = read_counter(p);
+    }
+    for (i=0; i<nslot_sets; i++) {
+        p = find_slot(slot_set[i], &s);
+        s->value = p;
+    }
+
+    for (s=slot; s<slot+nslots; s++) {
+        if (! s->value) {
+            fprintf(stderr, _("No value for patch slot %s\n"), s->name);
             exit(1);
         }
-        address = high << 16 | HEX(buf+3) << 8 | HEX(buf+5);
-
-        sum = 0;
-        for (i=0; i<bytes; ++i) {
-            data [i] = HEX(buf+9 + i + i);
-            sum += data [i];
+        if (s->nbytes > sizeof(bytes)) {
+            fprintf(stderr, _("Patch slot %s: too long\n"), s->name);
+            exit(1);
         }
-        sum += record_type + bytes + (address & 0xff) + (address >> 8 & 0xff);
-        if (sum != (unsigned char) - HEX(buf+9 + bytes + bytes)) {
-            fprintf(stderr, _("%s: bad HEX checksum\n"), filename);
+        memset(bytes, 0, s->nbytes);
+        switch (s->format) {
+        case SLOT_LE:
+        case SLOT_BE:
+            value = strtoull(s->value, &end, 0);
+            if (end == s->value || *end != 0 || (s->nbytes < 8 && (value >> (s->nbytes * 8)) != 0))
+                goto bad;
+            for (k=0; k<s->nbytes && k<8; k++) {
+                if (s->format == SLOT_LE)
+                    bytes [k] = value >> (k * 8);
+                else
+                    bytes [s->nbytes - 1 - k] = value >> (k * 8);
+            }
+            break;
+        case SLOT_HEX:
+            p = s->value;
+            for (k=0; k<s->nbytes; k++) {
+                if (*p == ':' || *p == '-' || *p == ' ')
+                    p++;
+                if (! isxdigit(p[0]) || ! isxdigit(p[1]))
+                    goto bad;
+                bytes [k] = HEX(p);
+                p += 2;
+            }
+            if (*p != 0)
+                goto bad;
+            break;
+        case SLOT_TEXT:
+            if (strlen(s->value) > s->nbytes)
+                goto bad;
+            memcpy(bytes, s->value, strlen(s->value));
+            break;
+        }
+
+        /* Slots always win over the data from input files. */
+        if (input_index >= MAXINPUTS) {
+            fprintf(stderr, _("Too many input files\n"));
             exit(1);
         }
+        input_name [++input_index] = s->name;
+        outside_seen = 0;
+        for (k=0; k<s->nbytes; k++)
+            store_data(s->addr + k, bytes [k]);
+        printf(_("         Slot: %s = %s\n"), s->name, s->value);
+        continue;
+bad:
+        fprintf(stderr, _("Bad value \"%s\" for patch slot %s\n"), s->value, s->name);
+        exit(1);
+    }
+}
 
-        if (record_type == 4) {
-            /* Extended address. */
-            if (bytes != 2) {
-                fprintf(stderr, _("%s: invalid HEX linear address record length\n"),
-                    filename);
-                exit(1);
-            }
-            high = data[0] << 8 | data[1];
+/*
+ * Advance counters after the board has been programmed.
+ */
+void update_counters()
+{
+    unsigned long long value;
+    slot_t *s;
+    FILE *fd;
+
+    for (s=slot; s<slot+nslots; s++) {
+        if (! s->counter)
             continue;
+        value = strtoull(s->value, 0, 0) + 1;
+        fd = fopen(s->counter, "w");
+        if (! fd) {
+            perror(s->counter);
+            exit(1);
         }
-        if (record_type != 0) {
-            fprintf(stderr, _("%s: unknown HEX record type: %d\n"),
-                filename, record_type);
+        if (strncmp(s->value, "0x", 2) == 0 || strncmp(s->value, "0X", 2) == 0)
+            fprintf(fd, "0x%llx\n", value);
+        else
+            fprintf(fd, "%llu\n", value);
+        fclose(fd);
+    }
+}
+
+/*
+ * Check whether the block of memory is selected
+ * by --range and --exclude options.
+ */
+static int is_selected(unsigned addr, unsigned nbytes)
+{
+    int i;
+
+    addr &= 0x1fffffff;
+    if (nranges > 0) {
+        for (i=0; i<nranges; i++) {
+            if (addr < range[i].end && addr + nbytes > range[i].start)
+                break;
+        }
+        if (i == nranges)
+            return 0;
+    }
+    for (i=0; i<nexcludes; i++) {
+        if (addr < exclude[i].end && addr + nbytes > exclude[i].start)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Address windows must not split flash pages,
+ * as pages are erased as a whole.
+ */
+static void check_windows(unsigned align)
+{
+    int i;
+
+    for (i=0; i<nranges; i++) {
+        if (range[i].start % align || range[i].end % align) {
+            fprintf(stderr, _("Range %08X:%08X is not aligned to %u bytes\n"),
+                range[i].start, range[i].end, align);
             exit(1);
         }
-        //printf("%08x: %u bytes\n", address, bytes);
-        for (i=0; i<bytes; i++) {
-            store_data(address++, data [i]);
+    }
+    for (i=0; i<nexcludes; i++) {
+        if (exclude[i].start % align || exclude[i].end % align) {
+            fprintf(stderr, _("Excluded range %08X:%08X is not aligned to %u bytes\n"),
+                exclude[i].start, exclude[i].end, align);
+            exit(1);
         }
     }
-    fclose(fd);
+}
+
+/*
+ * Check whether the page holds configuration words,
+ * which are written separately from the boot rows.
+ */
+static int is_devcfg_page(unsigned page, unsigned page_bytes)
+{
+    if (devcfg_addr >= page && devcfg_addr < page + page_bytes)
+        return 1;
+    if (FAMILY_MK == target->family->name_short) {
+        /* Boot flash 2 has a copy. */
+        if (devcfg_addr + 0x20000 >= page &&
+            devcfg_addr + 0x20000 < page + page_bytes)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Check that all rows of the page, which have data to program,
+ * are confirmed by the journal.
+ */
+static int is_page_confirmed(unsigned page, unsigned page_bytes)
+{
+    unsigned addr, offset;
+
+    for (addr=page; addr<page+page_bytes; addr+=blocksz) {
+        if (addr >= BOOTP_BASE) {
+            offset = addr - BOOTP_BASE;
+            if (! boot_used || offset >= boot_bytes ||
+                ! boot_dirty [offset / blocksz])
+                continue;
+        } else {
+            offset = addr - FLASHP_BASE;
+            if (! flash_used || offset >= flash_bytes ||
+                ! flash_dirty [offset / blocksz])
+                continue;
+        }
+        if (! journal_has(journal, addr))
+            return 0;
+    }
+    if (devcfg_addr && is_devcfg_page(page, page_bytes) &&
+        ! journal_has(journal, devcfg_addr))
+        return 0;
     return 1;
 }
 
+/*
+ * Check whether the page is to be erased before programming.
+ * When resuming, pages with all rows confirmed are kept.
+ */
+static int is_page_erased(unsigned page, unsigned page_bytes)
+{
+    if (! is_selected(page, page_bytes))
+        return 0;
+    if (journal_resume && is_page_confirmed(page, page_bytes))
+        return 0;
+    return 1;
+}
+
+/*
+ * A confirmed row remains valid, when its page is not erased.
+ */
+static int journal_keep(unsigned addr)
+{
+    unsigned page_bytes = target_page_size(target);
+
+    if (! journal_resume)
+        return 0;
+    if (addr == devcfg_addr && FAMILY_MK == target->family->name_short &&
+        ! is_page_confirmed((addr + 0x20000) & ~(page_bytes - 1), page_bytes))
+        return 0;
+    return is_page_confirmed(addr & ~(page_bytes - 1), page_bytes);
+}
+
+/*
+ * Add erase of the selected pages of flash and boot memory.
+ */
+static void plan_erase_pages(plan_t *p, unsigned flash_bytes, unsigned boot_bytes)
+{
+    unsigned page_bytes = target_page_size(target);
+    unsigned addr, page;
+
+    for (addr=FLASHP_BASE; addr<FLASHP_BASE+flash_bytes; addr+=page_bytes) {
+        if (is_page_erased(addr, page_bytes))
+            plan_add(p, PLAN_PAGE_ERASE, addr, page_bytes);
+    }
+    for (addr=BOOTP_BASE; addr<BOOTP_BASE+boot_bytes; addr+=page_bytes) {
+        if (is_page_erased(addr, page_bytes))
+            plan_add(p, PLAN_PAGE_ERASE, addr, page_bytes);
+    }
+    if (devcfg_addr && FAMILY_MK == target->family->name_short) {
+        /* On MK, configuration words are in boot flash 1 and 2,
+         * outside of boot memory. */
+        for (addr=devcfg_addr; addr<=devcfg_addr+0x20000; addr+=0x20000) {
+            page = addr & ~(page_bytes - 1);
+            if (! (journal_resume && is_page_confirmed(page, page_bytes)))
+                plan_add(p, PLAN_PAGE_ERASE, page, page_bytes);
+        }
+    }
+}
+
 void print_symbols(char symbol, int cnt)
 {
     while (cnt-- > 0)
@@ -351,6 +925,11 @@ void progress(unsigned step)
 
 void quit(void)
 {
+    if (journal != 0) {
+        /* Keep the journal for the next run. */
+        journal_close(journal, 0);
+        journal = 0;
+    }
     if (target != 0) {
         target_close(target, power_on);
         free(target);
@@ -413,77 +992,477 @@ void do_probe()
         exit(1);
     }
 
-    boot_bytes = target_boot_bytes(target);
-    printf(_("    Processor: %s (id %08X)\n"), target_cpu_name(target),
-        target_idcode(target));
-    printf(_(" Flash memory: %d kbytes\n"), target_flash_bytes(target) / 1024);
-    if (boot_bytes > 0)
-        printf(_("  Boot memory: %d kbytes\n"), boot_bytes / 1024);
-    target_print_devcfg(target);
+    boot_bytes = target_boot_bytes(target);
+    printf(_("    Processor: %s (id %08X)\n"), target_cpu_name(target),
+        target_idcode(target));
+    printf(_(" Flash memory: %d kbytes\n"), target_flash_bytes(target) / 1024);
+    if (boot_bytes > 0)
+        printf(_("  Boot memory: %d kbytes\n"), boot_bytes / 1024);
+    target_print_devcfg(target);
+}
+
+/*
+ * Write flash memory.
+ */
+void program_block(target_t *mc, unsigned addr)
+{
+    unsigned char *data;
+    unsigned offset;
+
+    if (addr >= BOOTV_KSEG0_BASE && addr < BOOTV_KSEG0_BASE + boot_bytes) {
+        data = boot_data;
+        offset = addr - BOOTV_KSEG0_BASE;
+    } else if (addr >= BOOTV_KSEG1_BASE && addr < BOOTV_KSEG1_BASE + boot_bytes) {
+        data = boot_data;
+        offset = addr - BOOTV_KSEG1_BASE;
+    } else if (addr >= BOOTP_BASE && addr < BOOTP_BASE + boot_bytes) {
+        data = boot_data;
+        offset = addr - BOOTP_BASE;
+    } else if (addr >= FLASHV_KSEG0_BASE && addr < FLASHV_KSEG0_BASE + flash_bytes) {
+        data = flash_data;
+        offset = addr - FLASHV_KSEG0_BASE;
+    } else if (addr >= FLASHV_KSEG1_BASE && addr < FLASHV_KSEG1_BASE + flash_bytes) {
+        data = flash_data;
+        offset = addr - FLASHV_KSEG1_BASE;
+    } else {
+        data = flash_data;
+        offset = addr - FLASHP_BASE;
+    }
+    target_program_block(mc, addr, blocksz/4, (unsigned*) (data + offset));
+}
+
+int verify_block(target_t *mc, unsigned addr)
+{
+    unsigned char *data;
+    unsigned offset;
+
+    if (addr >= BOOTV_KSEG0_BASE && addr < BOOTV_KSEG0_BASE + boot_bytes) {
+        data = boot_data;
+        offset = addr - BOOTV_KSEG0_BASE;
+    } if (addr >= BOOTV_KSEG1_BASE && addr < BOOTV_KSEG1_BASE + boot_bytes) {
+        data = boot_data;
+        offset = addr - BOOTV_KSEG1_BASE;
+    } else if (addr >= BOOTP_BASE && addr < BOOTP_BASE + boot_bytes) {
+        data = boot_data;
+        offset = addr - BOOTP_BASE;
+    } else if (addr >= FLASHV_KSEG0_BASE && addr < FLASHV_KSEG0_BASE + flash_bytes) {
+        data = flash_data;
+        offset = addr - FLASHV_KSEG0_BASE;
+    } else if (addr >= FLASHV_KSEG1_BASE && addr < FLASHV_KSEG1_BASE + flash_bytes) {
+        data = flash_data;
+        offset = addr - FLASHV_KSEG1_BASE;
+    } else {
+        data = flash_data;
+        offset = addr - FLASHP_BASE;
+    }
+    target_verify_block(mc, addr, blocksz/4, (unsigned*) (data + offset));
+    return 1;
+}
+
+/*
+ * Hash of the image to program, to match the journal.
+ */
+static unsigned long long image_hash()
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    unsigned i;
+
+    /* FNV-1a */
+    for (i=0; i<flash_bytes; i++) {
+        hash ^= flash_data [i];
+        hash *= 1099511628211ULL;
+    }
+    for (i=0; i<boot_bytes; i++) {
+        hash ^= boot_data [i];
+        hash *= 1099511628211ULL;
+    }
+    hash ^= blocksz;
+    hash *= 1099511628211ULL;
+    return hash;
+}
+
+#define SPOT_CHECKS 4           /* Rows to read back when resuming */
+
+/*
+ * Read back a few of the confirmed rows, to make sure
+ * the chip still holds what the journal says.
+ */
+static int spot_check()
+{
+    unsigned addr, offset, nrows, step, index, checked;
+    unsigned char *data, *block;
+    int ok = 1;
+
+    nrows = journal_count(journal);
+    step = (nrows > SPOT_CHECKS) ? nrows / SPOT_CHECKS : 1;
+    block = malloc(blocksz);
+    if (! block) {
+        fprintf(stderr, _("Out of memory\n"));
+        exit(-1);
+    }
+    index = 0;
+    checked = 0;
+    for (addr=FLASHP_BASE; ok && checked < SPOT_CHECKS; addr+=blocksz) {
+        if (addr == FLASHP_BASE + flash_bytes)
+            addr = BOOTP_BASE;
+        if (addr >= BOOTP_BASE + boot_bytes)
+            break;
+        if (addr >= BOOTP_BASE) {
+            data = boot_data;
+            offset = addr - BOOTP_BASE;
+            if (! boot_used || ! boot_dirty [offset / blocksz])
+                continue;
+        } else {
+            data = flash_data;
+            offset = addr - FLASHP_BASE;
+            if (! flash_used || ! flash_dirty [offset / blocksz])
+                continue;
+        }
+        if (! journal_has(journal, addr) || index++ % step != 0)
+            continue;
+        target_read_block(target, addr, blocksz/4, (unsigned*) block);
+        if (memcmp(block, data + offset, blocksz) != 0)
+            ok = 0;
+        checked++;
+    }
+    free(block);
+    return ok;
+}
+
+/*
+ * Verify the row just programmed and record it in the journal.
+ */
+static void confirm_block(unsigned paddr, unsigned vaddr)
+{
+    if (! skip_verify)
+        verify_block(target, vaddr);
+    journal_confirm(journal, paddr);
+}
+
+#define VERIFY_SPAN     (64 * 1024)     /* Max bytes of one CRC request */
+#define CLUSTER_SPAN    (16 * 1024)     /* Max bytes of one cluster write */
+#define VERIFY_GAP      (8 * 1024)      /* Max bytes of erased rows in one CRC request */
+
+/*
+ * Virtual address of image data, as given in the input file.
+ */
+static unsigned image_vaddr(unsigned paddr)
+{
+    if (paddr >= BOOTP_BASE)
+        return paddr - BOOTP_BASE + (bootv_kseg ? BOOTV_KSEG1_BASE : BOOTV_KSEG0_BASE);
+    return paddr - FLASHP_BASE + (flashv_kseg ? FLASHV_KSEG1_BASE : FLASHV_KSEG0_BASE);
+}
+
+static unsigned *image_data(unsigned paddr)
+{
+    if (paddr >= BOOTP_BASE)
+        return (unsigned*) (boot_data + paddr - BOOTP_BASE);
+    return (unsigned*) (flash_data + paddr - FLASHP_BASE);
+}
+
+/*
+ * Add rows of one memory, marked by dirty bits.
+ * With journal, confirmed rows are skipped, and every
+ * row is verified right after it has been written.
+ */
+static void plan_rows(plan_t *p, int op, unsigned base,
+    unsigned nbytes, unsigned char *dirty)
+{
+    unsigned addr;
+
+    for (addr=0; addr<nbytes; addr+=blocksz) {
+        if (! dirty [addr / blocksz])
+            continue;
+        if (op == PLAN_PROGRAM && journal) {
+            if (journal_has(journal, base + addr))
+                continue;
+            plan_add(p, PLAN_PROGRAM, base + addr, blocksz);
+            if (! skip_verify)
+                plan_add(p, PLAN_VERIFY, base + addr, blocksz);
+            continue;
+        }
+        plan_add(p, op, base + addr, blocksz);
+    }
+}
+
+/*
+ * Turn the image into a list of operations.
+ */
+static void build_plan(plan_t *p, int chip_erase)
+{
+    unsigned devcfg_block = devcfg_offset / blocksz, gap;
+    int devcfg_write = devcfg_addr && ! verify_only &&
+        ! (journal && journal_has(journal, devcfg_addr));
+    unsigned char save;
+
+    if (! verify_only) {
+        if (chip_erase)
+            plan_add(p, PLAN_CHIP_ERASE, 0, 0);
+        else
+            plan_erase_pages(p, flash_bytes, boot_bytes);
+        if (flash_used)
+            plan_rows(p, PLAN_PROGRAM, FLASHP_BASE, flash_bytes, flash_dirty);
+        if (boot_used)
+            plan_rows(p, PLAN_PROGRAM, BOOTP_BASE, boot_bytes, boot_dirty);
+        if (devcfg_write)
+            plan_add(p, PLAN_DEVCFG, devcfg_addr, 0);
+    }
+    if (skip_verify || journal)
+        return;
+    if (flash_used)
+        plan_rows(p, PLAN_VERIFY, FLASHP_BASE, flash_bytes, flash_dirty);
+    if (boot_used) {
+        /* Configuration words are verified with their row.
+         * Boot memory may hold data which is not in the image:
+         * verify no gaps. */
+        gap = p->verify_gap;
+        p->verify_gap = 0;
+        save = boot_dirty [devcfg_block];
+        if (devcfg_write)
+            boot_dirty [devcfg_block] = 1;
+        plan_rows(p, PLAN_VERIFY, BOOTP_BASE, boot_bytes, boot_dirty);
+        boot_dirty [devcfg_block] = save;
+        p->verify_gap = gap;
+    }
+}
+
+/*
+ * Cost model for the current adapter and chip.
+ */
+static void plan_costs(plan_cost_t *c)
+{
+    adapter_t *a = target->adapter;
+
+    c->round_trip_usec = a->round_trip_usec ? a->round_trip_usec : 1000;
+    c->bytes_per_sec = a->bytes_per_sec ? a->bytes_per_sec : 64000;
+    c->row_bytes = blocksz;
+    c->row_usec = a->row_usec ? a->row_usec : 2000;
+    c->page_bytes = target_page_size(target);
+    c->page_erase_msec = a->page_erase_msec ? a->page_erase_msec : 20;
+    c->chip_erase_msec = a->erase_msec ? a->erase_msec : 1000;
+    c->verify_by_read = ! a->verify_data && ! (a->flags & AD_VERIFY_SPAN);
+    /* PE is not loaded yet: expect the one of this family. */
+    if (a->program_cluster && (target_family_pe_caps(target) & PE_CAP_CLUSTER))
+        c->cluster_bytes = CLUSTER_SPAN;
+    else
+        c->cluster_bytes = 0;
+}
+
+static void program_devcfg()
+{
+    if (FAMILY_MM == target->family->name_short){
+        target_program_devcfg(target, fdevopt, ficd, fpor, fwdt,
+                                foscsel, fsec, afdevopt, aficd,
+                                afpor, afwdt, afoscsel, afsec, 0, 0);
+    }
+    else if (FAMILY_MK == target->family->name_short){
+        target_program_devcfg(target, bf1devcfg0, bf1devcfg1,
+            bf1devcfg2, bf1devcfg3, bf1devcp, bf1devsign, bf1seq,
+            bf2devcfg0, bf2devcfg1, bf2devcfg2, bf2devcfg3,
+            bf2devcp, bf2devsign, bf2seq);
+    }
+    else{
+        target_program_devcfg(target, devcfg0, devcfg1, devcfg2, devcfg3,
+                                0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    }
+}
+
+/*
+ * Stages of execution, shown with a progress indicator.
+ */
+#define PHASE_NONE          0
+#define PHASE_ERASE         1
+#define PHASE_PROGRAM_FLASH 2
+#define PHASE_PROGRAM_BOOT  3
+#define PHASE_VERIFY_FLASH  4
+#define PHASE_VERIFY_BOOT   5
+
+static int phase_of(plan_op_t *o)
+{
+    int boot = (o->addr >= BOOTP_BASE);
+
+    switch (o->op) {
+    case PLAN_PAGE_ERASE:
+        return PHASE_ERASE;
+    case PLAN_PROGRAM:
+        return boot ? PHASE_PROGRAM_BOOT : PHASE_PROGRAM_FLASH;
+    case PLAN_VERIFY:
+        if (journal) {
+            /* Verified right after programming. */
+            return boot ? PHASE_PROGRAM_BOOT : PHASE_PROGRAM_FLASH;
+        }
+        return boot ? PHASE_VERIFY_BOOT : PHASE_VERIFY_FLASH;
+    }
+    return PHASE_NONE;
+}
+
+/*
+ * Print a title and the progress indicator for the operations,
+ * starting from given index. Return the progress step.
+ */
+static int begin_phase(plan_t *p, int i, int phase)
+{
+    unsigned nrows = 0, step, len;
+
+    switch (phase) {
+    case PHASE_ERASE:
+        printf(_("        Erase: "));
+        fflush(stdout);
+        return 1;
+    case PHASE_PROGRAM_FLASH:
+        printf(_("Program flash: "));
+        break;
+    case PHASE_PROGRAM_BOOT:
+        printf(_(" Program boot: "));
+        break;
+    case PHASE_VERIFY_FLASH:
+        printf(_(" Verify flash: "));
+        break;
+    case PHASE_VERIFY_BOOT:
+        printf(_("  Verify boot: "));
+        break;
+    default:
+        return 1;
+    }
+    for (; i<p->nops && phase_of(&p->op[i]) == phase; i++) {
+        if (p->op[i].op == PLAN_PROGRAM || ! journal)
+            nrows += p->op[i].nbytes / blocksz;
+    }
+    for (step=1; nrows / step >= 64; step<<=1)
+        continue;
+    len = nrows / step;
+    if (len < 1)
+        len = 1;
+    print_symbols('.', len);
+    print_symbols('\b', len);
+    fflush(stdout);
+    return step;
+}
+
+static void end_phase(int phase, unsigned npages)
+{
+    switch (phase) {
+    case PHASE_ERASE:
+        printf(_("%u pages done\n"), npages);
+        break;
+    case PHASE_PROGRAM_FLASH:
+        printf(_("# done\n"));
+        break;
+    case PHASE_PROGRAM_BOOT:
+        printf(_("# done      \n"));
+        break;
+    case PHASE_VERIFY_FLASH:
+        printf(_(" done\n"));
+        break;
+    case PHASE_VERIFY_BOOT:
+        printf(_(" done       \n"));
+        break;
+    }
 }
 
 /*
- * Write flash memory.
+ * Write a span of rows by PE clusters: one command
+ * and one response for up to CLUSTER_SPAN bytes.
  */
-void program_block(target_t *mc, unsigned addr)
+static void program_clusters(plan_op_t *o, int step)
 {
-    unsigned char *data;
-    unsigned offset;
-
-    if (addr >= BOOTV_KSEG0_BASE && addr < BOOTV_KSEG0_BASE + boot_bytes) {
-        data = boot_data;
-        offset = addr - BOOTV_KSEG0_BASE;
-    } else if (addr >= BOOTV_KSEG1_BASE && addr < BOOTV_KSEG1_BASE + boot_bytes) {
-        data = boot_data;
-        offset = addr - BOOTV_KSEG1_BASE;
-    } else if (addr >= BOOTP_BASE && addr < BOOTP_BASE + boot_bytes) {
-        data = boot_data;
-        offset = addr - BOOTP_BASE;
-    } else if (addr >= FLASHV_KSEG0_BASE && addr < FLASHV_KSEG0_BASE + flash_bytes) {
-        data = flash_data;
-        offset = addr - FLASHV_KSEG0_BASE;
-    } else if (addr >= FLASHV_KSEG1_BASE && addr < FLASHV_KSEG1_BASE + flash_bytes) {
-        data = flash_data;
-        offset = addr - FLASHV_KSEG1_BASE;
-    } else {
-        data = flash_data;
-        offset = addr - FLASHP_BASE;
+    unsigned addr, end = o->addr + o->nbytes, n;
+
+    for (addr=o->addr; addr<end; ) {
+        n = end - addr;
+        if (n > CLUSTER_SPAN)
+            n = CLUSTER_SPAN;
+        target_program_cluster(target, image_vaddr(addr), n / 4, image_data(addr));
+        for (; n > 0; n -= blocksz, addr += blocksz) {
+            if (journal && skip_verify)
+                journal_confirm(journal, addr);
+            progress(step);
+        }
     }
-    target_program_block(mc, addr, blocksz/4, (unsigned*) (data + offset));
 }
 
-int verify_block(target_t *mc, unsigned addr)
+/*
+ * Execute the plan.
+ * Time is counted from the first program or verify operation.
+ */
+static void run_plan(plan_t *p, void **t0)
 {
-    unsigned char *data;
-    unsigned offset;
+    unsigned page_bytes = target_page_size(target);
+    unsigned addr, npages = 0;
+    int i, phase = PHASE_NONE, step = 1;
+    plan_op_t *o;
 
-    if (addr >= BOOTV_KSEG0_BASE && addr < BOOTV_KSEG0_BASE + boot_bytes) {
-        data = boot_data;
-        offset = addr - BOOTV_KSEG0_BASE;
-    } if (addr >= BOOTV_KSEG1_BASE && addr < BOOTV_KSEG1_BASE + boot_bytes) {
-        data = boot_data;
-        offset = addr - BOOTV_KSEG1_BASE;
-    } else if (addr >= BOOTP_BASE && addr < BOOTP_BASE + boot_bytes) {
-        data = boot_data;
-        offset = addr - BOOTP_BASE;
-    } else if (addr >= FLASHV_KSEG0_BASE && addr < FLASHV_KSEG0_BASE + flash_bytes) {
-        data = flash_data;
-        offset = addr - FLASHV_KSEG0_BASE;
-    } else if (addr >= FLASHV_KSEG1_BASE && addr < FLASHV_KSEG1_BASE + flash_bytes) {
-        data = flash_data;
-        offset = addr - FLASHV_KSEG1_BASE;
-    } else {
-        data = flash_data;
-        offset = addr - FLASHP_BASE;
+    progress_count = 0;
+    for (i=0; i<p->nops; i++) {
+        o = &p->op[i];
+        if (o->op != PLAN_CHIP_ERASE && ! executive_loaded) {
+            target_use_executive(target);
+            executive_loaded = 1;
+        }
+        if (phase_of(o) != phase) {
+            end_phase(phase, npages);
+            phase = phase_of(o);
+            step = begin_phase(p, i, phase);
+        }
+        if (! *t0 && (o->op == PLAN_PROGRAM || o->op == PLAN_VERIFY))
+            *t0 = fix_time();
+
+        switch (o->op) {
+        case PLAN_CHIP_ERASE:
+            target_erase(target);
+            break;
+        case PLAN_PAGE_ERASE:
+            if (! target_erase_pages(target, o->addr, o->nbytes / page_bytes)) {
+                fprintf(stderr, _("\nError: Page erase not supported by the adapter.\n"));
+                exit(1);
+            }
+            npages += o->nbytes / page_bytes;
+            break;
+        case PLAN_PROGRAM:
+            if (target_has_cluster(target)) {
+                program_clusters(o, step);
+                break;
+            }
+            for (addr=o->addr; addr<o->addr+o->nbytes; addr+=blocksz) {
+                program_block(target, image_vaddr(addr));
+                if (journal && skip_verify)
+                    journal_confirm(journal, addr);
+                progress(step);
+            }
+            break;
+        case PLAN_DEVCFG:
+            /* Write chip configuration. */
+            program_devcfg();
+            if (journal)
+                confirm_block(devcfg_addr, image_vaddr(BOOTP_BASE +
+                    devcfg_offset / blocksz * blocksz));
+            break;
+        case PLAN_VERIFY:
+            target_verify_block(target, image_vaddr(o->addr),
+                o->nbytes / 4, image_data(o->addr));
+            for (addr=o->addr; addr<o->addr+o->nbytes; addr+=blocksz) {
+                if (journal)
+                    journal_confirm(journal, addr);
+                else
+                    progress(step);
+            }
+            break;
+        }
     }
-    target_verify_block(mc, addr, blocksz/4, (unsigned*) (data + offset));
-    return 1;
+    end_phase(phase, npages);
 }
 
 void do_erase()
 {
+    plan_t plan;
+    plan_cost_t cost;
+    void *t0 = 0;
+
     atexit(quit);
-    target = target_open(target_port, target_speed, interface, interface_speed);
+    if (dry_run_part)
+        target = target_open_part(dry_run_part);
+    else
+        target = target_open(target_port, target_speed, interface, interface_speed);
     if (! target) {
         fprintf(stderr, _("Error detecting device -- check cable!\n"));
         exit(1);
@@ -494,18 +1473,40 @@ void do_erase()
         exit(1);
     }
 
-    target_erase(target);
+    plan_init(&plan, "erase", 0);
+    if (nranges > 0 || nexcludes > 0) {
+        /* Erase only selected pages. */
+        check_windows(target_page_size(target));
+        plan_erase_pages(&plan, target_flash_bytes(target), target_boot_bytes(target));
+    } else
+        plan_add(&plan, PLAN_CHIP_ERASE, 0, 0);
+
+    if (dry_run) {
+        blocksz = target_block_size(target);
+        plan_costs(&cost);
+        plan_print(&plan, &cost);
+    } else if (plan.nops == 1 && plan.op[0].op == PLAN_CHIP_ERASE) {
+        target_erase(target);
+    } else {
+        run_plan(&plan, &t0);
+    }
+    plan_free(&plan);
 }
 
 void do_program(char *filename)
 {
-    unsigned addr;
-    int progress_len, progress_step, boot_progress_len;
+    unsigned addr, page_bytes, selected_blocks;
+    int windowed = 0, paged = 0, chip_erase, devcfg_selected, nplans, best, i;
+    plan_t plan [2];
+    plan_cost_t cost;
     void *t0;
 
     /* Open and detect the device. */
     atexit(quit);
-    target = target_open(target_port, target_speed, interface, interface_speed);
+    if (dry_run_part)
+        target = target_open_part(dry_run_part);
+    else
+        target = target_open(target_port, target_speed, interface, interface_speed);
     if (! target) {
         fprintf(stderr, _("Error detecting device -- check cable!\n"));
         exit(1);
@@ -524,6 +1525,12 @@ void do_program(char *filename)
         blocksz = target_block_size(target);
     }
     devcfg_offset = target_devcfg_offset(target);
+    if (nranges > 0 || nexcludes > 0) {
+        windowed = 1;
+        page_bytes = target_page_size(target);
+        check_windows(page_bytes > blocksz ? page_bytes : blocksz);
+    }
+    devcfg_selected = is_selected(BOOTP_BASE + devcfg_offset, 16);
     printf(_("    Processor: %s\n"), target_cpu_name(target));
     printf(_(" Flash memory: %d kbytes\n"), flash_bytes / 1024);
     if (boot_bytes > 0)
@@ -531,7 +1538,7 @@ void do_program(char *filename)
     printf(_("         Data: %d bytes\n"), total_bytes);
 
     /* Verify DEVCFGx values. */
-    if (boot_used) {
+    if (boot_used && devcfg_selected) {
         if (FAMILY_MM == target->family->name_short){
             /* Check if both values have something in them.
              * DEVOPT (and other) have some permanent 1 bits. Use those.
@@ -597,140 +1604,357 @@ void do_program(char *filename)
         }
     }
 
-    if (! verify_only) {
-        /* Erase flash. */
-        target_erase(target);
-    }
-    target_use_executive(target);
-
     /* Compute dirty bits for every block. */
     if (flash_used) {
         for (addr=0; addr<flash_bytes; addr+=blocksz) {
-            flash_dirty [addr / blocksz] = is_flash_block_dirty(addr);
+            flash_dirty [addr / blocksz] = is_flash_block_dirty(addr) &&
+                is_selected(FLASHP_BASE + addr, blocksz);
         }
     }
     if (boot_used) {
         for (addr=0; addr<boot_bytes; addr+=blocksz) {
-            boot_dirty [addr / blocksz] = is_boot_block_dirty(addr);
+            boot_dirty [addr / blocksz] = is_boot_block_dirty(addr) &&
+                is_selected(BOOTP_BASE + addr, blocksz);
         }
     }
+    if (windowed) {
+        /* Skip memories with no selected blocks. */
+        selected_blocks = 0;
+        for (addr=0; addr<flash_bytes; addr+=blocksz)
+            selected_blocks += flash_dirty [addr / blocksz];
+        if (selected_blocks == 0)
+            flash_used = 0;
+        selected_blocks = devcfg_selected;
+        for (addr=0; addr<boot_bytes; addr+=blocksz)
+            selected_blocks += boot_dirty [addr / blocksz];
+        if (selected_blocks == 0)
+            boot_used = 0;
+    }
 
-    /* Compute length of progress indicator for flash memory. */
-    for (progress_step=1; ; progress_step<<=1) {
-        progress_len = 0;
-        for (addr=0; addr<flash_bytes; addr+=blocksz) {
-            if (flash_dirty [addr / blocksz])
-                progress_len++;
+    devcfg_addr = 0;
+    if (boot_used && devcfg_selected && ! boot_dirty [devcfg_offset / blocksz]) {
+        /* Configuration words are written separately. */
+        devcfg_addr = BOOTP_BASE + devcfg_offset;
+        if (FAMILY_MK == target->family->name_short)
+            devcfg_addr += 0x40000;
+    }
+
+    if (journal_name && ! verify_only && ! dry_run) {
+        journal = journal_open(journal_name, image_hash(), target_idcode(target));
+        if (! journal)
+            exit(1);
+        if (journal_count(journal) > 0) {
+            page_bytes = target_page_size(target);
+            if (! target->adapter->erase_page || page_bytes < blocksz) {
+                printf(_("      Journal: page erase not supported, starting over\n"));
+            } else {
+                journal_resume = 1;
+                paged = 1;
+            }
         }
-        if (progress_len / progress_step < 64) {
-            progress_len /= progress_step;
-            if (progress_len < 1)
-                progress_len = 1;
-            break;
+    }
+
+    if (journal_resume) {
+        target_use_executive(target);
+        executive_loaded = 1;
+        if (spot_check()) {
+            printf(_("      Journal: %u rows already done\n"), journal_count(journal));
+        } else {
+            printf(_("      Journal: chip contents differ, starting over\n"));
+            journal_resume = 0;
+        }
+    }
+    if (journal) {
+        /* Rows in pages to be erased are not confirmed anymore. */
+        journal_begin(journal, journal_keep);
+    }
+
+    /* With CRC, one verify request covers a long span.
+     * After chip erase, it may also cover the erased rows between
+     * spans: fewer requests, but more bytes for PE to check.
+     * Choose the fastest plan. */
+    chip_erase = ! windowed && ! paged;
+    plan_costs(&cost);
+    nplans = 0;
+    if ((target->adapter->flags & AD_VERIFY_SPAN) && ! skip_verify && ! journal) {
+        plan_init(&plan[nplans], "span verify", VERIFY_SPAN);
+        build_plan(&plan[nplans++], chip_erase);
+        if (chip_erase) {
+            plan_init(&plan[nplans], "span verify over gaps", VERIFY_SPAN);
+            plan[nplans].verify_gap = VERIFY_GAP;
+            build_plan(&plan[nplans++], chip_erase);
         }
+    } else {
+        plan_init(&plan[nplans], "row verify", blocksz);
+        build_plan(&plan[nplans++], chip_erase);
+    }
+    best = 0;
+    for (i=1; i<nplans; i++) {
+        if (plan_estimate(&plan[i], &cost) < plan_estimate(&plan[best], &cost))
+            best = i;
     }
+    if (dry_run) {
+        for (i=0; i<nplans; i++)
+            plan_print(&plan[i], &cost);
+        printf(_("Chosen plan: %s\n"), plan[best].name);
+    } else {
+        t0 = 0;
+        run_plan(&plan[best], &t0);
+        if (! t0)
+            t0 = fix_time();
+    }
+    for (i=0; i<nplans; i++)
+        plan_free(&plan[i]);
+    if (dry_run)
+        return;
 
-    /* Compute length of progress indicator for boot memory. */
-    boot_progress_len = 1;
-    for (addr=0; addr<boot_bytes; addr+=blocksz) {
-        if (boot_dirty [addr / blocksz])
-            boot_progress_len++;
+    if (journal) {
+        /* Completed: the journal is not needed anymore. */
+        journal_close(journal, 1);
+        journal = 0;
+    }
+    if (boot_used || flash_used)
+        printf(_(" Program rate: %ld bytes per second\n"),
+            total_bytes * 1000L / mseconds_elapsed(t0));
+}
+
+/*
+ * Update configuration words only.
+ * The page with configuration words is read from the chip,
+ * patched, erased and written back, keeping the rest of boot flash.
+ * New values come from --config-word options and from input files.
+ */
+void do_config()
+{
+    unsigned page_bytes, row_bytes, cfg_addr[2], page_addr[2];
+    unsigned *old_page[2], *new_page[2], offset, addr, i, k;
+    int npages, p, changed;
+    void *t0;
+
+    atexit(quit);
+    target = target_open(target_port, target_speed, interface, interface_speed);
+    if (! target) {
+        fprintf(stderr, _("Error detecting device -- check cable!\n"));
+        exit(1);
+    }
+    if ((target->adapter->flags & AD_WRITE) == 0) {
+        fprintf(stderr, _("Error: Target write not supported.\n"));
+        exit(1);
+    }
+    devcfg_offset = target_devcfg_offset(target);
+    if (devcfg_offset == 0) {
+        fprintf(stderr, _("Error: No configuration words on this chip.\n"));
+        exit(1);
+    }
+    printf(_("    Processor: %s\n"), target_cpu_name(target));
+
+    /* MK has configuration words in both boot flash panels. */
+    page_bytes = target_page_size(target);
+    row_bytes = target_block_size(target);
+    if (FAMILY_MK == target->family->name_short) {
+        cfg_addr[0] = BOOTP_BASE + 0x40000 + devcfg_offset;
+        cfg_addr[1] = cfg_addr[0] + 0x20000;
+        npages = 2;
+    } else {
+        cfg_addr[0] = BOOTP_BASE + devcfg_offset;
+        npages = 1;
     }
 
-    progress_count = 0;
     t0 = fix_time();
-    if (! verify_only) {
-        if (flash_used) {
-            printf(_("Program flash: "));
-            print_symbols('.', progress_len);
-            print_symbols('\b', progress_len);
-            fflush(stdout);
-            for (addr=0; addr<flash_bytes; addr+=blocksz) {
-                if (flash_dirty [addr / blocksz]) {
-                    program_block(target, addr + (flashv_kseg ? FLASHV_KSEG1_BASE : FLASHV_KSEG0_BASE));
-                    progress(progress_step);
-                }
-            }
-            printf(_("# done\n"));
-        }
-        if (boot_used) {
-            printf(_(" Program boot: "));
-            print_symbols('.', boot_progress_len);
-            print_symbols('\b', boot_progress_len);
-            fflush(stdout);
-            for (addr=0; addr<boot_bytes; addr+=blocksz) {
-                if (boot_dirty [addr / blocksz]) {
-                    program_block(target, addr + (bootv_kseg ? BOOTV_KSEG1_BASE : BOOTV_KSEG0_BASE));
-                    progress(1);
-                }
-            }
-            printf(_("# done      \n"));
-            if (! boot_dirty [devcfg_offset / blocksz]) {
-                /* Write chip configuration. */
-                if (FAMILY_MM == target->family->name_short){
-                    target_program_devcfg(target, fdevopt, ficd, fpor, fwdt, 
-                                            foscsel, fsec, afdevopt, aficd, 
-                                            afpor, afwdt, afoscsel, afsec, 0, 0);
-                }
-				else if (FAMILY_MK == target->family->name_short){
-					target_program_devcfg(target, bf1devcfg0, bf1devcfg1,
-						bf1devcfg2, bf1devcfg3, bf1devcp, bf1devsign, bf1seq,
-						bf2devcfg0, bf2devcfg1, bf2devcfg2, bf2devcfg3,
-						bf2devcp, bf2devsign, bf2seq);
-				}
-                else{
-                    target_program_devcfg(target, devcfg0, devcfg1, devcfg2, devcfg3,
-                                            0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
-                }
-                boot_dirty [devcfg_offset / blocksz] = 1;
-            }
+    target_use_executive(target);
+    changed = 0;
+    for (p=0; p<npages; p++) {
+        page_addr[p] = cfg_addr[p] & ~(page_bytes - 1);
+        old_page[p] = malloc(page_bytes);
+        new_page[p] = malloc(page_bytes);
+        if (! old_page[p] || ! new_page[p]) {
+            fprintf(stderr, _("Out of memory\n"));
+            exit(1);
+        }
+        target_read_block(target, page_addr[p], page_bytes/4, old_page[p]);
+        memcpy(new_page[p], old_page[p], page_bytes);
+
+        /* Apply data from input files. */
+        for (i=0; i<page_bytes; i++) {
+            offset = page_addr[p] + i - BOOTP_BASE;
+            if (boot_owner [offset])
+                ((unsigned char*) new_page[p]) [i] = boot_data [offset];
+        }
+        if (FAMILY_MZ == target->family->name_short) {
+            /* Clear bits DEVSIGN0[31] and ADEVSIGN0[31]. */
+            new_page[p] [(0xFFEC - devcfg_offset + cfg_addr[p] - page_addr[p]) / 4] &= 0x7fffffff;
+            new_page[p] [(0xFF6C - devcfg_offset + cfg_addr[p] - page_addr[p]) / 4] &= 0x7fffffff;
         }
     }
-    if (flash_used && !skip_verify) {
-        printf(_(" Verify flash: "));
-        print_symbols('.', progress_len);
-        print_symbols('\b', progress_len);
-        fflush(stdout);
-        for (addr=0; addr<flash_bytes; addr+=blocksz) {
-            if (flash_dirty [addr / blocksz]) {
-                progress(progress_step);
-                if (! verify_block(target, addr + (flashv_kseg ? FLASHV_KSEG1_BASE : FLASHV_KSEG0_BASE)))
-                    exit(0);
+
+    /* Apply patches from command line. */
+    for (k=0; k<ncfgpatches; k++) {
+        for (p=0; p<npages; p++) {
+            addr = cfgpatch[k].addr;
+            if (addr >= page_addr[p] && addr < page_addr[p] + page_bytes) {
+                unsigned *word = &new_page[p] [(addr - page_addr[p]) / 4];
+
+                *word = (*word & ~cfgpatch[k].mask) |
+                        (cfgpatch[k].value & cfgpatch[k].mask);
+                break;
             }
         }
-        printf(_(" done\n"));
+        if (p == npages) {
+            fprintf(stderr, _("%08X: address is outside of configuration page\n"),
+                cfgpatch[k].addr);
+            exit(1);
+        }
     }
-    if (boot_used && !skip_verify) {
-        printf(_("  Verify boot: "));
-        print_symbols('.', boot_progress_len);
-        print_symbols('\b', boot_progress_len);
-        fflush(stdout);
-        for (addr=0; addr<boot_bytes; addr+=blocksz) {
-            if (boot_dirty [addr / blocksz]) {
-                progress(1);
-                if (! verify_block(target, addr + (bootv_kseg ? BOOTV_KSEG1_BASE : BOOTV_KSEG0_BASE)))
-                    exit(0);
+
+    for (p=0; p<npages; p++) {
+        if (memcmp(old_page[p], new_page[p], page_bytes) == 0)
+            continue;
+        changed++;
+        for (i=0; i<page_bytes/4; i++) {
+            if (old_page[p][i] != new_page[p][i])
+                printf(_("     %08X: %08X -> %08X\n"), page_addr[p] + i*4,
+                    old_page[p][i], new_page[p][i]);
+        }
+        if (dry_run)
+            continue;
+
+        /* Erase the page and write it back. The row with
+         * configuration words is written by small units. */
+        if (! target_erase_pages(target, page_addr[p], 1)) {
+            fprintf(stderr, _("Error: Page erase not supported by the adapter.\n"));
+            exit(1);
+        }
+        for (i=0; i<page_bytes; i+=row_bytes) {
+            addr = page_addr[p] + i;
+            if (cfg_addr[p] >= addr && cfg_addr[p] < addr + row_bytes)
+                target_program_units(target, addr, row_bytes/4, new_page[p] + i/4);
+            else
+                target_program_block(target, addr, row_bytes/4, new_page[p] + i/4);
+        }
+        target_verify_block(target, page_addr[p], page_bytes/4, new_page[p]);
+    }
+    if (changed && dry_run)
+        printf(_("Configuration: %d page(s) to update\n"), changed);
+    else if (changed)
+        printf(_("Configuration: %d page(s) updated in %u msec\n"),
+            changed, mseconds_elapsed(t0));
+    else
+        printf(_("Configuration: no changes\n"));
+    for (p=0; p<npages; p++) {
+        free(old_page[p]);
+        free(new_page[p]);
+    }
+}
+
+/*
+ * Check whether the data read from the target are erased.
+ */
+static int is_erased(unsigned *data, unsigned nwords)
+{
+    while (nwords-- > 0) {
+        if (*data++ != 0xffffffff)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Read one region of memory into the dump.
+ * Fill one buffer from the target, while the other is written.
+ * In sparse mode, erased chunks are detected by the adapter
+ * and not transferred at all; erased blocks which were read
+ * are not written.
+ */
+static unsigned read_region(dump_t *dump, char *filename,
+    unsigned base, unsigned nbytes, unsigned progress_step)
+{
+    unsigned addr, chunk, n, m, *data, fill, start, skipped;
+    int blank, device_check;
+
+    skipped = 0;
+    data = 0;
+    fill = 0;
+    start = base;
+    device_check = sparse_read;
+    for (chunk=base; chunk-base<nbytes; chunk+=n) {
+        n = nbytes - (chunk - base);
+        if (n > DUMP_BUFSZ)
+            n = DUMP_BUFSZ;
+
+        blank = 0;
+        if (device_check) {
+            blank = target_blank_check(target, chunk, n/4);
+            if (blank < 0) {
+                /* Not supported: check on host side. */
+                device_check = 0;
+                blank = 0;
             }
         }
-        printf(_(" done       \n"));
+        for (addr=chunk; addr-chunk<n; addr+=m) {
+            m = n - (addr - chunk);
+            if (m > blocksz)
+                m = blocksz;
+            progress(progress_step);
+            if (! blank) {
+                if (! data) {
+                    data = dump_buffer(dump);
+                    if (! data) {
+                        fprintf(stderr, _("%s: write error!\n"), filename);
+                        exit(1);
+                    }
+                }
+                if (fill == 0)
+                    start = addr;
+                target_read_block(target, addr, m/4, data + fill/4);
+                if (! sparse_read || ! is_erased(data + fill/4, m/4)) {
+                    fill += m;
+                    if (fill == DUMP_BUFSZ) {
+                        dump_write(dump, start, fill);
+                        data = 0;
+                        fill = 0;
+                    }
+                    continue;
+                }
+            }
+
+            /* Erased block: pass the pending data, and leave a hole. */
+            if (fill > 0) {
+                dump_write(dump, start, fill);
+                data = 0;
+                fill = 0;
+            }
+            dump_hole(dump, addr, m);
+            skipped += m;
+        }
     }
-    if (boot_used || flash_used)
-        printf(_(" Program rate: %ld bytes per second\n"),
-            total_bytes * 1000L / mseconds_elapsed(t0));
+    if (fill > 0)
+        dump_write(dump, start, fill);
+    return skipped;
 }
 
+/*
+ * Read memory to file.
+ * When nbytes is zero, read all memory regions of the chip.
+ */
 void do_read(char *filename, unsigned base, unsigned nbytes)
 {
-    FILE *fd;
-    unsigned len, addr, data [256], progress_step;
+    dump_t *dump;
+    target_region_t map [TARGET_MAXREGIONS];
+    unsigned len, total, progress_step, skipped;
+    int format, nregions, i;
     void *t0;
 
-    fd = fopen(filename, "wb");
-    if (! fd) {
+    format = read_format >= 0 ? read_format : dump_format_of(filename);
+    if (nbytes == 0 && format == DUMP_RAW) {
+        fprintf(stderr, _("%s: use HEX, SREC or ELF format to read all memory\n"),
+            filename);
+        exit(1);
+    }
+    dump = dump_open(filename, format);
+    if (! dump) {
         perror(filename);
         exit(1);
     }
-    printf(_("       Memory: total %d bytes\n"), nbytes);
 
     /* Use 1kbyte blocks. */
     blocksz = 1024;
@@ -748,9 +1972,30 @@ void do_read(char *filename, unsigned base, unsigned nbytes)
         exit(1);
     }
 
+    if (nbytes > 0) {
+        printf(_("       Memory: total %d bytes\n"), nbytes);
+        map[0].name = "memory";
+        map[0].addr = base;
+        map[0].nbytes = (nbytes + blocksz - 1) / blocksz * blocksz;
+        nregions = 1;
+    } else {
+        /* Whole chip, at KSEG1 addresses. */
+        printf(_("    Processor: %s\n"), target_cpu_name(target));
+        nregions = target_memory_map(target, map);
+        for (i=0; i<nregions; i++) {
+            printf(_("%13s: %08X, %d bytes\n"), map[i].name,
+                map[i].addr, map[i].nbytes);
+            map[i].addr |= 0xa0000000;
+        }
+    }
+    total = 0;
+    for (i=0; i<nregions; i++)
+        total += (map[i].nbytes + blocksz - 1) / blocksz * blocksz;
+
+    /* All regions are read in one PE session. */
     target_use_executive(target);
     for (progress_step=1; ; progress_step<<=1) {
-        len = 1 + nbytes / progress_step / blocksz;
+        len = 1 + total / progress_step / blocksz;
         if (len < 64)
             break;
     }
@@ -760,19 +2005,20 @@ void do_read(char *filename, unsigned base, unsigned nbytes)
     fflush(stdout);
 
     progress_count = 0;
+    skipped = 0;
     t0 = fix_time();
-    for (addr=base; addr-base<nbytes; addr+=blocksz) {
-        progress(progress_step);
-        target_read_block(target, addr, blocksz/4, data);
-        if (fwrite(data, 1, blocksz, fd) != blocksz) {
-            fprintf(stderr, "%s: write error!\n", filename);
-            exit(1);
-        }
+    for (i=0; i<nregions; i++)
+        skipped += read_region(dump, filename,
+            map[i].addr, map[i].nbytes, progress_step);
+    if (dump_close(dump) < 0) {
+        fprintf(stderr, _("%s: write error!\n"), filename);
+        exit(1);
     }
     printf(_("# done\n"));
+    if (sparse_read)
+        printf(_("       Erased: %d bytes skipped\n"), skipped);
     printf(_("         Rate: %ld bytes per second\n"),
-        nbytes * 1000L / mseconds_elapsed(t0));
-    fclose(fd);
+        total * 1000L / mseconds_elapsed(t0));
 }
 
 /*
@@ -823,7 +2069,7 @@ static void gpl_show_warranty(void)
 
 int main(int argc, char **argv)
 {
-    int ch, read_mode = 0;
+    int ch, i, read_mode = 0;
     unsigned base, nbytes;
     static const struct option long_options[] = {
         { "help",        0, 0, 'h' },
@@ -831,6 +2077,22 @@ int main(int argc, char **argv)
         { "copying",     0, 0, 'C' },
         { "version",     0, 0, 'V' },
         { "skip-verify", 0, 0, 'S' },
+        { "autospeed",   0, 0, 'A' },
+        { "format",      1, 0, 'F' },
+        { "sparse",      0, 0, 'Z' },
+        { "overlap",     1, 0, 'O' },
+        { "range",       1, 0, 'R' },
+        { "config",      0, 0, 'c' },
+        { "config-word", 1, 0, 'w' },
+        { "exclude",     1, 0, 'X' },
+        { "journal",     1, 0, 'J' },
+        { "slot",        1, 0, 'L' },
+        { "set",         1, 0, 'T' },
+        { "counter",     1, 0, 'N' },
+        { "csv",         1, 0, 'Q' },
+        { "dry-run",     0, 0, 'n' },
+        { "part",        1, 0, 'M' },
+        { "pe-path",     1, 0, 'P' },
         { NULL,          0, 0, 0 },
     };
 
@@ -859,7 +2121,10 @@ int main(int argc, char **argv)
 #endif
     signal(SIGTERM, interrupted);
 
-    while ((ch = getopt_long(argc, argv, "vDhrpeCVWSd:b:B:i:s:",
+    /* Directories with PE files, unless given by option. */
+    target_pe_path(getenv("PIC32PROG_PE_PATH"));
+
+    while ((ch = getopt_long(argc, argv, "vDhrpeCVWSd:b:B:i:s:F:",
       long_options, 0)) != -1) {
         switch (ch) {
         case 'v':
@@ -936,6 +2201,74 @@ int main(int argc, char **argv)
                 fprintf(stderr, "Using clock speed of %d khz, if available\n", interface_speed);
             }
             continue;
+        case 'A':
+            interface_speed = SPEED_AUTO;
+            continue;
+        case 'F':
+            read_format = dump_format(optarg);
+            if (read_format < 0) {
+                fprintf(stderr, _("Unknown dump format \"%s\"\n"), optarg);
+                return 0;
+            }
+            continue;
+        case 'Z':
+            ++sparse_read;
+            continue;
+        case 'c':
+            ++config_only;
+            continue;
+        case 'w':
+            parse_cfgpatch(optarg);
+            ++config_only;
+            continue;
+        case 'R':
+            parse_window(optarg, range, &nranges);
+            continue;
+        case 'X':
+            parse_window(optarg, exclude, &nexcludes);
+            continue;
+        case 'J':
+            journal_name = optarg;
+            continue;
+        case 'L':
+            parse_slot(optarg);
+            continue;
+        case 'T':
+            if (nslot_sets >= MAXWINDOWS) {
+                fprintf(stderr, _("Too many slot values\n"));
+                return 0;
+            }
+            slot_set [nslot_sets++] = optarg;
+            continue;
+        case 'N':
+            if (nslot_counters >= MAXWINDOWS) {
+                fprintf(stderr, _("Too many counters\n"));
+                return 0;
+            }
+            slot_counter [nslot_counters++] = optarg;
+            continue;
+        case 'Q':
+            slot_csv = optarg;
+            continue;
+        case 'n':
+            ++dry_run;
+            continue;
+        case 'M':
+            dry_run_part = optarg;
+            continue;
+        case 'P':
+            target_pe_path(optarg);
+            continue;
+        case 'O':
+            if (strcmp(optarg, "later") == 0) {
+                overlap_later = 1;
+            } else if (strcmp(optarg, "error") == 0) {
+                overlap_later = 0;
+            } else {
+                fprintf(stderr, _("Unknown overlap policy \"%s\"\n"), optarg);
+                return 0;
+            }
+            continue;
         }
 usage:
         printf("%s.\n\n", copyright);
@@ -948,12 +2281,16 @@ usage:
         printf("\nWrite flash memory:\n");
         printf("       pic32prog [-v] file.srec\n");
         printf("       pic32prog [-v] file.hex\n");
+        printf("       pic32prog [-v] boot.hex app.elf data.bin@0x9d070000 ...\n");
         printf("\nRead memory:\n");
         printf("       pic32prog -r file.bin address length\n");
+        printf("       pic32prog -r file.hex address length\n");
+        printf("       pic32prog -r file.hex\n");
         printf("\nArgs:\n");
         printf("       file.srec           Code file in SREC format\n");
         printf("       file.hex            Code file in Intel HEX format\n");
         printf("       file.bin            Code file in binary format\n");
+        printf("       file.elf            Code file in ELF format\n");
         printf("       -v                  Verify only\n");
         printf("       -r                  Read mode\n");
         printf("       -d device           Use specified serial or USB device\n");
@@ -969,6 +2306,26 @@ usage:
         printf("       -C, --copying       Print copying information\n");
         printf("       -W, --warranty      Print warranty information\n");
         printf("       -S, --skip-verify   Skip the write verification step\n");
+        printf("       --autospeed         Find the fastest reliable interface clock\n");
+        printf("       -F, --format=fmt    Format of memory dump: raw, hex, srec or elf\n");
+        printf("                           (default by file extension)\n");
+        printf("       --sparse            Skip erased memory when reading\n");
+        printf("       --overlap=policy    Overlapping input files: error or later\n");
+        printf("       --range=start:end   Erase, program and verify only this range\n");
+        printf("       --exclude=start:end Do not touch this range\n");
+        printf("       --journal=file      Record progress, resume interrupted programming\n");
+        printf("       --dry-run           Print the plan and time estimate, do not change the chip\n");
+        printf("       --part=name         With --dry-run: plan for this part or family,\n");
+        printf("                           no chip needed, default adapter timings\n");
+        printf("       --pe-path=dir:dir   Search for PE files pe-<family>.hex or .elf\n");
+        printf("       --slot=name@addr:len[:le|be|hex|text]\n");
+        printf("                           Per-board patch slot in the image\n");
+        printf("       --set=name=value    Value of the patch slot\n");
+        printf("       --counter=name=file Value from counter file, advanced when done\n");
+        printf("       --csv=file@row      Values from the row of CSV table\n");
+        printf("       --config            Update only configuration words from file\n");
+        printf("       --config-word=addr:value[/mask]\n");
+        printf("                           Change bits of configuration word\n");
         printf("\n");
         return 0;
     }
@@ -976,34 +2333,47 @@ usage:
     argc -= optind;
     argv += optind;
 
+    if (dry_run_part && (! dry_run || read_mode || config_only ||
+                         (argc == 0 && ! erase_only))) {
+        fprintf(stderr, _("Option --part needs --dry-run, with -e or input files\n"));
+        exit(1);
+    }
+
     memset(boot_data, ~0, BOOT_BYTES);
     memset(flash_data, ~0, FLASH_BYTES);
 
-    switch (argc) {
-    case 0:
+    if (config_only) {
+        /* Input files give new configuration words. */
+        for (i=0; i<argc; i++)
+            load_input(argv[i]);
+        do_config();
+    } else if (argc == 0) {
         if (erase_only > 0) {
             do_erase();
         } else {
             do_probe();
         }
-        break;
-    case 1:
-        if (! read_srec(argv[0]) &&
-            ! read_hex(argv[0])) {
-            fprintf(stderr, _("%s: bad file format\n"), argv[0]);
-            exit(1);
+    } else if (read_mode) {
+        switch (argc) {
+        case 1:
+            do_read(argv[0], 0, 0);
+            break;
+        case 3:
+            base = strtoul(argv[1], 0, 0);
+            nbytes = strtoul(argv[2], 0, 0);
+            do_read(argv[0], base, nbytes);
+            break;
+        default:
+            goto usage;
         }
+    } else {
+        /* Merge all input files into one image. */
+        for (i=0; i<argc; i++)
+            load_input(argv[i]);
+        apply_slots();
         do_program(argv[0]);
-        break;
-    case 3:
-        if (! read_mode)
-            goto usage;
-        base = strtoul(argv[1], 0, 0);
-        nbytes = strtoul(argv[2], 0, 0);
-        do_read(argv[0], base, nbytes);
-        break;
-    default:
-        goto usage;
+        if (! verify_only && ! dry_run)
+            update_counters();
     }
     quit();
     return 0;
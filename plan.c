@@ -0,0 +1,146 @@
+/*
+ * Plan of programming: a list of operations with a cost estimate.
+ *
+ * The plan is built from the image before touching the chip,
+ * so different strategies can be compared by the estimated time,
+ * and printed with --dry-run option.
+ *
+ * Copyright (C) 2015 Serge Vakulenko
+ *
+ * This file is part of PIC32PROG project, which is distributed
+ * under the terms of the GNU General Public License (GPL).
+ * See the accompanying file "COPYING" for more details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "plan.h"
+
+#define DEVCFG_WRITES   4       /* Requests to write configuration words */
+#define READ_CHUNK      1024    /* Bytes read back per request */
+#define CRC_BYTES_USEC  20      /* Speed of CRC computation by PE */
+
+void plan_init(plan_t *p, const char *name, unsigned verify_span)
+{
+    p->name = name;
+    p->op = 0;
+    p->nops = 0;
+    p->maxops = 0;
+    p->verify_span = verify_span;
+    p->verify_gap = 0;
+}
+
+void plan_free(plan_t *p)
+{
+    free(p->op);
+    p->op = 0;
+    p->nops = 0;
+    p->maxops = 0;
+}
+
+void plan_add(plan_t *p, int op, unsigned addr, unsigned nbytes)
+{
+    plan_op_t *last = p->nops > 0 ? &p->op[p->nops - 1] : 0;
+
+    if (last && last->op == op && last->addr + last->nbytes == addr &&
+        (op == PLAN_PROGRAM || op == PLAN_PAGE_ERASE ||
+         (op == PLAN_VERIFY && last->nbytes + nbytes <= p->verify_span))) {
+        last->nbytes += nbytes;
+        return;
+    }
+    if (last && last->op == op && op == PLAN_VERIFY &&
+        addr > last->addr + last->nbytes &&
+        addr - (last->addr + last->nbytes) <= p->verify_gap &&
+        addr + nbytes - last->addr <= p->verify_span) {
+        /* Verify the erased rows in between too. */
+        last->nbytes = addr + nbytes - last->addr;
+        return;
+    }
+    if (p->nops >= p->maxops) {
+        p->maxops = p->maxops ? p->maxops * 2 : 64;
+        p->op = realloc(p->op, p->maxops * sizeof(plan_op_t));
+        if (! p->op) {
+            fprintf(stderr, "plan: out of memory\n");
+            exit(-1);
+        }
+    }
+    last = &p->op[p->nops++];
+    last->op = op;
+    last->addr = addr;
+    last->nbytes = nbytes;
+}
+
+/*
+ * Estimate time of one operation, in microseconds.
+ */
+static unsigned long long op_usec(plan_op_t *o, plan_cost_t *c)
+{
+    unsigned long long n, transfer;
+
+    switch (o->op) {
+    case PLAN_CHIP_ERASE:
+        return c->round_trip_usec + c->chip_erase_msec * 1000ULL;
+
+    case PLAN_PAGE_ERASE:
+        n = (o->nbytes + c->page_bytes - 1) / c->page_bytes;
+        return n * (c->round_trip_usec + c->page_erase_msec * 1000ULL);
+
+    case PLAN_PROGRAM:
+        n = (o->nbytes + c->row_bytes - 1) / c->row_bytes;
+        transfer = c->row_bytes * 1000000ULL / c->bytes_per_sec;
+        if (c->cluster_bytes) {
+            /* One request for a cluster of rows. */
+            return (o->nbytes + c->cluster_bytes - 1) / c->cluster_bytes *
+                c->round_trip_usec + n * (transfer + c->row_usec);
+        }
+        return n * (c->round_trip_usec + transfer + c->row_usec);
+
+    case PLAN_DEVCFG:
+        return DEVCFG_WRITES * (c->round_trip_usec + c->row_usec);
+
+    case PLAN_VERIFY:
+        if (c->verify_by_read) {
+            n = (o->nbytes + READ_CHUNK - 1) / READ_CHUNK;
+            return n * c->round_trip_usec +
+                o->nbytes * 1000000ULL / c->bytes_per_sec;
+        }
+        return c->round_trip_usec + o->nbytes / CRC_BYTES_USEC;
+    }
+    return 0;
+}
+
+unsigned plan_estimate(plan_t *p, plan_cost_t *cost)
+{
+    unsigned long long usec = 0;
+    int i;
+
+    for (i=0; i<p->nops; i++)
+        usec += op_usec(&p->op[i], cost);
+    return (usec + 999) / 1000;
+}
+
+void plan_print(plan_t *p, plan_cost_t *cost)
+{
+    static const char *op_name[] = {
+        "chip erase", "page erase", "program", "devcfg", "verify",
+    };
+    plan_op_t *o;
+    unsigned msec = plan_estimate(p, cost);
+    int i;
+
+    printf("Plan \"%s\": %d operations, estimated %u.%03u seconds\n",
+        p->name, p->nops, msec / 1000, msec % 1000);
+    for (i=0; i<p->nops; i++) {
+        o = &p->op[i];
+        printf("    %-10s", op_name[o->op]);
+        if (o->nbytes > 0) {
+            printf("  %08X-%08X", o->addr, o->addr + o->nbytes - 1);
+            if (o->op == PLAN_PAGE_ERASE)
+                printf("  %u pages", (o->nbytes + cost->page_bytes - 1) / cost->page_bytes);
+            else
+                printf("  %u rows", (o->nbytes + cost->row_bytes - 1) / cost->row_bytes);
+        } else if (o->op == PLAN_DEVCFG) {
+            printf("  %08X", o->addr);
+        }
+        printf("  %llu msec\n", (op_usec(o, cost) + 999) / 1000);
+    }
+}
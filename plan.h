@@ -0,0 +1,73 @@
+/*
+ * Plan of programming: a list of operations with a cost estimate.
+ *
+ * Copyright (C) 2015 Serge Vakulenko
+ *
+ * This file is part of PIC32PROG project, which is distributed
+ * under the terms of the GNU General Public License (GPL).
+ * See the accompanying file "COPYING" for more details.
+ */
+
+#ifndef _PLAN_H
+#define _PLAN_H
+
+/*
+ * Operations.
+ */
+#define PLAN_CHIP_ERASE 0       /* Erase whole chip */
+#define PLAN_PAGE_ERASE 1       /* Erase a span of pages */
+#define PLAN_PROGRAM    2       /* Program a span of rows */
+#define PLAN_DEVCFG     3       /* Write configuration words */
+#define PLAN_VERIFY     4       /* Verify a span of rows */
+
+typedef struct {
+    int op;
+    unsigned addr;              /* Physical address */
+    unsigned nbytes;            /* Length of span */
+} plan_op_t;
+
+typedef struct {
+    const char *name;
+    plan_op_t *op;
+    int nops;
+    int maxops;
+    unsigned verify_span;       /* Max bytes of one verify operation */
+    unsigned verify_gap;        /* Max bytes of erased rows joined into verify */
+} plan_t;
+
+/*
+ * Cost model of the adapter and the chip.
+ */
+typedef struct {
+    unsigned round_trip_usec;   /* Latency of one request to adapter */
+    unsigned bytes_per_sec;     /* Data rate of the link */
+    unsigned row_bytes;         /* Size of programming row */
+    unsigned row_usec;          /* Time of row write */
+    unsigned page_bytes;        /* Size of erase page */
+    unsigned page_erase_msec;   /* Time of page erase */
+    unsigned chip_erase_msec;   /* Time of chip erase */
+    int verify_by_read;         /* Data is read back for verify */
+    unsigned cluster_bytes;     /* Max bytes of one program request, or 0 */
+} plan_cost_t;
+
+void plan_init(plan_t *p, const char *name, unsigned verify_span);
+void plan_free(plan_t *p);
+
+/*
+ * Append an operation. Spans, contiguous with the previous
+ * operation of the same kind, are merged. Verify spans are
+ * also merged over a gap of up to verify_gap bytes.
+ */
+void plan_add(plan_t *p, int op, unsigned addr, unsigned nbytes);
+
+/*
+ * Estimate time of the plan, in milliseconds.
+ */
+unsigned plan_estimate(plan_t *p, plan_cost_t *cost);
+
+/*
+ * Print the list of operations and the estimate.
+ */
+void plan_print(plan_t *p, plan_cost_t *cost);
+
+#endif
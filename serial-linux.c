@@ -0,0 +1,36 @@
+/*
+ * Interface to serial port: arbitrary baud rates on Linux.
+ *
+ * The rate is set by termios2 with BOTHER flag. The layout
+ * of termios2 differs between architectures, so it is taken
+ * from <asm/termbits.h>, which conflicts with <termios.h>:
+ * that is why this code is apart from serial.c.
+ *
+ * Copyright (C) 2015 Serge Vakulenko
+ *
+ * This file is part of PIC32PROG project, which is distributed
+ * under the terms of the GNU General Public License (GPL).
+ * See the accompanying file "COPYING" for more details.
+ */
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+#include "serial.h"
+
+int serial_set_bother(int fd, int baud_rate)
+{
+#if defined(TCGETS2) && defined(BOTHER)
+    struct termios2 tio;
+
+    if (ioctl(fd, TCGETS2, &tio) < 0)
+        return -1;
+    tio.c_cflag &= ~CBAUD;
+    tio.c_cflag |= BOTHER;
+    tio.c_ispeed = baud_rate;
+    tio.c_ospeed = baud_rate;
+    if (ioctl(fd, TCSETS2, &tio) < 0)
+        return -1;
+    return 0;
+#else
+    return -1;
+#endif
+}
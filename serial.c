@@ -14,18 +14,44 @@
 #include <fcntl.h>
 #include <errno.h>
 #include "adapter.h"
+#include "serial.h"
 
 #if defined(__WIN32__) || defined(WIN32)
     #include <windows.h>
     #include <malloc.h>
-    static void *fd = INVALID_HANDLE_VALUE;
-    static DCB saved_mode;
 #else
     #include <termios.h>
-    static int fd = -1;
-    static struct termios saved_mode;
+    #ifdef __linux__
+        #include <sys/ioctl.h>
+        #include <linux/serial.h>
+    #endif
 #endif
 
+#if defined(__linux__) && defined(TCGETS2)
+/*
+ * Linux: arbitrary baud rates are set by termios2,
+ * in serial-linux.c.
+ */
+#define HAVE_TERMIOS2
+#endif
+
+/*
+ * State of the open serial port.
+ */
+struct _serial_t {
+#if defined(__WIN32__) || defined(WIN32)
+    void *fd;
+    DCB saved_mode;
+#else
+    int fd;
+    struct termios saved_mode;
+
+    /* Receive buffer: serves small reads without a system call. */
+    unsigned char rbuf [4096];
+    int rhead, rcount;
+#endif
+};
+
 /*
  * Encode the speed in bits per second into bit value
  * accepted by cfsetspeed() function.
@@ -127,7 +153,9 @@ static int baud_encode(int bps)
     case 4000000: return B4000000;
 #endif
     }
+#ifndef HAVE_TERMIOS2
 printf("Unknown baud\n");
+#endif
     return -1;
 #endif
 }
@@ -139,6 +167,11 @@ printf("Unknown baud\n");
  */
 int serial_speed_valid(int bps)
 {
+#ifdef HAVE_TERMIOS2
+    /* Any rate can be set, the driver selects the nearest one. */
+    if (bps > 0)
+        return 1;
+#endif
     return baud_encode(bps) > 0;
 }
 
@@ -146,16 +179,16 @@ int serial_speed_valid(int bps)
  * Send data to device.
  * Return number of bytes, or -1 on error.
  */
-int serial_write(unsigned char *data, int len)
+int serial_write(serial_t *port, unsigned char *data, int len)
 {
 #if defined(__WIN32__) || defined(WIN32)
     DWORD written;
 
-    if (! WriteFile(fd, data, len, &written, 0))
+    if (! WriteFile(port->fd, data, len, &written, 0))
         return -1;
     return written;
 #else
-    return write(fd, data, len);
+    return write(port->fd, data, len);
 #endif
 }
 
@@ -163,7 +196,7 @@ int serial_write(unsigned char *data, int len)
  * Receive data from device.
  * Return number of bytes, or -1 on error.
  */
-int serial_read(unsigned char *data, int len, int timeout_msec)
+int serial_read(serial_t *port, unsigned char *data, int len, int timeout_msec)
 {
 #if defined(__WIN32__) || defined(WIN32)
     DWORD got;
@@ -176,12 +209,12 @@ int serial_read(unsigned char *data, int len, int timeout_msec)
     ctmo.ReadIntervalTimeout = 0;
     ctmo.ReadTotalTimeoutMultiplier = 0;
     ctmo.ReadTotalTimeoutConstant = timeout_msec;
-    if (! SetCommTimeouts(fd, &ctmo)) {
+    if (! SetCommTimeouts(port->fd, &ctmo)) {
         fprintf(stderr, "Cannot set timeouts in serial_read()\n");
         return -1;
     }
 
-    if (! ReadFile(fd, data, len, &got, 0)) {
+    if (! ReadFile(port->fd, data, len, &got, 0)) {
         fprintf(stderr, "serial_read: read error\n");
         exit(-1);
     }
@@ -190,14 +223,17 @@ int serial_read(unsigned char *data, int len, int timeout_msec)
     long got;
     fd_set rfds;
 
+    if (port->rcount > 0)
+        goto buffered;
+
     timeout.tv_sec = timeout_msec / 1000;
     timeout.tv_usec = timeout_msec % 1000 * 1000;
 again:
     to2 = timeout;
     FD_ZERO(&rfds);
-    FD_SET(fd, &rfds);
+    FD_SET(port->fd, &rfds);
 
-    got = select(fd + 1, &rfds, 0, 0, &to2);
+    got = select(port->fd + 1, &rfds, 0, 0, &to2);
     if (got < 0) {
         if (errno == EINTR || errno == EAGAIN) {
             if (debug_level > 1)
@@ -215,41 +251,105 @@ again:
     }
 
 #if ! defined(__WIN32__) && ! defined(WIN32)
-    got = read(fd, data, (len > 1024) ? 1024 : len);
+    /* Get all available data into the buffer. */
+    got = read(port->fd, port->rbuf, sizeof(port->rbuf));
     if (got < 0) {
         fprintf(stderr, "serial_read: read error\n");
         exit(-1);
     }
+    port->rhead = 0;
+    port->rcount = got;
+buffered:
+    got = (len < port->rcount) ? len : port->rcount;
+    memcpy(data, port->rbuf + port->rhead, got);
+    port->rhead += got;
+    port->rcount -= got;
 #endif
     return got;
 }
 
+#if ! defined(__WIN32__) && ! defined(WIN32)
+/*
+ * Set 8n1 mode and baud rate, discard received data.
+ * Return -1 when the baud rate is not supported.
+ */
+static int set_mode(serial_t *port, int baud_rate)
+{
+    struct termios new_mode;
+    int baud_code = baud_encode(baud_rate);
+    int custom = 0;
+
+#ifdef HAVE_TERMIOS2
+    if (baud_code < 0 && baud_rate > 0) {
+        /* Not a standard rate: set it later by termios2. */
+        baud_code = B38400;
+        custom = 1;
+    }
+#endif
+    if (baud_code < 0)
+        return -1;
+
+    /* 8n1, ignore parity */
+    memset(&new_mode, 0, sizeof(new_mode));
+    new_mode.c_cflag = CS8 | CLOCAL | CREAD;
+    new_mode.c_iflag = IGNBRK;
+    new_mode.c_oflag = 0;
+    new_mode.c_lflag = 0;
+    new_mode.c_cc[VTIME] = 0;
+    new_mode.c_cc[VMIN]  = 1;
+    cfsetispeed(&new_mode, baud_code);
+    cfsetospeed(&new_mode, baud_code);
+    tcflush(port->fd, TCIFLUSH);
+    tcsetattr(port->fd, TCSANOW, &new_mode);
+    port->rcount = 0;
+
+#ifdef HAVE_TERMIOS2
+    if (custom && serial_set_bother(port->fd, baud_rate) < 0)
+        return -1;
+#endif
+
+    /* Clear O_NONBLOCK flag. */
+    int flags = fcntl(port->fd, F_GETFL, 0);
+    if (flags >= 0)
+        fcntl(port->fd, F_SETFL, flags & ~O_NONBLOCK);
+    return 0;
+}
+#endif
+
 /*
  * Close the serial port.
  */
-void serial_close()
+void serial_close(serial_t *port)
 {
+    if (! port)
+        return;
 #if defined(__WIN32__) || defined(WIN32)
-    SetCommState(fd, &saved_mode);
-    CloseHandle(fd);
+    SetCommState(port->fd, &port->saved_mode);
+    CloseHandle(port->fd);
 #else
-    tcsetattr(fd, TCSANOW, &saved_mode);
-    close(fd);
+    tcsetattr(port->fd, TCSANOW, &port->saved_mode);
+    close(port->fd);
 #endif
+    free(port);
 }
 
 /*
  * Open the serial port.
- * Return -1 on error.
+ * Return 0 on error.
  */
-int serial_open(const char *devname, int baud_rate)
+serial_t *serial_open(const char *devname, int baud_rate)
 {
+    serial_t *port;
 #if defined(__WIN32__) || defined(WIN32)
     DCB new_mode;
-#else
-    struct termios new_mode;
 #endif
 
+    port = calloc(1, sizeof(*port));
+    if (! port) {
+        fprintf(stderr, "%s: Out of memory\n", devname);
+        return 0;
+    }
+
 #if defined(__WIN32__) || defined(WIN32)
     /* Check for the Windows device syntax and bend a DOS device
      * into that syntax to allow higher COM numbers than 9
@@ -259,7 +359,7 @@ int serial_open(const char *devname, int baud_rate)
         char *buf = alloca(5 + strlen(devname));
         if (! buf) {
             fprintf(stderr, "%s: Out of memory\n", devname);
-            return -1;
+            goto failed;
         }
         strcpy(buf, "\\\\.\\");
         strcat(buf, devname);
@@ -267,21 +367,21 @@ int serial_open(const char *devname, int baud_rate)
     }
 
     /* Open port */
-    fd = CreateFile(devname, GENERIC_READ | GENERIC_WRITE,
+    port->fd = CreateFile(devname, GENERIC_READ | GENERIC_WRITE,
         0, 0, OPEN_EXISTING, 0, 0);
-    if (fd == INVALID_HANDLE_VALUE) {
+    if (port->fd == INVALID_HANDLE_VALUE) {
         fprintf(stderr, "%s: Cannot open\n", devname);
-        return -1;
+        goto failed;
     }
 
     /* Set serial attributes */
-    memset(&saved_mode, 0, sizeof(saved_mode));
-    if (! GetCommState(fd, &saved_mode)) {
+    if (! GetCommState(port->fd, &port->saved_mode)) {
         fprintf(stderr, "%s: Cannot get state\n", devname);
-        return -1;
+        CloseHandle(port->fd);
+        goto failed;
     }
 
-    new_mode = saved_mode;
+    new_mode = port->saved_mode;
 
     new_mode.fDtrControl = DTR_CONTROL_ENABLE;
     new_mode.BaudRate = baud_rate;
@@ -297,47 +397,42 @@ int serial_open(const char *devname, int baud_rate)
     new_mode.fNull = FALSE;
     new_mode.fAbortOnError = FALSE;
     new_mode.fBinary = TRUE;
-    if (! SetCommState(fd, &new_mode)) {
+    if (! SetCommState(port->fd, &new_mode)) {
         fprintf(stderr, "%s: Cannot set state\n", devname);
-        return -1;
+        CloseHandle(port->fd);
+        goto failed;
     }
 #else
-    /* Encode baud rate. */
-    int baud_code = baud_encode(baud_rate);
-    if (baud_code < 0) {
-        fprintf(stderr, "%s: Bad baud rate %d\n", devname, baud_rate);
-        return -1;
-    }
-
     /* Open port */
-    fd = open(devname, O_RDWR | O_NOCTTY | O_NONBLOCK);
-    if (fd < 0) {
+    port->fd = open(devname, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (port->fd < 0) {
         perror(devname);
-        return -1;
+        goto failed;
     }
 
     /* Set serial attributes */
-    memset(&saved_mode, 0, sizeof(saved_mode));
-    tcgetattr(fd, &saved_mode);
-
-    /* 8n1, ignore parity */
-    memset(&new_mode, 0, sizeof(new_mode));
-    new_mode.c_cflag = CS8 | CLOCAL | CREAD;
-    new_mode.c_iflag = IGNBRK;
-    new_mode.c_oflag = 0;
-    new_mode.c_lflag = 0;
-    new_mode.c_cc[VTIME] = 0;
-    new_mode.c_cc[VMIN]  = 1;
-    cfsetispeed(&new_mode, baud_code);
-    cfsetospeed(&new_mode, baud_code);
-    tcflush(fd, TCIFLUSH);
-    tcsetattr(fd, TCSANOW, &new_mode);
+    tcgetattr(port->fd, &port->saved_mode);
+    if (set_mode(port, baud_rate) < 0) {
+        fprintf(stderr, "%s: Bad baud rate %d\n", devname, baud_rate);
+        close(port->fd);
+        goto failed;
+    }
 
-    /* Clear O_NONBLOCK flag. */
-    int flags = fcntl(fd, F_GETFL, 0);
-    if (flags >= 0)
-        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+#ifdef __linux__
+    /* Ask the driver to deliver received data without delay.
+     * Not all drivers support it. */
+    struct serial_struct ss;
+    if (ioctl(port->fd, TIOCGSERIAL, &ss) == 0) {
+        ss.flags |= ASYNC_LOW_LATENCY;
+        if (ioctl(port->fd, TIOCSSERIAL, &ss) < 0 && debug_level > 0)
+            fprintf(stderr, "%s: low latency mode not supported\n", devname);
+    }
+#endif
 #endif
+    return port;
+
+failed:
+    free(port);
     return 0;
 }
 
@@ -345,16 +440,14 @@ int serial_open(const char *devname, int baud_rate)
  * Change baud rate
  * Return -1 on error.
  */
-int serial_baud(int baud_rate)
+int serial_baud(serial_t *port, int baud_rate)
 {
 #if defined(__WIN32__) || defined(WIN32)
     DCB new_mode;
-#else
-    struct termios new_mode;
 #endif
 
 #if defined(__WIN32__) || defined(WIN32)
-    new_mode = saved_mode;
+    new_mode = port->saved_mode;
 
     new_mode.BaudRate = baud_rate;
     new_mode.ByteSize = 8;
@@ -369,35 +462,15 @@ int serial_baud(int baud_rate)
     new_mode.fNull = FALSE;
     new_mode.fAbortOnError = FALSE;
     new_mode.fBinary = TRUE;
-    if (! SetCommState(fd, &new_mode)) {
+    if (! SetCommState(port->fd, &new_mode)) {
         fprintf(stderr, "Cannot set state\n");
         return -1;
     }
 #else
-    /* Encode baud rate. */
-    int baud_code = baud_encode(baud_rate);
-    if (baud_code < 0) {
+    if (set_mode(port, baud_rate) < 0) {
         fprintf(stderr, "Bad baud rate %d\n", baud_rate);
         return -1;
     }
-
-    /* 8n1, ignore parity */
-    memset(&new_mode, 0, sizeof(new_mode));
-    new_mode.c_cflag = CS8 | CLOCAL | CREAD;
-    new_mode.c_iflag = IGNBRK;
-    new_mode.c_oflag = 0;
-    new_mode.c_lflag = 0;
-    new_mode.c_cc[VTIME] = 0;
-    new_mode.c_cc[VMIN]  = 1;
-    cfsetispeed(&new_mode, baud_code);
-    cfsetospeed(&new_mode, baud_code);
-    tcflush(fd, TCIFLUSH);
-    tcsetattr(fd, TCSANOW, &new_mode);
-
-    /* Clear O_NONBLOCK flag. */
-    int flags = fcntl(fd, F_GETFL, 0);
-    if (flags >= 0)
-        fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
 #endif
     return 0;
 }
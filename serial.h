@@ -11,35 +11,36 @@
 #ifndef _SERIAL_H
 #define _SERIAL_H
 
+typedef struct _serial_t serial_t;
+
 /*
- * Open the serial port with the specified baud rate and
- * receive timeout (in milliseconds).
- * Return -1 on error.
+ * Open the serial port with the specified baud rate.
+ * Return a handle of the port, or 0 on error.
  */
-int serial_open(const char *devname, int baud_rate);
+serial_t *serial_open(const char *devname, int baud_rate);
 
 /*
  * Change the serial baud rate
  * Return -1 on error.
  */
-int serial_baud(int baud_rate);
+int serial_baud(serial_t *port, int baud_rate);
 
 /*
  * Close the serial port.
  */
-void serial_close(void);
+void serial_close(serial_t *port);
 
 /*
  * Send data to device.
  * Return number of bytes, or -1 on error.
  */
-int serial_write(unsigned char *data, int len);
+int serial_write(serial_t *port, unsigned char *data, int len);
 
 /*
- * Receive data from device.
+ * Receive data from device, waiting up to timeout_msec.
  * Return number of bytes, or -1 on error.
  */
-int serial_read(unsigned char *data, int len, int timeout_msec);
+int serial_read(serial_t *port, unsigned char *data, int len, int timeout_msec);
 
 /*
  * Check whether the given speed in bits per second
@@ -48,4 +49,10 @@ int serial_read(unsigned char *data, int len, int timeout_msec);
  */
 int serial_speed_valid(int bps);
 
+/*
+ * Linux: set arbitrary baud rate of the open file descriptor.
+ * Return -1 on error.
+ */
+int serial_set_bother(int fd, int baud_rate);
+
 #endif
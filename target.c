@@ -15,11 +15,23 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdint.h>
+#include <sys/time.h>
+
+#ifdef USE_MPSSE
+#if defined(__FreeBSD__) || defined(__DragonFly__)
+#   include <libusb.h>
+#else
+#   include <libusb-1.0/libusb.h>
+#endif
+#else
+#   include "hidapi.h"
+#endif
 
 #include "target.h"
 #include "adapter.h"
 #include "localize.h"
 #include "pic32.h"
+#include "pefile.h"
 
 extern print_func_t print_mx1;
 extern print_func_t print_mx3;
@@ -29,284 +41,116 @@ extern print_func_t print_mk;
 
 /*
  * PIC32 families.
+ * Row write and page erase times are typical ones. For MZ, they are
+ * taken from the datasheet in FRC cycles at 8 MHz: 66451 per row
+ * and 132179 per page. MK has the same flash controller with 512-byte
+ * rows. MX and MM families have 2 msec per row and 20 msec per page.
+ *
+ * Every PE has PROGRAM_CLUSTER, PAGE_ERASE, BLANK_CHECK and GET_CRC,
+ * see PE_CAPS_COMMON. The table gives only the command to write
+ * a flash word: PROGRAM on MX, DOUBLE_WORD_PGRM on MM and
+ * QUAD_WORD_PGRM on MZ and MK, as in the flash programming
+ * specifications of these families.
  */
-                    /*-Boot-Devcfg--Row---Print------Code--------Nwords-Version-*/
+#define PE_CAPS_COMMON  (PE_CAP_CLUSTER | PE_CAP_PAGE_ERASE | PE_CAP_BLANK_CHECK | PE_CAP_CRC)
+
+                    /*-Boot-Devcfg--Row---Print------Code--------Nwords-Version-Erase-*/
+                    /*-Page---PE-word-write---------Row-usec-Page-erase-*/
+                    /*-PE-address-Least-RAM-kbytes-*/
 static const
-family_t family_mm_gpl  = { "mm_gpl", FAMILY_MM, 
-                        4, 0x1700,  256, print_mm,  pic32_pemm_gpl,  555, 0x0510 };
+family_t family_mm_gpl  = { "mm_gpl", FAMILY_MM,
+                        4, 0x1700,  256, print_mm,  pic32_pemm_gpl,  555, 0x0510, 20,
+                        2048, PE_CAP_DOUBLE_WORD,   2000, 20,
+                        0x0300, 4 };
 static const
-family_t family_mm_gpm  = { "mm_gpm", FAMILY_MM, 
-                        4, 0x1700,  256, print_mm,  pic32_pemm_gpm,  555, 0x0510 };
+family_t family_mm_gpm  = { "mm_gpm", FAMILY_MM,
+                        4, 0x1700,  256, print_mm,  pic32_pemm_gpm,  555, 0x0510, 20,
+                        2048, PE_CAP_DOUBLE_WORD,   2000, 20,
+                        0x0300, 4 };
 
 static const
 family_t family_mx1 = { "mx1", FAMILY_MX1,
-                        3,  0x0bf0, 128,  print_mx1, pic32_pemx1, 422,  0x0301 };
+                        3,  0x0bf0, 128,  print_mx1, pic32_pemx1, 422,  0x0301, 20,
+                        1024, PE_CAP_WORD,          2000, 20,
+                        0x0900, 4 };
 static const
 family_t family_mx3 = { "mx3", FAMILY_MX3,
-                        12, 0x2ff0, 512,  print_mx3, pic32_pemx3, 1044, 0x0201 };
+                        12, 0x2ff0, 512,  print_mx3, pic32_pemx3, 1044, 0x0201, 80,
+                        4096, PE_CAP_WORD,          2000, 20,
+                        0x0900, 8 };
 static const
 family_t family_mz  = { "mz", FAMILY_MZ,
-                        80, 0xffc0, 2048, print_mz,  pic32_pemz,  1052, 0x0502 };
+                        80, 0xffc0, 2048, print_mz,  pic32_pemz,  1052, 0x0502, 200,
+                        16384, PE_CAP_QUAD_WORD,    8300, 17,
+                        0x0900, 128 };
 
 // Adding MK family support. Please hang on.
 //Name, FAMILY_NAME
 // Boot flash kB, offset of DevCFG from start of BootFlash, Bytes per row, etc.
 static const
 family_t family_mk  = { "mk", FAMILY_MK,
-                        16, 0x3fc0, 512, print_mk,  pic32_pemk,  804, 0x0506 };
+                        16, 0x3fc0, 512, print_mk,  pic32_pemk,  804, 0x0506, 200,
+                        4096, PE_CAP_QUAD_WORD,     2100, 17,
+                        0x0900, 256 };
 /*
  * This one is a special one for the bootloader. We have no idea what we're
- * programming, so set the values to the maximum out of all the others.
+ * programming: the bootloader itself gives the memory layout.
  * We don't really care at the end of the day.
  */
 static const
-family_t family_bl  = { "bootloader",
-                        80, 0,      1024, 0,         0,           0,    0      };
-
-/*
- * Table of PIC32 chip variants.
- * This list can be extended at run time from pic32prog.conf file.
- */
-#define TABSZ   1000
-
-static variant_t pic32_tab[TABSZ] = {
-
-    /* MX1/2 family-------------Flash---Family */
-    {0x4A07053, "MX110F016B",     16,   &family_mx1},
-    {0x4A09053, "MX110F016C",     16,   &family_mx1},
-    {0x4A0B053, "MX110F016D",     16,   &family_mx1},
-    {0x4A06053, "MX120F032B",     32,   &family_mx1},
-    {0x4A08053, "MX120F032C",     32,   &family_mx1},
-    {0x4A0A053, "MX120F032D",     32,   &family_mx1},
-    {0x6A50053, "MX120F064H",     64,   &family_mx1},
-    {0x4D07053, "MX130F064B",     64,   &family_mx1},
-    {0x4D09053, "MX130F064C",     64,   &family_mx1},
-    {0x4D0B053, "MX130F064D",     64,   &family_mx1},
-    {0x6A00053, "MX130F128H",    128,   &family_mx1},
-    {0x6A01053, "MX130F128L",    128,   &family_mx1},
-    {0x4D06053, "MX150F128B",    128,   &family_mx1},
-    {0x4D08053, "MX150F128C",    128,   &family_mx1},
-    {0x4D0A053, "MX150F128D",    128,   &family_mx1},
-    {0x6A10053, "MX150F256H",    256,   &family_mx1},
-    {0x6A11053, "MX150F256L",    256,   &family_mx1},
-    {0x6610053, "MX170F256B",    256,   &family_mx1},
-    {0x661A053, "MX170F256D",    256,   &family_mx1},
-    {0x6A30053, "MX170F512H",    512,   &family_mx1},
-    {0x6A31053, "MX170F512L",    512,   &family_mx1},
-    {0x4A01053, "MX210F016B",     16,   &family_mx1},
-    {0x4A03053, "MX210F016C",     16,   &family_mx1},
-    {0x4A05053, "MX210F016D",     16,   &family_mx1},
-    {0x4A00053, "MX220F032B",     32,   &family_mx1},
-    {0x4A02053, "MX220F032C",     32,   &family_mx1},
-    {0x4A04053, "MX220F032D",     32,   &family_mx1},
-    {0x4D01053, "MX230F064B",     64,   &family_mx1},
-    {0x4D03053, "MX230F064C",     64,   &family_mx1},
-    {0x4D05053, "MX230F064D",     64,   &family_mx1},
-    {0x6A02053, "MX230F128H",    128,   &family_mx1},
-    {0x6A03053, "MX230F128L",    128,   &family_mx1},
-    {0x4D00053, "MX250F128B",    128,   &family_mx1},
-    {0x4D02053, "MX250F128C",    128,   &family_mx1},
-    {0x4D04053, "MX250F128D",    128,   &family_mx1},
-    {0x6A12053, "MX250F256H",    256,   &family_mx1},
-    {0x6A13053, "MX250F256L",    256,   &family_mx1},
-    {0x6600053, "MX270F256B",    256,   &family_mx1},
-    {0x660A053, "MX270F256D",    256,   &family_mx1},
-    {0x6A32053, "MX270F512H",    512,   &family_mx1},
-    {0x6A33053, "MX270F512L",    512,   &family_mx1},
-    {0x6A04053, "MX530F128H",    128,   &family_mx1},
-    {0x6A05053, "MX530F128L",    128,   &family_mx1},
-    {0x6A14053, "MX550F256H",    256,   &family_mx1},
-    {0x6A15053, "MX550F256L",    256,   &family_mx1},
-    {0x6A34053, "MX570F512H",    512,   &family_mx1},
-    {0x6A35053, "MX570F512L",    512,   &family_mx1},
-
-    /* MX3/4/5/6/7 family-------Flash---Family */
-    {0x0902053, "MX320F032H",     32,   &family_mx3},
-    {0x0906053, "MX320F064H",     64,   &family_mx3},
-    {0x090A053, "MX320F128H",    128,   &family_mx3},
-    {0x092A053, "MX320F128L",    128,   &family_mx3},
-    {0x5600053, "MX330F064H",     64,   &family_mx3},
-    {0x5601053, "MX330F064L",     64,   &family_mx3},
-    {0x090D053, "MX340F128H",    128,   &family_mx3},
-    {0x092D053, "MX340F128L",    128,   &family_mx3},
-    {0x0912053, "MX340F256H",    256,   &family_mx3},
-    {0x0916053, "MX340F512H",    512,   &family_mx3},
-    {0x570C053, "MX350F128H",    128,   &family_mx3},
-    {0x570D053, "MX350F128L",    128,   &family_mx3},
-    {0x5704053, "MX350F256H",    256,   &family_mx3},
-    {0x5705053, "MX350F256L",    256,   &family_mx3},
-    {0x0934053, "MX360F256L",    256,   &family_mx3},
-    {0x0938053, "MX360F512L",    512,   &family_mx3},
-    {0x5808053, "MX370F512H",    512,   &family_mx3},
-    {0x5809053, "MX370F512L",    512,   &family_mx3},
-    {0x0942053, "MX420F032H",     32,   &family_mx3},
-    {0x5602053, "MX430F064H",     64,   &family_mx3},
-    {0x5603053, "MX430F064L",     64,   &family_mx3},
-    {0x094D053, "MX440F128H",    128,   &family_mx3},
-    {0x096D053, "MX440F128L",    128,   &family_mx3},
-    {0x0952053, "MX440F256H",    256,   &family_mx3},
-    {0x0956053, "MX440F512H",    512,   &family_mx3},
-    {0x570E053, "MX450F128H",    128,   &family_mx3},
-    {0x570F053, "MX450F128L",    128,   &family_mx3},
-    {0x5706053, "MX450F256H",    256,   &family_mx3},
-    {0x5707053, "MX450F256L",    256,   &family_mx3},
-    {0x0974053, "MX460F256L",    256,   &family_mx3},
-    {0x0978053, "MX460F512L",    512,   &family_mx3},
-    {0x580A053, "MX470F512H",    512,   &family_mx3},
-    {0x580B053, "MX470F512L",    512,   &family_mx3},
-    {0x4400053, "MX534F064H",     64,   &family_mx3},
-    {0x440C053, "MX534F064L",     64,   &family_mx3},
-    {0x4401053, "MX564F064H",     64,   &family_mx3},
-    {0x440D053, "MX564F064L",     64,   &family_mx3},
-    {0x4403053, "MX564F128H",    128,   &family_mx3},
-    {0x440F053, "MX564F128L",    128,   &family_mx3},
-    {0x4317053, "MX575F256H",    256,   &family_mx3},
-    {0x4333053, "MX575F256L",    256,   &family_mx3},
-    {0x4309053, "MX575F512H",    512,   &family_mx3},
-    {0x430F053, "MX575F512L",    512,   &family_mx3},
-    {0x4405053, "MX664F064H",     64,   &family_mx3},
-    {0x4411053, "MX664F064L",     64,   &family_mx3},
-    {0x4407053, "MX664F128H",    128,   &family_mx3},
-    {0x4413053, "MX664F128L",    128,   &family_mx3},
-    {0x430B053, "MX675F256H",    256,   &family_mx3},
-    {0x4305053, "MX675F256L",    256,   &family_mx3},
-    {0x430C053, "MX675F512H",    512,   &family_mx3},
-    {0x4311053, "MX675F512L",    512,   &family_mx3},
-    {0x4325053, "MX695F512H",    512,   &family_mx3},
-    {0x4341053, "MX695F512L",    512,   &family_mx3},
-    {0x440B053, "MX764F128H",    128,   &family_mx3},
-    {0x4417053, "MX764F128L",    128,   &family_mx3},
-    {0x4303053, "MX775F256H",    256,   &family_mx3},
-    {0x4312053, "MX775F256L",    256,   &family_mx3},
-    {0x430D053, "MX775F512H",    512,   &family_mx3},
-    {0x4306053, "MX775F512L",    512,   &family_mx3},
-    {0x430E053, "MX795F512H",    512,   &family_mx3},
-    {0x4307053, "MX795F512L",    512,   &family_mx3},
-
-    /* MZ family----------------Flash---Family */
-    {0x5100053, "MZ0256ECE064",  256,   &family_mz},
-    {0x510A053, "MZ0256ECE100",  256,   &family_mz},
-    {0x5114053, "MZ0256ECE124",  256,   &family_mz},
-    {0x511E053, "MZ0256ECE144",  256,   &family_mz},
-    {0x5105053, "MZ0256ECF064",  256,   &family_mz},
-    {0x510F053, "MZ0256ECF100",  256,   &family_mz},
-    {0x5119053, "MZ0256ECF124",  256,   &family_mz},
-    {0x5123053, "MZ0256ECF144",  256,   &family_mz},
-    {0x5101053, "MZ0512ECE064",  512,   &family_mz},
-    {0x510B053, "MZ0512ECE100",  512,   &family_mz},
-    {0x5115053, "MZ0512ECE124",  512,   &family_mz},
-    {0x511F053, "MZ0512ECE144",  512,   &family_mz},
-    {0x5106053, "MZ0512ECF064",  512,   &family_mz},
-    {0x5110053, "MZ0512ECF100",  512,   &family_mz},
-    {0x511A053, "MZ0512ECF124",  512,   &family_mz},
-    {0x5124053, "MZ0512ECF144",  512,   &family_mz},
-    {0x5102053, "MZ1024ECE064", 1024,   &family_mz},
-    {0x510C053, "MZ1024ECE100", 1024,   &family_mz},
-    {0x5116053, "MZ1024ECE124", 1024,   &family_mz},
-    {0x5120053, "MZ1024ECE144", 1024,   &family_mz},
-    {0x5107053, "MZ1024ECF064", 1024,   &family_mz},
-    {0x5111053, "MZ1024ECF100", 1024,   &family_mz},
-    {0x511B053, "MZ1024ECF124", 1024,   &family_mz},
-    {0x5125053, "MZ1024ECF144", 1024,   &family_mz},
-    {0x5103053, "MZ1024ECG064", 1024,   &family_mz},
-    {0x510D053, "MZ1024ECG100", 1024,   &family_mz},
-    {0x5117053, "MZ1024ECG124", 1024,   &family_mz},
-    {0x5121053, "MZ1024ECG144", 1024,   &family_mz},
-    {0x5108053, "MZ1024ECH064", 1024,   &family_mz},
-    {0x5112053, "MZ1024ECH100", 1024,   &family_mz},
-    {0x511C053, "MZ1024ECH124", 1024,   &family_mz},
-    {0x5126053, "MZ1024ECH144", 1024,   &family_mz},
-    {0x5130053, "MZ1024ECM064", 1024,   &family_mz},
-    {0x513A053, "MZ1024ECM100", 1024,   &family_mz},
-    {0x5144053, "MZ1024ECM124", 1024,   &family_mz},
-    {0x514E053, "MZ1024ECM144", 1024,   &family_mz},
-    {0x5104053, "MZ2048ECG064", 2048,   &family_mz},
-    {0x510E053, "MZ2048ECG100", 2048,   &family_mz},
-    {0x5118053, "MZ2048ECG124", 2048,   &family_mz},
-    {0x5122053, "MZ2048ECG144", 2048,   &family_mz},
-    {0x5109053, "MZ2048ECH064", 2048,   &family_mz},
-    {0x5113053, "MZ2048ECH100", 2048,   &family_mz},
-    {0x511D053, "MZ2048ECH124", 2048,   &family_mz},
-    {0x5127053, "MZ2048ECH144", 2048,   &family_mz},
-    {0x5131053, "MZ2048ECM064", 2048,   &family_mz},
-    {0x513B053, "MZ2048ECM100", 2048,   &family_mz},
-    {0x5145053, "MZ2048ECM124", 2048,   &family_mz},
-    {0x514F053, "MZ2048ECM144", 2048,   &family_mz},
-
-    /* MZ family with FPU-------Flash---Family */
-    {0x7201053, "MZ0512EFE064",  512,   &family_mz},
-    {0x7206053, "MZ0512EFF064",  512,   &family_mz},
-    {0x722E053, "MZ0512EFK064",  512,   &family_mz},
-    {0x7202053, "MZ1024EFE064", 1024,   &family_mz},
-    {0x7207053, "MZ1024EFF064", 1024,   &family_mz},
-    {0x722F053, "MZ1024EFK064", 1024,   &family_mz},
-    {0x7203053, "MZ1024EFG064", 1024,   &family_mz},
-    {0x7208053, "MZ1024EFH064", 1024,   &family_mz},
-    {0x7230053, "MZ1024EFM064", 1024,   &family_mz},
-    {0x7204053, "MZ2048EFG064", 2048,   &family_mz},
-    {0x7209053, "MZ2048EFH064", 2048,   &family_mz},
-    {0x7231053, "MZ2048EFM064", 2048,   &family_mz},
-
-    {0x720B053, "MZ0512EFE100",  512,   &family_mz},
-    {0x7210053, "MZ0512EFF100",  512,   &family_mz},
-    {0x7238053, "MZ0512EFK100",  512,   &family_mz},
-    {0x720C053, "MZ1024EFE100", 1024,   &family_mz},
-    {0x7211053, "MZ1024EFF100", 1024,   &family_mz},
-    {0x7239053, "MZ1024EFK100", 1024,   &family_mz},
-    {0x720D053, "MZ1024EFG100", 1024,   &family_mz},
-    {0x7212053, "MZ1024EFH100", 1024,   &family_mz},
-    {0x723A053, "MZ1024EFM100", 1024,   &family_mz},
-    {0x720E053, "MZ2048EFG100", 2048,   &family_mz},
-    {0x7213053, "MZ2048EFH100", 2048,   &family_mz},
-    {0x723B053, "MZ2048EFM100", 2048,   &family_mz},
-
-    {0x7215053, "MZ0512EFE124",  512,   &family_mz},
-    {0x721A053, "MZ0512EFF124",  512,   &family_mz},
-    {0x7242053, "MZ0512EFK124",  512,   &family_mz},
-    {0x7216053, "MZ1024EFE124", 1024,   &family_mz},
-    {0x721B053, "MZ1024EFF124", 1024,   &family_mz},
-    {0x7243053, "MZ1024EFK124", 1024,   &family_mz},
-    {0x7217053, "MZ1024EFG124", 1024,   &family_mz},
-    {0x721C053, "MZ1024EFH124", 1024,   &family_mz},
-    {0x7244053, "MZ1024EFM124", 1024,   &family_mz},
-    {0x7218053, "MZ2048EFG124", 2048,   &family_mz},
-    {0x721D053, "MZ2048EFH124", 2048,   &family_mz},
-    {0x7245053, "MZ2048EFM124", 2048,   &family_mz},
-
-    {0x721F053, "MZ0512EFE144",  512,   &family_mz},
-    {0x7224053, "MZ0512EFF144",  512,   &family_mz},
-    {0x724C053, "MZ0512EFK144",  512,   &family_mz},
-    {0x7220053, "MZ1024EFE144", 1024,   &family_mz},
-    {0x7225053, "MZ1024EFF144", 1024,   &family_mz},
-    {0x724D053, "MZ1024EFK144", 1024,   &family_mz},
-    {0x7221053, "MZ1024EFG144", 1024,   &family_mz},
-    {0x7226053, "MZ1024EFH144", 1024,   &family_mz},
-    {0x724E053, "MZ1024EFM144", 1024,   &family_mz},
-    {0x7222053, "MZ2048EFG144", 2048,   &family_mz},
-    {0x7227053, "MZ2048EFH144", 2048,   &family_mz},
-    {0x724F053, "MZ2048EFM144", 2048,   &family_mz},
-
-    /* MZ DA family */
-    {0x5f4f053, "MZ2048XXXXXX", 2048,   &family_mz},
-    {0x5fb7053, "MZ2048XXXXXX", 2048,   &family_mz},
-
-    /* MM GPL family */
-    {0x6b12053, "MM0064GPL028",  64,   &family_mm_gpl},
-    {0x6b16053, "MM0064GPL036",  64,   &family_mm_gpl},
-    {0x6b04053, "MM0016GPL028",  16,   &family_mm_gpl},
-
-    /* MM GPL family */
-    {0x771e053, "MM0256GPM064", 256,   &family_mm_gpm},
-
-
-    /* MK family */
-    {0x6201053, "MK1024MCF100",  1024,   &family_mk},
-
-
-    /* USB bootloader */
-    {0xEAFB00B, "Bootloader",   0,      &family_bl},
-    {0}
-};
+family_t family_bl  = { "bootloader", FAMILY_BL,
+                        0,  1024,   0,    0,         0,           0,    0,      0,
+                        0,    0,                    2000, 20,
+                        0, 0 };
+
+/*
+ * Table of PIC32 chip variants: generated from pic32prog.conf
+ * at build time, and indexed by a perfect hash of DEVID.
+ */
+#include "pic32tab.inc"
+
+/*
+ * Variants added at run time from pic32prog.conf file.
+ * The file is parsed only when DEVID is not found in pic32_tab[].
+ */
+static variant_t *conf_tab;
+static unsigned conf_count;
+
+/*
+ * Hash function for DEVID lookup.
+ * Must match pic32_hash() in conf-to-c.py script.
+ */
+static unsigned pic32_hash(unsigned id, unsigned seed)
+{
+    unsigned h = id ^ seed;
+
+    h = (h ^ (h >> 16)) * 0x85ebca6b;
+    h = (h ^ (h >> 13)) * 0xc2b2ae35;
+    return h ^ (h >> 16);
+}
+
+/*
+ * Find a chip variant by DEVID, ignoring the revision bits.
+ * Return 0 when not found.
+ */
+static const variant_t *find_variant(unsigned devid)
+{
+    const variant_t *v;
+    unsigned i, seed;
+
+    devid &= 0x0fffffff;
+    seed = pic32_seed[pic32_hash(devid, 0) % PIC32_NBUCKETS];
+    if (seed != 0) {
+        v = &pic32_tab[pic32_hash(devid, seed) % PIC32_TABSZ];
+        if (v->devid == devid)
+            return v;
+    }
+    for (i=0; i<conf_count; i++) {
+        if (((conf_tab[i].devid ^ devid) & 0x0fffffff) == 0)
+            return &conf_tab[i];
+    }
+    return 0;
+}
 
 /*
  * Table of supported serial protocols.
@@ -347,6 +191,14 @@ void mdelay(unsigned msec)
     Sleep(msec);
 }
 
+/*
+ * Current time in milliseconds: Windows.
+ */
+static unsigned mtime()
+{
+    return GetTickCount();
+}
+
 int __ms_vsnprintf(char *str, size_t size, const char *format, va_list ap)
 {
     // Needed to link the libusb-win32/libusb-1.0.a library.
@@ -360,8 +212,317 @@ void mdelay(unsigned msec)
 {
     usleep(msec * 1000);
 }
+
+/*
+ * Current time in milliseconds: Unix.
+ */
+static unsigned mtime()
+{
+    struct timeval t;
+
+    gettimeofday(&t, 0);
+    return t.tv_sec * 1000 + t.tv_usec / 1000;
+}
 #endif
 
+/*
+ * Statistics of waits, by name.
+ */
+static struct {
+    const char *name;
+    unsigned count;
+    unsigned timeouts;
+    unsigned total_msec;
+    unsigned max_msec;
+} wait_stat [16];
+
+/*
+ * Record a wait in the statistics.
+ */
+static void mwait_record(const char *name, unsigned elapsed, int timeout)
+{
+    unsigned i;
+
+    for (i=0; i<sizeof(wait_stat)/sizeof(wait_stat[0]); i++) {
+        if (wait_stat[i].name == 0)
+            wait_stat[i].name = name;
+        if (strcmp(wait_stat[i].name, name) == 0) {
+            wait_stat[i].count++;
+            if (timeout)
+                wait_stat[i].timeouts++;
+            wait_stat[i].total_msec += elapsed;
+            if (elapsed > wait_stat[i].max_msec)
+                wait_stat[i].max_msec = elapsed;
+            break;
+        }
+    }
+}
+
+/*
+ * Wait until ready() returns nonzero.
+ * The first poll is made after first_msec, when the operation
+ * has surely started; then the interval doubles,
+ * up to a quarter of the expected time: so a wait never overshoots
+ * the real completion by more than 25%.
+ * Give up after 20 times the expected time, but not sooner than 1 second.
+ * Return the time of wait in msec, or -1 on timeout.
+ */
+int mwait(const char *name, int (*ready)(void *arg), void *arg,
+    unsigned first_msec, unsigned expected_msec)
+{
+    unsigned start = mtime(), elapsed, interval = 1;
+    unsigned max_interval = expected_msec / 4;
+    unsigned timeout = expected_msec * 20;
+
+    if (max_interval < 1)
+        max_interval = 1;
+    if (timeout < 1000)
+        timeout = 1000;
+    if (first_msec > 0)
+        mdelay(first_msec);
+    for (;;) {
+        if (ready(arg))
+            break;
+        elapsed = mtime() - start;
+        if (elapsed > timeout) {
+            if (debug_level > 0)
+                fprintf(stderr, "%s: timeout after %u msec\n", name, timeout);
+            mwait_record(name, elapsed, 1);
+            return -1;
+        }
+        mdelay(interval);
+        interval *= 2;
+        if (interval > max_interval)
+            interval = max_interval;
+    }
+    elapsed = mtime() - start;
+    mwait_record(name, elapsed, 0);
+    return elapsed;
+}
+
+/*
+ * Print statistics of waits.
+ */
+void mwait_stats()
+{
+    unsigned i;
+
+    for (i=0; i<sizeof(wait_stat)/sizeof(wait_stat[0]) && wait_stat[i].name; i++) {
+        fprintf(stderr, "Wait %s: %u times, %u timeouts, total %u msec, max %u msec\n",
+            wait_stat[i].name, wait_stat[i].count, wait_stat[i].timeouts,
+            wait_stat[i].total_msec, wait_stat[i].max_msec);
+    }
+}
+
+/*
+ * Table of USB adapters for autodetection, in order of preference.
+ */
+#define AUTO_ICSP   0   /* Debug probe, ICSP only */
+#define AUTO_MPSSE  1   /* FTDI-based probe, JTAG or ICSP */
+#define AUTO_BOOT   2   /* Bootloader, no interface selection */
+
+typedef struct {
+    unsigned short vid, pid;
+    const char *name;
+    adapter_t *(*func)(int vid, int pid, const char *serial);
+    int kind;
+} autodetect_t;
+
+static const autodetect_t autodetect_probe[] = {
+    { 0x04d8, 0x0033, "PICkit2",    adapter_open_pickit2,   AUTO_ICSP  },
+    { 0x04d8, 0x900a, "PICkit3",    adapter_open_pickit3,   AUTO_ICSP  },
+    { 0x04d8, 0x8108, "PICkit3",    adapter_open_pickit3,   AUTO_ICSP  },  /* chipKIT */
+    { 0x04d8, 0x8107, "PICkit3",    adapter_open_pickit3,   AUTO_ICSP  },  /* Onboard */
+    { 0 },
+};
+
+static const autodetect_t autodetect_boot[] = {
+    { 0x04d8, 0x003c, "hidboot",    adapter_open_hidboot,   AUTO_BOOT  },
+    { 0x04d8, 0xfa8d, "hidboot",    adapter_open_hidboot,   AUTO_BOOT  },  /* Maximite */
+    { 0x15ba, 0x0032, "hidboot",    adapter_open_hidboot,   AUTO_BOOT  },  /* Duinomite */
+    { 0x04d8, 0x003c, "an1388",     adapter_open_an1388,    AUTO_BOOT  },
+    { 0x1234, 0x0001, "uhb",        adapter_open_uhb,       AUTO_BOOT  },
+    { 0 },
+};
+
+/*
+ * All entries: debug probes, then MPSSE adapters, then bootloaders.
+ * MPSSE entries are taken from the device list of the adapter.
+ */
+static autodetect_t autodetect_tab [32];
+
+static void autodetect_init()
+{
+    int n = 0, i;
+#ifdef USE_MPSSE
+    unsigned short vid, pid;
+    int k;
+#endif
+
+    if (autodetect_tab[0].vid)
+        return;
+    for (i=0; autodetect_probe[i].vid; i++)
+        autodetect_tab[n++] = autodetect_probe[i];
+#ifdef USE_MPSSE
+    for (i=0; adapter_mpsse_id(i, &vid, &pid); i++) {
+        /* Several adapters share the same ids. */
+        for (k=0; k<n; k++) {
+            if (autodetect_tab[k].vid == vid && autodetect_tab[k].pid == pid)
+                break;
+        }
+        if (k < n)
+            continue;
+        if (n >= (int) (sizeof(autodetect_tab)/sizeof(autodetect_tab[0]) -
+                        sizeof(autodetect_boot)/sizeof(autodetect_boot[0]))) {
+            /* Keep room for bootloaders and the terminator. */
+            fprintf(stderr, "Too many adapters to autodetect\n");
+            break;
+        }
+        autodetect_tab[n].vid = vid;
+        autodetect_tab[n].pid = pid;
+        autodetect_tab[n].name = "MPSSE";
+        autodetect_tab[n].func = 0;
+        autodetect_tab[n].kind = AUTO_MPSSE;
+        n++;
+    }
+#endif
+    for (i=0; autodetect_boot[i].vid; i++)
+        autodetect_tab[n++] = autodetect_boot[i];
+}
+
+/*
+ * USB adapter, found by enumeration.
+ */
+typedef struct {
+    unsigned short  vid;
+    unsigned short  pid;
+    const char      *name;          /* Adapter type */
+    int             entry;          /* Index in autodetect table */
+} usb_match_t;
+
+/*
+ * Enumerate the USB bus in a single pass, and find all known adapters.
+ * Matches are sorted in order of preference from autodetect_tab[].
+ * When a device matches several table entries (like hidboot/an1388),
+ * only the first entry is returned.
+ * Return the number of matches.
+ */
+static int find_usb_adapters(usb_match_t *list, int maxcount)
+{
+    struct {
+        unsigned short vid, pid;
+        int matched;
+    } *dev;
+    int ndev = 0, count = 0, i, k;
+#ifdef USE_MPSSE
+    libusb_context *context = 0;
+    libusb_device **devs;
+    ssize_t n;
+
+    if (libusb_init(&context) != 0)
+        return 0;
+    n = libusb_get_device_list(context, &devs);
+    if (n < 0) {
+        libusb_exit(context);
+        return 0;
+    }
+    dev = calloc(n + 1, sizeof(*dev));
+    if (! dev) {
+        fprintf(stderr, _("Out of memory\n"));
+        exit(-1);
+    }
+    for (i=0; i<n; i++) {
+        struct libusb_device_descriptor desc;
+
+        if (libusb_get_device_descriptor(devs[i], &desc) == 0) {
+            dev[i].vid = desc.idVendor;
+            dev[i].pid = desc.idProduct;
+        }
+    }
+    ndev = n;
+#else
+    struct hid_device_info *devs, *d;
+
+    devs = hid_enumerate(0, 0);
+    for (d=devs; d; d=d->next)
+        ndev++;
+    dev = calloc(ndev + 1, sizeof(*dev));
+    if (! dev) {
+        fprintf(stderr, _("Out of memory\n"));
+        exit(-1);
+    }
+    for (i=0, d=devs; d; i++, d=d->next) {
+        dev[i].vid = d->vendor_id;
+        dev[i].pid = d->product_id;
+    }
+#endif
+    autodetect_init();
+    for (k=0; autodetect_tab[k].vid && count < maxcount; k++) {
+        for (i=0; i<ndev && count < maxcount; i++) {
+            if (dev[i].matched ||
+                dev[i].vid != autodetect_tab[k].vid ||
+                dev[i].pid != autodetect_tab[k].pid)
+                continue;
+
+            dev[i].matched = 1;
+            list[count].vid = dev[i].vid;
+            list[count].pid = dev[i].pid;
+            list[count].name = autodetect_tab[k].name;
+            list[count].entry = k;
+            count++;
+        }
+    }
+    free(dev);
+#ifdef USE_MPSSE
+    libusb_free_device_list(devs, 1);
+    libusb_exit(context);
+#else
+    hid_free_enumeration(devs);
+#endif
+    return count;
+}
+
+/*
+ * Open USB adapter, found by enumeration.
+ * When the opener fails, try other table entries with the same VID:PID.
+ * Return a pointer to adapter structure, or 0 on failure.
+ */
+static adapter_t *open_usb_match(const usb_match_t *m, int interface, int speed)
+{
+    adapter_t *a = 0;
+    int k;
+
+    for (k=m->entry; autodetect_tab[k].vid; k++) {
+        if (autodetect_tab[k].vid != m->vid ||
+            autodetect_tab[k].pid != m->pid)
+            continue;
+
+        switch (autodetect_tab[k].kind) {
+        case AUTO_ICSP:
+            if (interface == INTERFACE_JTAG) {
+                fprintf(stderr, "Found %s, but it does not support the JTAG interface\n",
+                    autodetect_tab[k].name);
+                return 0;
+            }
+            a = autodetect_tab[k].func(m->vid, m->pid, 0);
+            break;
+#ifdef USE_MPSSE
+        case AUTO_MPSSE:
+            a = adapter_open_mpsse(m->vid, m->pid, 0, interface, speed);
+            break;
+#endif
+        case AUTO_BOOT:
+            a = autodetect_tab[k].func(m->vid, m->pid, 0);
+            if (a && interface != INTERFACE_DEFAULT)
+                fprintf(stderr, "Found bootloader, ignoring specified interface\n");
+            break;
+        }
+        if (a)
+            break;
+    }
+    return a;
+}
+
 /*
  * Open USB adapter, detected by vendor/product ID.
  * Return a pointer to adapter structure, or 0 when not found.
@@ -374,40 +535,13 @@ static adapter_t *open_usb_adapter(const char *port_name, int interface, int spe
 
     if (!port_name) {
         /* Autodetect the device from a list of known adapters. */
-        adapter_t *a = adapter_open_pickit2(0, 0, 0);
-		if(a && (INTERFACE_JTAG == interface)){
-			fprintf(stderr, "Found Pickit2, but it does not support the JTAG interface\n");
-			return 0;
-		}
-        if (! a){
-            a = adapter_open_pickit3(0, 0, 0);
-			if(a && (INTERFACE_JTAG == interface)){
-				fprintf(stderr, "Found Pickit3, but it does not support the JTAG interface\n");
-				return 0;
-			}
-		}
-#ifdef USE_MPSSE
-        if (! a)
-            a = adapter_open_mpsse(0, 0, 0, interface, speed);
-#endif
-        if (! a){
-            a = adapter_open_hidboot(0, 0, 0);
-			if(a && (INTERFACE_DEFAULT != interface)){
-				fprintf(stderr, "Found bootloader, ignoring specified interface\n");
-			}
-		}
-        if (! a){
-            a = adapter_open_an1388(0, 0, 0);
-			if(a && (INTERFACE_DEFAULT != interface)){
-				fprintf(stderr, "Found bootloader, ignoring specified interface\n");
-			}
-		}
-        if (! a){
-            a = adapter_open_uhb(0, 0, 0);
-			if(a && (INTERFACE_DEFAULT != interface)){
-				fprintf(stderr, "Found bootloader, ignoring specified interface\n");
-			}
-		}
+        usb_match_t list[16];
+        adapter_t *a = 0;
+        int count = find_usb_adapters(list, 16);
+
+        for (i=0; i<count && !a; i++) {
+            a = open_usb_match(&list[i], interface, speed);
+        }
         return a;
     }
 
@@ -509,6 +643,48 @@ static int is_usb_device(const char *port_name)
     return 1;
 }
 
+/*
+ * Search path for PE files, or 0.
+ */
+static const char *pe_path;
+
+void target_pe_path(const char *path)
+{
+    pe_path = path;
+}
+
+/*
+ * Replace the built-in PE by a file from the search path.
+ * The file must be linked at the PE address of the family,
+ * and fit in the least RAM of the family.
+ * Its version is not known until it runs.
+ */
+static void find_executive(target_t *t)
+{
+    const family_t *f = t->family;
+    char *filename;
+    unsigned addr, nwords, *code;
+
+    filename = pefile_find(pe_path, f->name);
+    if (! filename)
+        return;
+    code = pefile_read(filename, f->ram_kbytes * 1024 - f->pe_addr,
+        &addr, &nwords);
+    if (code && addr != f->pe_addr) {
+        fprintf(stderr, _("%s: PE must be loaded at %08x, not %08x\n"),
+            filename, f->pe_addr, addr);
+        code = 0;
+    }
+    if (! code) {
+        t->adapter->close(t->adapter, 0);
+        exit(1);
+    }
+    printf(_("    Executive: %s, %u bytes\n"), filename, nwords * 4);
+    t->pe_code = code;
+    t->pe_nwords = nwords;
+    t->pe_version = 0;
+}
+
 /*
  * Connect to JTAG adapter.
  */
@@ -523,9 +699,6 @@ target_t *target_open(const char *port_name, int baud_rate, int interface, int s
     }
     t->cpu_name = "Unknown";
 
-    /* Update pic2_tab[] array from the pic32prog.conf file. */
-    target_configure();
-
     /* Find adapter. */
     if (is_usb_device(port_name)) {
         t->adapter = open_usb_adapter(port_name, interface, speed);
@@ -547,19 +720,22 @@ target_t *target_open(const char *port_name, int baud_rate, int interface, int s
         exit(1);
     }
 
-    unsigned i;
-    for (i=0; (t->cpuid ^ pic32_tab[i].devid) & 0x0fffffff; i++) {
-        if (pic32_tab[i].devid == 0) {
-            /* Device not detected. */
-            fprintf(stderr, _("Unknown CPUID=%08x.\n"), t->cpuid);
-            t->adapter->close(t->adapter, 0);
-            exit(1);
-        }
+    const variant_t *v = find_variant(t->cpuid);
+    if (! v) {
+        /* Not a built-in chip: try the pic32prog.conf file. */
+        target_configure();
+        v = find_variant(t->cpuid);
     }
-    t->family = pic32_tab[i].family;
-    t->cpu_name = pic32_tab[i].name;
+    if (! v) {
+        /* Device not detected. */
+        fprintf(stderr, _("Unknown CPUID=%08x.\n"), t->cpuid);
+        t->adapter->close(t->adapter, 0);
+        exit(1);
+    }
+    t->family = v->family;
+    t->cpu_name = v->name;
     t->flash_addr = 0x1d000000;
-    t->flash_bytes = pic32_tab[i].flash_kbytes * 1024;
+    t->flash_bytes = v->flash_kbytes * 1024;
     if (! t->flash_bytes) {
         t->flash_addr = t->adapter->user_start;
         t->flash_bytes = t->adapter->user_nbytes;
@@ -567,7 +743,93 @@ target_t *target_open(const char *port_name, int baud_rate, int interface, int s
     }
     t->adapter->family_name = t->family->name;
     t->adapter->family_name_short = t->family->name_short;
+    t->adapter->erase_msec = t->family->erase_msec;
+    t->adapter->row_usec = t->family->row_usec;
+    t->adapter->page_erase_msec = t->family->page_erase_msec;
+
+    t->pe_code = t->family->pe_code;
+    t->pe_nwords = t->family->pe_nwords;
+    t->pe_version = t->family->pe_version;
+    if (pe_path && t->pe_nwords != 0)
+        find_executive(t);
+    return t;
+}
+
+/*
+ * Find a chip variant by name, like MX795F512L or PIC32MX795F512L.
+ * A family name, like mx3, gives the variant of this family
+ * with the largest flash memory.
+ * Return 0 when not found.
+ */
+static const variant_t *find_variant_by_name(const char *name)
+{
+    const variant_t *v, *found = 0;
+    unsigned i;
+
+    if (strncasecmp(name, "PIC32", 5) == 0)
+        name += 5;
+    for (i=0; i<PIC32_TABSZ + conf_count; i++) {
+        v = (i < PIC32_TABSZ) ? &pic32_tab[i] : &conf_tab[i - PIC32_TABSZ];
+        if (! v->name)
+            continue;
+        if (strcasecmp(name, v->name) == 0)
+            return v;
+        if (strcasecmp(name, v->family->name) == 0 &&
+            (! found || v->flash_kbytes > found->flash_kbytes))
+            found = v;
+    }
+    return found;
+}
+
+static void offline_close(adapter_t *a, int power_on)
+{
+    free(a);
+}
+
+/*
+ * Describe the chip given by name, with no adapter connected.
+ * Enough to plan programming: the adapter has default timings
+ * and no functions to access the chip.
+ */
+target_t *target_open_part(const char *part_name)
+{
+    const variant_t *v;
+    target_t *t;
+
+    v = find_variant_by_name(part_name);
+    if (! v) {
+        /* Not a built-in chip: try the pic32prog.conf file. */
+        target_configure();
+        v = find_variant_by_name(part_name);
+    }
+    if (! v || ! v->flash_kbytes) {
+        fprintf(stderr, _("Unknown part %s.\n"), part_name);
+        exit(1);
+    }
+    t = calloc(1, sizeof(target_t));
+    if (t)
+        t->adapter = calloc(1, sizeof(adapter_t));
+    if (! t || ! t->adapter) {
+        fprintf(stderr, _("Out of memory\n"));
+        exit(-1);
+    }
+    t->adapter->close = offline_close;
+    t->adapter->flags = AD_ERASE | AD_WRITE | AD_VERIFY_SPAN;
+
+    t->family = v->family;
+    t->cpu_name = v->name;
+    t->cpuid = v->devid;
+    t->flash_addr = 0x1d000000;
+    t->flash_bytes = v->flash_kbytes * 1024;
+    t->adapter->family_name = t->family->name;
+    t->adapter->family_name_short = t->family->name_short;
+    t->adapter->erase_msec = t->family->erase_msec;
+    t->adapter->row_usec = t->family->row_usec;
+    t->adapter->page_erase_msec = t->family->page_erase_msec;
 
+    t->pe_code = t->family->pe_code;
+    t->pe_nwords = t->family->pe_nwords;
+    t->pe_version = t->family->pe_version;
     return t;
 }
 
@@ -576,6 +838,8 @@ target_t *target_open(const char *port_name, int baud_rate, int interface, int s
  */
 void target_close(target_t *t, int power_on)
 {
+    if (debug_level > 0)
+        mwait_stats();
     t->adapter->close(t->adapter, power_on);
 }
 
@@ -609,34 +873,99 @@ unsigned target_block_size(target_t *t)
     return t->family->bytes_per_row;
 }
 
+static void add_region(target_region_t *map, int *n,
+    const char *name, unsigned addr, unsigned nbytes)
+{
+    if (nbytes == 0 || *n >= TARGET_MAXREGIONS)
+        return;
+    map[*n].name = name;
+    map[*n].addr = addr;
+    map[*n].nbytes = nbytes;
+    ++*n;
+}
+
 /*
- * Add an entry to the pic32_tab[] array.
+ * Get the list of memory regions, which hold the complete
+ * contents of the chip: program flash, boot flash, configuration
+ * words and device serial number.
+ * Return the number of regions.
+ */
+int target_memory_map(target_t *t, target_region_t *map)
+{
+    unsigned boot_bytes = target_boot_bytes(t);
+    int n = 0;
+
+    add_region(map, &n, "flash", 0x1d000000, t->flash_bytes);
+    add_region(map, &n, "boot", 0x1fc00000, boot_bytes);
+    switch (t->family->name_short) {
+    case FAMILY_MK:
+        /* Both boot flash panels, with configuration words. */
+        add_region(map, &n, "boot1", 0x1fc40000, boot_bytes);
+        add_region(map, &n, "boot2", 0x1fc60000, boot_bytes);
+        add_region(map, &n, "devsn", 0x1fc45020, 16);
+        break;
+    case FAMILY_MZ:
+        add_region(map, &n, "devsn", 0x1fc54020, 8);
+        break;
+    case FAMILY_MM:
+        /* Configuration words are outside of boot flash. */
+        add_region(map, &n, "config", 0x1fc00000 + t->family->devcfg_offset, 256);
+        break;
+    }
+    return n;
+}
+
+/*
+ * Size of flash erase page.
+ */
+unsigned target_page_size(target_t *t)
+{
+    return t->family->page_bytes;
+}
+
+/*
+ * Add an entry to the table of run-time variants.
  */
 void target_add_variant(char *name, unsigned id,
     char *family, unsigned flash_kbytes)
 {
+    static const family_t *family_tab[] = {
+        &family_mx1, &family_mx3, &family_mz, &family_mk,
+        &family_mm_gpl, &family_mm_gpm, 0,
+    };
+    const family_t *f;
+    variant_t *v;
     int i;
 
     //printf("'%s'\t%07x\t'%s'\t%uk\n", name, id, family, flash_kbytes);
-    for (i=0; i<TABSZ; i++) {
-        if (pic32_tab[i].devid == 0 ||
-            id == pic32_tab[i].devid) {
-            /* Add a new entry or update an existing one
-             * with new data from config file. */
-            pic32_tab[i].name = strdup(name);
-            pic32_tab[i].flash_kbytes = flash_kbytes;
-            if (strcmp(family, "MX1") == 0)
-                pic32_tab[i].family = &family_mx1;
-            else if (strcmp(family, "MX3") == 0)
-                pic32_tab[i].family = &family_mx3;
-            else if (strcmp(family, "MZ") == 0)
-                pic32_tab[i].family = &family_mz;
-            else {
-                fprintf(stderr, "%s: Unknown family=%s.\n", name, family);
-            }
+    for (i=0; family_tab[i]; i++) {
+        if (strcasecmp(family, family_tab[i]->name) == 0)
             break;
+    }
+    if (! family_tab[i]) {
+        fprintf(stderr, "%s: Unknown family=%s.\n", name, family);
+        return;
+    }
+    f = family_tab[i];
+
+    for (i=0; i<conf_count; i++) {
+        if (((id ^ conf_tab[i].devid) & 0x0fffffff) == 0)
+            break;
+    }
+    if (i == conf_count) {
+        /* Add a new entry. */
+        conf_tab = realloc(conf_tab, (conf_count + 1) * sizeof(variant_t));
+        if (! conf_tab) {
+            fprintf(stderr, _("Out of memory\n"));
+            exit(-1);
         }
+        conf_count++;
     }
+    v = &conf_tab[i];
+    v->devid = id;
+    v->name = strdup(name);
+    v->flash_kbytes = flash_kbytes;
+    v->family = f;
 }
 
 /*
@@ -644,9 +973,55 @@ void target_add_variant(char *name, unsigned id,
  */
 void target_use_executive(target_t *t)
 {
-    if (t->adapter->load_executive != 0 && t->family->pe_nwords != 0)
+    if (t->adapter->load_executive != 0 && t->pe_nwords != 0) {
         t->adapter->load_executive(t->adapter,
-            t->family->pe_code, t->family->pe_nwords, t->family->pe_version);
+            t->pe_code, t->pe_nwords, t->pe_version);
+        if (t->pe_version == 0 && t->adapter->pe_version < t->family->pe_version)
+            printf(_("PE version %04x is older than %04x: fast commands disabled.\n"),
+                t->adapter->pe_version, t->family->pe_version);
+    }
+}
+
+/*
+ * Commands of the built-in PE of the family.
+ */
+unsigned target_family_pe_caps(target_t *t)
+{
+    if (! t->family->pe_code)
+        return 0;
+    return PE_CAPS_COMMON | t->family->pe_caps;
+}
+
+/*
+ * Commands of the running PE.  The family gives the set of its
+ * built-in PE, and every later version is expected to keep it.
+ * An older PE is trusted only with the basic commands.
+ */
+unsigned target_pe_caps(target_t *t)
+{
+    unsigned caps = target_family_pe_caps(t);
+
+    if (t->adapter->pe_version < t->family->pe_version)
+        caps &= ~(PE_CAP_CLUSTER | PE_CAP_BLANK_CHECK | PE_CAP_CRC);
+    return caps;
+}
+
+/*
+ * Read a group of configuration words with a single block request,
+ * when the adapter supports it: the PE reads them in one command,
+ * and without PE the adapter batches the serial execution sequence.
+ */
+static void read_config(target_t *t, unsigned addr,
+    unsigned nwords, unsigned *data)
+{
+    if (t->adapter->read_data) {
+        t->adapter->read_data(t->adapter, addr, nwords, data);
+        return;
+    }
+    for (; nwords > 0; nwords--) {
+        *data++ = t->adapter->read_word(t->adapter, addr);
+        addr += 4;
+    }
 }
 
 /*
@@ -661,77 +1036,55 @@ void target_print_devcfg(target_t *t)
         uint32_t devcfg_addr = 0x1fc00000 + target_devcfg_offset(t);
         uint32_t offset_first = 0xc0;
         uint32_t offset_alternate = 0x40;
-        
-        uint32_t fdevopt = t->adapter->read_word(t->adapter, devcfg_addr + offset_first + 0x04);
-        uint32_t ficd    = t->adapter->read_word(t->adapter, devcfg_addr + offset_first + 0x08);
-        uint32_t fpor    = t->adapter->read_word(t->adapter, devcfg_addr + offset_first + 0x0c);
-        uint32_t fwdt    = t->adapter->read_word(t->adapter, devcfg_addr + offset_first + 0x10);
-        uint32_t foscsel = t->adapter->read_word(t->adapter, devcfg_addr + offset_first + 0x14);
-        uint32_t fsec    = t->adapter->read_word(t->adapter, devcfg_addr + offset_first + 0x18);
-        uint32_t afdevopt = t->adapter->read_word(t->adapter, devcfg_addr + offset_alternate + 0x04);
-        uint32_t aficd    = t->adapter->read_word(t->adapter, devcfg_addr + offset_alternate + 0x08);
-        uint32_t afpor    = t->adapter->read_word(t->adapter, devcfg_addr + offset_alternate + 0x0c);
-        uint32_t afwdt    = t->adapter->read_word(t->adapter, devcfg_addr + offset_alternate + 0x10);
-        uint32_t afoscsel = t->adapter->read_word(t->adapter, devcfg_addr + offset_alternate + 0x14);
-        uint32_t afsec    = t->adapter->read_word(t->adapter, devcfg_addr + offset_alternate + 0x18);
-        if (fdevopt == 0 || afdevopt == 0){
+        uint32_t cfg[6], acfg[6];
+
+        /* FDEVOPT, FICD, FPOR, FWDT, FOSCSEL, FSEC */
+        read_config(t, devcfg_addr + offset_first + 0x04, 6, cfg);
+        read_config(t, devcfg_addr + offset_alternate + 0x04, 6, acfg);
+        if (cfg[0] == 0 || acfg[0] == 0){
             fprintf(stderr, "Failed to read config value, or values are garbage\n");            
             return;
         } 
-        print_mm(fdevopt, ficd, fpor, fwdt, foscsel, fsec,
-                                afdevopt, aficd, afpor, afwdt, afoscsel, afsec,
+        print_mm(cfg[0], cfg[1], cfg[2], cfg[3], cfg[4], cfg[5],
+                                acfg[0], acfg[1], acfg[2], acfg[3], acfg[4], acfg[5],
 								0, 0, 0, 0, 0, 0);
     }
     else if (FAMILY_MK == t->family->name_short){
 		// Offset is set to BF1DEVCFG3 in Boot Flash 1!
         uint32_t devcfg_addr    = 0x1fc40000 + target_devcfg_offset(t);
-		
-		// Boot flash 1 area
-        uint32_t bf1devcfg3     = t->adapter->read_word(t->adapter, devcfg_addr);
-        uint32_t bf1devcfg2     = t->adapter->read_word(t->adapter, devcfg_addr + 0x04);
-        uint32_t bf1devcfg1     = t->adapter->read_word(t->adapter, devcfg_addr + 0x08);
-        uint32_t bf1devcfg0     = t->adapter->read_word(t->adapter, devcfg_addr + 0x0c);
-        uint32_t bf1devcp       = t->adapter->read_word(t->adapter, devcfg_addr + 0x1c);
-        uint32_t bf1devsign     = t->adapter->read_word(t->adapter, devcfg_addr + 0x2c);
-        uint32_t bf1seq 	    = t->adapter->read_word(t->adapter, devcfg_addr + 0x30);
+        uint32_t bf1[13], bf2[13], devsn[4];
+
+		// Boot flash 1 area: DEVCFG3..DEVCFG0, DEVCP, DEVSIGN, SEQ
+        read_config(t, devcfg_addr, 13, bf1);
 
 		// Boot flash 2 area
-        uint32_t bf2devcfg3 	= t->adapter->read_word(t->adapter, devcfg_addr + 0x20000);
-        uint32_t bf2devcfg2 	= t->adapter->read_word(t->adapter, devcfg_addr + 0x20000 + 0x04);
-        uint32_t bf2devcfg1 	= t->adapter->read_word(t->adapter, devcfg_addr + 0x20000 + 0x8);
-        uint32_t bf2devcfg0 	= t->adapter->read_word(t->adapter, devcfg_addr + 0x20000 + 0x0c);
-        uint32_t bf2devcp       = t->adapter->read_word(t->adapter, devcfg_addr + 0x20000 + 0x1c);
-        uint32_t bf2devsign     = t->adapter->read_word(t->adapter, devcfg_addr + 0x20000 + 0x2c);
-        uint32_t bf2seq 	    = t->adapter->read_word(t->adapter, devcfg_addr + 0x20000 + 0x30);
+        read_config(t, devcfg_addr + 0x20000, 13, bf2);
 
 		// DEVSNx registers
-        uint32_t devsn0         = t->adapter->read_word(t->adapter, 0x1FC45020);
-        uint32_t devsn1         = t->adapter->read_word(t->adapter, 0x1FC45024);
-        uint32_t devsn2         = t->adapter->read_word(t->adapter, 0x1FC45028);
-        uint32_t devsn3         = t->adapter->read_word(t->adapter, 0x1FC4502C);
+        read_config(t, 0x1FC45020, 4, devsn);
 
-		t->family->print_devcfg(bf1devcfg3, bf1devcfg2, bf1devcfg1, bf1devcfg0,
-				bf1devcp, bf1devsign, bf1seq,
-				bf2devcfg3, bf2devcfg2, bf2devcfg1, bf2devcfg0,
-				bf2devcp, bf2devsign, bf2seq,
-				devsn0, devsn1, devsn2, devsn3);
+		t->family->print_devcfg(bf1[0], bf1[1], bf1[2], bf1[3],
+				bf1[0x1c/4], bf1[0x2c/4], bf1[0x30/4],
+				bf2[0], bf2[1], bf2[2], bf2[3],
+				bf2[0x1c/4], bf2[0x2c/4], bf2[0x30/4],
+				devsn[0], devsn[1], devsn[2], devsn[3]);
     }
     else{
         /* MX, MZ */
         unsigned devcfg_addr = 0x1fc00000 + target_devcfg_offset(t);
-        unsigned devcfg3 = t->adapter->read_word(t->adapter, devcfg_addr);
-        unsigned devcfg2 = t->adapter->read_word(t->adapter, devcfg_addr + 4);
-        unsigned devcfg1 = t->adapter->read_word(t->adapter, devcfg_addr + 8);
-        unsigned devcfg0 = t->adapter->read_word(t->adapter, devcfg_addr + 12);
+        unsigned devcfg[4];
+
+        /* DEVCFG3, DEVCFG2, DEVCFG1, DEVCFG0 */
+        read_config(t, devcfg_addr, 4, devcfg);
 
-        if (devcfg3 == 0xffffffff && devcfg2 == 0xffffffff &&
-            devcfg1 == 0xffffffff && devcfg0 == 0x7fffffff)
+        if (devcfg[0] == 0xffffffff && devcfg[1] == 0xffffffff &&
+            devcfg[2] == 0xffffffff && devcfg[3] == 0x7fffffff)
             return;
-        if (devcfg3 == 0 && devcfg2 == 0 && devcfg1 == 0 && devcfg0 == 0)
+        if (devcfg[0] == 0 && devcfg[1] == 0 && devcfg[2] == 0 && devcfg[3] == 0)
             return;
 
         printf(_("Configuration:\n"));
-        t->family->print_devcfg(devcfg0, devcfg1, devcfg2, devcfg3,
+        t->family->print_devcfg(devcfg[3], devcfg[2], devcfg[1], devcfg[0],
                                 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
     }
 }
@@ -773,32 +1126,69 @@ void target_read_block(target_t *t, unsigned addr,
     //fprintf(stderr, "    done (addr = %x)\n", addr);
 }
 
+/*
+ * Check that memory is erased, without reading it.
+ * Return 1 when blank, 0 when not, or -1 when
+ * the adapter cannot tell.
+ */
+int target_blank_check(target_t *t, unsigned addr, unsigned nwords)
+{
+    if (! t->adapter->blank_check ||
+        ! (target_pe_caps(t) & PE_CAP_BLANK_CHECK))
+        return -1;
+    return t->adapter->blank_check(t->adapter, virt_to_phys(addr), nwords);
+}
+
 /*
  * Verify data.
  */
 void target_verify_block(target_t *t, unsigned addr,
     unsigned nwords, unsigned *data)
 {
-    unsigned i, word, expected, block[512];
+    unsigned i, n, word, expected, block[512];
 
     //fprintf(stderr, "%s: addr=%08x, nwords=%u, data=%08x...\n", __func__, addr, nwords, data[0]);
-    if (t->adapter->verify_data != 0) {
+    if (t->adapter->verify_data != 0 &&
+        (! t->adapter->load_executive || (target_pe_caps(t) & PE_CAP_CRC))) {
         t->adapter->verify_data(t->adapter, virt_to_phys(addr), nwords, data);
         return;
     }
 
-    t->adapter->read_data(t->adapter, addr, nwords, block);
-    for (i=0; i<nwords; i++) {
-        expected = data [i];
-        word = block [i];
-        if (word != expected) {
-            printf(_("\nerror at address %08X: file=%08X, mem=%08X\n"),
-                addr + i*4, expected, word);
-            exit(1);
+    for (; nwords > 0; nwords -= n, addr += n*4, data += n) {
+        n = nwords;
+        if (n > 512)
+            n = 512;
+        target_read_block(t, addr, n, block);
+        for (i=0; i<n; i++) {
+            expected = data [i];
+            word = block [i];
+            if (word != expected) {
+                printf(_("\nerror at address %08X: file=%08X, mem=%08X\n"),
+                    addr + i*4, expected, word);
+                exit(1);
+            }
         }
     }
 }
 
+/*
+ * Erase pages of flash memory, starting from the given address.
+ * Return 0 when not supported by the adapter.
+ */
+int target_erase_pages(target_t *t, unsigned addr, unsigned npages)
+{
+    unsigned page_bytes = target_page_size(t);
+
+    if (! t->adapter->erase_page)
+        return 0;
+    addr = virt_to_phys(addr);
+    for (; npages > 0; npages--) {
+        t->adapter->erase_page(t->adapter, addr);
+        addr += page_bytes;
+    }
+    return 1;
+}
+
 /*
  * Erase all Flash memory.
  */
@@ -857,6 +1247,82 @@ void target_program_block(target_t *t, unsigned addr,
     }
 }
 
+/*
+ * Can the running PE write a span of rows by one command.
+ */
+int target_has_cluster(target_t *t)
+{
+    return t->adapter->program_cluster != 0 &&
+        (target_pe_caps(t) & PE_CAP_CLUSTER);
+}
+
+/*
+ * Write a span of whole rows by PROGRAM_CLUSTER.
+ * Every run of non-empty rows goes under one PE command,
+ * with a single response at the end.
+ */
+void target_program_cluster(target_t *t, unsigned addr,
+    unsigned nwords, unsigned *data)
+{
+    unsigned words_per_row = t->family->bytes_per_row / 4;
+    unsigned n;
+
+    addr = virt_to_phys(addr);
+    while (nwords > 0) {
+        /* Skip empty rows. */
+        if (target_test_empty_block(data, words_per_row)) {
+            addr += words_per_row<<2;
+            data += words_per_row;
+            nwords -= words_per_row;
+            continue;
+        }
+        for (n=words_per_row; n<nwords; n+=words_per_row) {
+            if (target_test_empty_block(data + n, words_per_row))
+                break;
+        }
+        t->adapter->program_cluster(t->adapter, addr, n, data);
+        addr += n<<2;
+        data += n;
+        nwords -= n;
+    }
+}
+
+/*
+ * Write to flash memory by the smallest unit, allowed for
+ * configuration words: quad word on MZ and MK, double word on MM,
+ * single word on MX. Erased units are skipped.
+ */
+void target_program_units(target_t *t, unsigned addr,
+    unsigned nwords, unsigned *data)
+{
+    unsigned unit;
+
+    addr = virt_to_phys(addr);
+    if (t->family->pe_caps & PE_CAP_DOUBLE_WORD)
+        unit = 2;
+    else if (t->family->pe_caps & PE_CAP_QUAD_WORD)
+        unit = 4;
+    else
+        unit = 1;
+
+    for (; nwords >= unit; nwords -= unit, data += unit, addr += unit*4) {
+        if (target_test_empty_block(data, unit))
+            continue;
+        switch (unit) {
+        case 4:
+            t->adapter->program_quad_word(t->adapter, addr,
+                data[0], data[1], data[2], data[3]);
+            break;
+        case 2:
+            t->adapter->program_double_word(t->adapter, addr, data[0], data[1]);
+            break;
+        default:
+            t->adapter->program_word(t->adapter, addr, data[0]);
+            break;
+        }
+    }
+}
+
 /*
  * Program the configuration registers.
  */
@@ -934,7 +1400,7 @@ void target_program_devcfg(target_t *t, uint32_t arg0, uint32_t arg1,
     else{
 
         fprintf(stderr, "%s: devcfg0-3 = %08x %08x %08x %08x\n", __func__, arg0, arg1, arg2, arg3);
-        if (t->family->pe_version >= 0x0500) {
+        if (t->family->pe_caps & PE_CAP_QUAD_WORD) {
             /* Since pic32mz, the programming executive */
 
             t->adapter->program_quad_word(t->adapter, devcfg_addr, arg3,
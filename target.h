@@ -30,8 +30,26 @@ typedef struct {
     const unsigned  *pe_code;
     unsigned        pe_nwords;
     unsigned        pe_version;
+    unsigned        erase_msec;     /* Typical time of chip erase */
+    unsigned        page_bytes;     /* Size of erase page */
+    unsigned        pe_caps;        /* PE command to write a word, see below */
+    unsigned        row_usec;       /* Typical time of row write */
+    unsigned        page_erase_msec; /* Typical time of page erase */
+    unsigned        pe_addr;        /* Physical address of PE in RAM */
+    unsigned        ram_kbytes;     /* Least RAM size in the family */
 } family_t;
 
+/*
+ * Capabilities of programming executive.
+ */
+#define PE_CAP_WORD         0x01    /* PROGRAM of a single word */
+#define PE_CAP_DOUBLE_WORD  0x02    /* DOUBLE_WORD_PGRM */
+#define PE_CAP_QUAD_WORD    0x04    /* QUAD_WORD_PGRM */
+#define PE_CAP_CLUSTER      0x08    /* PROGRAM_CLUSTER */
+#define PE_CAP_PAGE_ERASE   0x10    /* PAGE_ERASE */
+#define PE_CAP_BLANK_CHECK  0x20    /* BLANK_CHECK */
+#define PE_CAP_CRC          0x40    /* GET_CRC */
+
 typedef struct {
     unsigned        devid;
     const char      *name;
@@ -47,11 +65,29 @@ typedef struct {
     unsigned        flash_addr;
     unsigned        flash_bytes;
     unsigned        boot_bytes;
+    const unsigned  *pe_code;       /* Built-in PE, or from file */
+    unsigned        pe_nwords;
+    unsigned        pe_version;     /* Expected version, or 0 for any */
 } target_t;
 
+/*
+ * Memory region of the target chip.
+ */
+typedef struct {
+    const char      *name;
+    unsigned        addr;           /* Physical address */
+    unsigned        nbytes;
+} target_region_t;
+
+#define TARGET_MAXREGIONS   8
+
 target_t *target_open(const char *port, int baud_rate, int interface, int speed);
+target_t *target_open_part(const char *part_name);
 void target_close(target_t *t, int power_on);
 void target_use_executive(target_t *t);
+void target_pe_path(const char *path);
+unsigned target_pe_caps(target_t *t);
+unsigned target_family_pe_caps(target_t *t);
 void target_configure(void);
 void target_add_variant(char *name, unsigned id, char *family, unsigned flash_kbytes);
 
@@ -61,17 +97,26 @@ unsigned target_flash_width(target_t *t);
 unsigned target_flash_bytes(target_t *t);
 unsigned target_boot_bytes(target_t *t);
 unsigned target_block_size(target_t *t);
+unsigned target_page_size(target_t *t);
 unsigned target_devcfg_offset(target_t *t);
 void target_print_devcfg(target_t *t);
+int target_memory_map(target_t *t, target_region_t *map);
 
 void target_read_block(target_t *t, unsigned addr,
     unsigned nwords, unsigned *data);
+int target_blank_check(target_t *t, unsigned addr, unsigned nwords);
 void target_verify_block(target_t *t, unsigned addr,
     unsigned nwords, unsigned *data);
 
 int target_erase(target_t *t);
+int target_erase_pages(target_t *t, unsigned addr, unsigned npages);
 void target_program_block(target_t *t, unsigned addr,
     unsigned nwords, unsigned *data);
+void target_program_units(target_t *t, unsigned addr,
+    unsigned nwords, unsigned *data);
+int target_has_cluster(target_t *t);
+void target_program_cluster(target_t *t, unsigned addr,
+    unsigned nwords, unsigned *data);
 void target_program_devcfg(target_t *t, uint32_t arg0, uint32_t arg1,
         uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5, 
         uint32_t arg6, uint32_t arg7, uint32_t arg8, uint32_t arg9, 